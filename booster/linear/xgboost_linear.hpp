@@ -36,12 +36,12 @@ namespace xgboost{
                 model.InitModel();
             }
         public:
-            virtual void DoBoost( std::vector<float> &grad, 
-                                  std::vector<float> &hess,
+            virtual void DoBoost( GPairView gpair,
                                   const FMatrix &fmat,
                                   const std::vector<unsigned> &root_index ){
-                utils::Assert( grad.size() < UINT_MAX, "number of instance exceed what we can handle" );
-                this->UpdateWeights( grad, hess, fmat );
+                utils::Assert( gpair.size() < UINT_MAX, "number of instance exceed what we can handle" );
+                utils::Assert( fmat.HaveColAccess(), "LinearBooster: need column access matrix" );
+                this->UpdateWeights( gpair, fmat );
             }
             inline float Predict( const FMatrix &fmat, bst_uint ridx, unsigned root_index ){
                 float sum = model.bias();
@@ -157,43 +157,51 @@ namespace xgboost{
             ParamTrain param;
         protected:
             // update weights, should work for any FMatrix
-            inline void UpdateWeights( std::vector<float> &grad,                       
-                                       const std::vector<float> &hess,
+            inline void UpdateWeights( GPairView &gpair,
                                        const FMatrix &smat ){
                 {// optimize bias
                     double sum_grad = 0.0, sum_hess = 0.0;
-                    for( size_t i = 0; i < grad.size(); i ++ ){
-                        sum_grad += grad[ i ]; sum_hess += hess[ i ];
+                    for( size_t i = 0; i < gpair.size(); i ++ ){
+                        sum_grad += gpair[ i ].grad; sum_hess += gpair[ i ].hess;
                     }
                     // remove bias effect
                     double dw = param.learning_rate * param.CalcDeltaBias( sum_grad, sum_hess, model.bias() );
                     model.bias() += dw;
                     // update grad value 
-                    for( size_t i = 0; i < grad.size(); i ++ ){
-                        grad[ i ] += dw * hess[ i ];
+                    for( size_t i = 0; i < gpair.size(); i ++ ){
+                        gpair[ i ].grad += dw * gpair[ i ].hess;
                     }
                 }
 
-                // optimize weight
-                const unsigned nfeat= (unsigned)smat.NumCol();                           
-                for( unsigned i = 0; i < nfeat; i ++ ){
-                    if( !smat.GetSortedCol( i ).Next() ) continue;
-                    double sum_grad = 0.0, sum_hess = 0.0;
-                    for( typename FMatrix::ColIter it = smat.GetSortedCol(i); it.Next(); ){
-                        const float v = it.fvalue();
-                        sum_grad += grad[ it.rindex() ] * v;
-                        sum_hess += hess[ it.rindex() ] * v * v;
-                    }
-                    float w = model.weight[ i ];
-                    double dw = param.learning_rate * param.CalcDelta( sum_grad, sum_hess, w );
-                    model.weight[ i ] += dw;
-                    // update grad value 
-                    for( typename FMatrix::ColIter it = smat.GetSortedCol(i); it.Next(); ){
-                        const float v = it.fvalue();
-                        grad[ it.rindex() ] += hess[ it.rindex() ] * v * dw;
+                // optimize weight, columns are visited block by block
+                for( unsigned b = 0; b < smat.NumColBlock(); b ++ ){
+                    smat.FetchColBlock( b );
+                    const unsigned fend = (unsigned)smat.ColBlockBegin( b + 1 );
+                    for( unsigned i = (unsigned)smat.ColBlockBegin( b ); i < fend; i ++ ){
+                        this->UpdateWeight( i, gpair, smat );
                     }
                 }
             }
+            // update weight of feature i, the column of i must be accessible
+            inline void UpdateWeight( unsigned i,
+                                      GPairView &gpair,
+                                      const FMatrix &smat ){
+                if( !smat.GetSortedCol( i ).Next() ) return;
+                double sum_grad = 0.0, sum_hess = 0.0;
+                for( typename FMatrix::ColIter it = smat.GetSortedCol(i); it.Next(); ){
+                    const float v = it.fvalue();
+                    sum_grad += gpair[ it.rindex() ].grad * v;
+                    sum_hess += gpair[ it.rindex() ].hess * v * v;
+                }
+                float w = model.weight[ i ];
+                double dw = param.learning_rate * param.CalcDelta( sum_grad, sum_hess, w );
+                model.weight[ i ] += dw;
+                // update grad value 
+                for( typename FMatrix::ColIter it = smat.GetSortedCol(i); it.Next(); ){
+                    const float v = it.fvalue();
+                    gpair[ it.rindex() ].grad += gpair[ it.rindex() ].hess * v * dw;
+                }
+            }
         };
     };
 };
@@ -8,15 +8,24 @@
  * \author Tianqi Chen: tianqi.tchen@gmail.com 
  */
 #include <vector>
+#include <queue>
+#include <algorithm>
 #include "xgboost_tree_model.h"
+#include "../../utils/xgboost_quantile.h"
+#include "../../utils/xgboost_random.h"
+#include "xgboost_split_kernel.hpp"
 
 namespace xgboost{
     namespace booster{
         class BaseTreeMaker{
+        public:
+            struct Workspace;
         protected:
             BaseTreeMaker( RegTree &tree,
-                           const TreeParamTrain &param )
-                : tree( tree ), param( param ){}
+                           const TreeParamTrain &param,
+                           Workspace &wspace )
+                : qexpand( wspace.qexpand ), snode( wspace.snode ), prune_parent( wspace.prune_parent ),
+                  tree( tree ), param( param ){}
         protected:
             // statistics that is helpful to decide a split
             struct SplitEntry{
@@ -84,6 +93,20 @@ namespace xgboost{
                     weight = root_gain = 0.0f;
                 }
             };
+        public:
+            /*! 
+             * \brief buffers of a tree maker that outlive the maker, so that a maker made in each boosting round
+             *        resets the space left by the previous round instead of allocating it again,
+             *        each tree maker extends it with its own buffers
+             */
+            struct Workspace{
+                /*! \brief queue of nodes to be expanded */
+                std::vector<int> qexpand;
+                /*! \brief TreeNode Data: statistics for each constructed node, the derived class must maintain this */
+                std::vector<NodeEntry> snode;
+                /*! \brief parent of each node before pruning, -1 for root */
+                std::vector<int> prune_parent;
+            };
         private:
             // try to prune off current leaf, return true if successful
             inline void TryPruneLeaf( int nid, int depth ){
@@ -104,6 +127,11 @@ namespace xgboost{
             /*! \brief do prunning of a tree */
             inline int DoPrune( void ){
                 this->stat_num_pruned = 0;
+                // pruning removes the parent of deleted nodes, keep it to find the leaf of rows in them
+                prune_parent.resize( tree.param.num_nodes );
+                for( int nid = 0; nid < tree.param.num_nodes; ++ nid ){
+                    prune_parent[ nid ] = tree[ nid ].is_root() ? -1 : tree[ nid ].parent();
+                }
                 // initialize auxiliary statistics
                 for( int nid = 0; nid < tree.param.num_nodes; ++ nid ){
                     tree.stat( nid ).leaf_child_cnt = 0;
@@ -115,6 +143,64 @@ namespace xgboost{
                 }
                 return this->stat_num_pruned;
             }
+            /*!
+             * \brief get the leaf after pruning, given the leaf before pruning
+             * \param nid leaf before pruning
+             * \return the leaf node in the pruned tree
+             */
+            inline int PrunedLeaf( int nid ) const{
+                // deleted nodes are not roots but have no parent
+                while( nid >= tree.param.num_roots && tree[ nid ].is_root() ){
+                    nid = prune_parent[ nid ];
+                }
+                return nid;
+            }
+        protected:
+            /*! \brief weighted quantile summary used to propose candidate splits */
+            typedef utils::WQSummary<float,double> WQSummary;
+            /*! 
+             * \brief propose candidate split values of a feature in approximate mode
+             * \param summary summary of feature values weighted by hessian
+             * \param tmp temp space
+             * \param cut output candidate split values in increasing order, the split puts fvalue < cut[k] to the left
+             */
+            inline void ProposeCut( const WQSummary &summary, WQSummary &tmp, std::vector<float> &cut ) const{
+                const size_t max_size = std::max( static_cast<size_t>( 1.0f / param.sketch_eps ), (size_t)1 ) + 1;
+                tmp.SetPrune( summary, max_size );
+                cut.clear();
+                // the minimum value gives empty left child, skip it
+                for( size_t i = 1; i < tmp.data.size(); ++ i ){
+                    cut.push_back( tmp.data[i].value );
+                }
+            }
+        protected:
+            /*!
+             * \brief keep a random subset of ratio of the features in findex, at least one feature is kept,
+             *        findex is shuffled, nothing is drawn when ratio is not below 1
+             */
+            inline static void SampleFeat( std::vector<int> &findex, float ratio ){
+                if( !( ratio < 1.0f ) || findex.size() == 0 ) return;
+                random::Shuffle( findex );
+                const size_t n = static_cast<size_t>( ratio * findex.size() + 0.5f );
+                findex.resize( std::max( n, (size_t)1 ) );
+            }
+            /*!
+             * \brief sample the features scanned in the next level by colsample_bylevel, feat_mask of a feature is
+             *        0 if it is not sampled for the tree, 1 if it is, and 2 if it is also sampled for the level
+             * \param feat_mask PerFeature: sampling state of each feature
+             * \param fbuf temp space
+             */
+            inline void SampleLevelFeat( std::vector<char> &feat_mask, std::vector<int> &fbuf ) const{
+                fbuf.clear();
+                for( size_t i = 0; i < feat_mask.size(); ++ i ){
+                    if( feat_mask[i] == 0 ) continue;
+                    feat_mask[i] = 1; fbuf.push_back( static_cast<int>( i ) );
+                }
+                SampleFeat( fbuf, param.colsample_bylevel );
+                for( size_t i = 0; i < fbuf.size(); ++ i ){
+                    feat_mask[ fbuf[i] ] = 2;
+                }
+            }
         protected:
             /*! \brief update queue expand add in new leaves */
             inline void UpdateQueueExpand( std::vector<int> &qexpand ){
@@ -129,14 +215,45 @@ namespace xgboost{
                 // use new nodes for qexpand
                 qexpand = newnodes;
             }
+        protected:
+            /*! \brief candidate node in loss guided growth */
+            struct ExpandEntry{
+                /*! \brief node id */
+                int nid;
+                /*! \brief depth of the node */
+                int depth;
+                /*! \brief loss change of the best split of the node */
+                float loss_chg;
+                /*! \brief order in which the node is pushed */
+                unsigned timestamp;
+                ExpandEntry( int nid, int depth, float loss_chg, unsigned timestamp )
+                    : nid( nid ), depth( depth ), loss_chg( loss_chg ), timestamp( timestamp ){}
+                // the queue pops the largest loss change first, and the earlier node when loss changes equal
+                inline bool operator<( const ExpandEntry &b ) const{
+                    if( loss_chg == b.loss_chg ) return timestamp > b.timestamp;
+                    return loss_chg < b.loss_chg;
+                }
+            };
+            /*! \brief priority queue of candidate nodes */
+            typedef std::priority_queue<ExpandEntry> ExpandQueue;
+            /*! 
+             * \brief whether a candidate node popped from the queue should be split in loss guided growth
+             * \param e the candidate node
+             * \param num_leaves current number of leaves in the tree
+             */
+            inline bool NeedExpand( const ExpandEntry &e, int num_leaves ) const{
+                if( !( e.loss_chg > rt_eps ) ) return false;
+                if( param.max_depth > 0 && e.depth >= param.max_depth ) return false;
+                return param.max_leaves <= 0 || num_leaves < param.max_leaves;
+            }
         protected:
             // local helper tmp data structure
             // statistics
             int stat_num_pruned;
-            /*! \brief queue of nodes to be expanded */
-            std::vector<int> qexpand;
-            /*! \brief TreeNode Data: statistics for each constructed node, the derived class must maintain this */
-            std::vector<NodeEntry> snode;
+            // buffers in the workspace, see Workspace
+            std::vector<int> &qexpand;
+            std::vector<NodeEntry> &snode;
+            std::vector<int> &prune_parent;
         protected:
             // original data that supports tree construction
             RegTree &tree;
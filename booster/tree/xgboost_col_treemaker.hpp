@@ -8,53 +8,104 @@
  */
 // use openmp
 #include <vector>
+#include <climits>
+#include <algorithm>
+#include <functional>
 #include "xgboost_tree_model.h"
 #include "../../utils/xgboost_omp.h"
 #include "../../utils/xgboost_random.h"
 #include "../../utils/xgboost_fmap.h"
 #include "xgboost_base_treemaker.hpp"
+#include "xgboost_row_treemaker.hpp"
 
 namespace xgboost{
     namespace booster{
         template<typename FMatrix>
         class ColTreeMaker : protected BaseTreeMaker{
         public:
+            struct Workspace;
             ColTreeMaker( RegTree &tree,
                           const TreeParamTrain &param, 
-                          const std::vector<float> &grad,
-                          const std::vector<float> &hess,
+                          const GPairView &gpair,
                           const FMatrix &smat, 
                           const std::vector<unsigned> &root_index, 
-                          const utils::FeatConstrain  &constrain )
-                : BaseTreeMaker( tree, param ), 
-                  grad(grad), hess(hess), 
-                  smat(smat), root_index(root_index), constrain(constrain) {
-                utils::Assert( grad.size() == hess.size(), "booster:invalid input" );
-                utils::Assert( smat.NumRow() == hess.size(), "booster:invalid input" );
-                utils::Assert( root_index.size() == 0 || root_index.size() == hess.size(), "booster:invalid input" );                
+                          const utils::FeatConstrain  &constrain,
+                          Workspace &wspace,
+                          bool hybrid = false )
+                : BaseTreeMaker( tree, param, wspace ), 
+                  feat_index( wspace.feat_index ), block_feat( wspace.block_feat ), feat_mask( wspace.feat_mask ),
+                  block_level( wspace.block_level ), position( wspace.position ),
+                  active( wspace.active ), ccol( wspace.ccol ), ccol_ptr( wspace.ccol_ptr ), stemp( wspace.stemp ),
+                  cand_buf( wspace.cand_buf ), segs( wspace.segs ), qindex( wspace.qindex ), seg_stat( wspace.seg_stat ),
+                  seg_start( wspace.seg_start ), seg_best( wspace.seg_best ), seg_temp( wspace.seg_temp ),
+                  node_slot( wspace.node_slot ), fcut( wspace.fcut ), bundle_order( wspace.bundle_order ),
+                  bcol( wspace.bcol ), bcol_ptr( wspace.bcol_ptr ), bundle_nodes( wspace.bundle_nodes ), row_space( wspace.row_space ),
+                  gpair(gpair), 
+                  smat(smat), root_index(root_index), constrain(constrain), hybrid(hybrid) {
+                utils::Assert( smat.NumRow() == gpair.size(), "booster:invalid input" );
+                utils::Assert( root_index.size() == 0 || root_index.size() == gpair.size(), "booster:invalid input" );                
                 utils::Assert( smat.HaveColAccess(), "ColTreeMaker: need column access matrix" );
             }
             inline void Make( int& stat_max_depth, int& stat_num_pruned ){
                 this->InitData();
                 this->InitNewNode( this->qexpand );
+                if( param.approx_method != 0 ) this->ProposeCuts();
                 stat_max_depth = 0;
                 
-                for( int depth = 0; depth < param.max_depth; ++ depth ){
-                    this->FindSplit( depth );
-                    this->UpdateQueueExpand( this->qexpand );
-                    this->InitNewNode( this->qexpand );
-                    // if nothing left to be expand, break
-                    if( qexpand.size() == 0 ) break;
-                    stat_max_depth = depth + 1;
-                }
-                // set all the rest expanding nodes to leaf
-                for( size_t i = 0; i < qexpand.size(); ++ i ){
-                    const int nid = qexpand[i];
-                    tree[ nid ].set_leaf( snode[nid].weight * param.learning_rate );                        
+                if( param.grow_policy == 1 ){
+                    this->MakeLossGuide( stat_max_depth );
+                }else{
+                    for( int depth = 0; depth < param.max_depth; ++ depth ){
+                        this->SetLevelFeat();
+                        if( hybrid ){
+                            this->HandOffSmallNodes( depth, stat_max_depth );
+                            if( qexpand.size() == 0 ) break;
+                        }
+                        this->CompactCols();
+                        this->FindSplit();
+                        this->ApplySplit();
+                        this->UpdatePosition();
+                        this->UpdateQueueExpand( this->qexpand );
+                        this->InitNewNode( this->qexpand );
+                        // if nothing left to be expand, break
+                        if( qexpand.size() == 0 ) break;
+                        if( param.approx_method == 2 ) this->ProposeCuts();
+                        stat_max_depth = depth + 1;
+                    }
+                    // set all the rest expanding nodes to leaf
+                    for( size_t i = 0; i < qexpand.size(); ++ i ){
+                        const int nid = qexpand[i];
+                        tree[ nid ].set_leaf( snode[nid].weight * param.learning_rate );                        
+                    }
                 }
                 // start prunning the tree
                 stat_num_pruned = this->DoPrune();
             }
+            /*!
+             * \brief get the leaf each instance reached, call after Make
+             * \param leaf output leaf of each instance in the pruned tree, -1 if the instance is not used in training
+             */
+            inline void GetLeafPosition( std::vector<int> &leaf ) const{
+                leaf.resize( position.size() );
+                const unsigned ndata = static_cast<unsigned>( position.size() );
+                #pragma omp parallel for schedule( static )
+                for( unsigned i = 0; i < ndata; ++ i ){
+                    const int nid = position[i];
+                    if( nid == kUnused ){
+                        leaf[i] = -1;
+                    }else{
+                        leaf[i] = this->PrunedLeaf( nid >= 0 ? nid : ~nid );
+                    }
+                }
+            }
+            /*! \return number of column entries visited when enumerating splits in last Make */
+            inline size_t NumScanEntry( void ) const{
+                return scan_entry;
+            }
+            /*! \return seconds spent in enumerating splits in last Make */
+            inline double ScanTime( void ) const{
+                return scan_time;
+            }
         private:
             /*! \brief per thread x per node entry to store tmp data */
             struct ThreadEntry{
@@ -64,6 +115,8 @@ namespace xgboost{
                 double sum_hess;
                 /*! \brief last feature value scanned */
                 float  last_fvalue;
+                /*! \brief position of next candidate split after last_fvalue, used in approximate mode */
+                unsigned cut_pos;
                 /*! \brief current best solution */
                 SplitEntry best;
                 /*! \brief constructor */
@@ -75,6 +128,89 @@ namespace xgboost{
                     sum_grad = sum_hess = 0.0;
                 }
             };
+            /*! \brief part of a sorted column that is scanned by one thread */
+            struct Segment{
+                /*! \brief feature id */
+                unsigned fid;
+                /*! \brief entries of the segment, in ascending order of feature value */
+                const typename FMatrix::REntry *begin, *end;
+                /*! \brief whether the segment is the first or the last one of its column */
+                bool head, tail;
+            };
+            /*! \brief statistics of one node in a column segment */
+            struct SegStat{
+                /*! \brief sum of gradient statistics */
+                double sum_grad, sum_hess;
+                /*! \brief feature value of the first and last instance of the node */
+                float first_fvalue, last_fvalue;
+                /*! \brief constructor */
+                SegStat( void ){
+                    sum_grad = sum_hess = 0.0;
+                    first_fvalue = last_fvalue = 0.0f;
+                }
+                /*! \brief add an instance, instances come in ascending order of feature value */
+                inline void Add( const bst_gpair &p, float fvalue ){
+                    if( sum_hess == 0.0 ) first_fvalue = fvalue;
+                    sum_grad += p.grad; sum_hess += p.hess;
+                    last_fvalue = fvalue;
+                }
+                /*! \brief append the statistics of next segment in the scan, last_fvalue follows the scan direction */
+                inline void Append( const SegStat &s, bool is_forward_search ){
+                    if( s.sum_hess == 0.0 ) return;
+                    sum_grad += s.sum_grad; sum_hess += s.sum_hess;
+                    last_fvalue = is_forward_search ? s.last_fvalue : s.first_fvalue;
+                }
+            };
+        public:
+            /*! \brief buffers of the column tree maker, see BaseTreeMaker::Workspace */
+            struct Workspace : public BaseTreeMaker::Workspace{
+                // Per feature: shuffle index of each feature index
+                std::vector<int> feat_index;
+                // PerColBlock: positions in feat_index of features in each column block
+                std::vector< std::vector<unsigned> > block_feat;
+                // PerFeature: 0 if the feature is not sampled for the tree, 1 if it is, 2 if it is also sampled for the current level
+                std::vector<char> feat_mask;
+                // PerColBlock: positions in feat_index of features sampled for the current level in each column block
+                std::vector< std::vector<unsigned> > block_level;
+                // Instance Data: current node position in the tree of each instance,
+                // ~nid once the instance is in leaf nid, kUnused if the instance is not used
+                std::vector<int> position;
+                // instances whose position is a node being expanded, only kept in level wise growth
+                std::vector<bst_uint> active;
+                // compacted sorted columns: entries of active instances, indexed by ccol_ptr of each feature,
+                // empty if the columns are not compacted
+                std::vector<typename FMatrix::REntry> ccol;
+                std::vector<size_t> ccol_ptr;
+                // PerThread x PerTreeNode: statistics for per thread construction
+                std::vector< std::vector<ThreadEntry> > stemp;
+                // PerThread: split candidates waiting for evaluation
+                std::vector<SplitCandBuffer> cand_buf;
+                // segments of long columns in current column block, segments of one column are stored together
+                std::vector<Segment> segs;
+                // PerTreeNode: position of expanding node in qexpand
+                std::vector<int> qindex;
+                // PerSegment x PerExpandNode: statistics in the segment
+                std::vector<SegStat> seg_stat;
+                // PerDirection x PerSegment x PerExpandNode: state the segment scan starts from, and best split found in it
+                std::vector<SegStat> seg_start;
+                std::vector<SplitEntry> seg_best;
+                // PerThread x PerTreeNode: statistics of segment scan
+                std::vector< std::vector<ThreadEntry> > seg_temp;
+                // approximate mode, PerTreeNode: candidate slot of each node
+                std::vector<unsigned> node_slot;
+                // approximate mode, PerFeature x PerSlot: candidate split values, indexed by position in feat_index
+                std::vector< std::vector<float> > fcut;
+                // feature bundling, bundles with features sampled for the current level, bundled features are left out of feat_index
+                std::vector<unsigned> bundle_order;
+                // feature bundling, compacted shared columns of bundles, indexed by bcol_ptr of each position
+                // in the bundle index, empty if the columns are not compacted
+                std::vector<typename FMatrix::REntry> bcol;
+                std::vector<size_t> bcol_ptr;
+                // feature bundling, PerThread: nodes hit by the bundled feature being scanned
+                std::vector< std::vector<int> > bundle_nodes;
+                // hybrid mode, buffers of the row based expansion
+                typename RowTreeMaker<FMatrix>::Workspace row_space;
+            };
         private:
             // make leaf nodes for all qexpand, update node statistics, mark leaf value
             inline void InitNewNode( const std::vector<int> &qexpand ){
@@ -85,14 +221,17 @@ namespace xgboost{
                     snode.resize( tree.param.num_nodes, NodeEntry() );
                 }
 
-                const unsigned ndata = static_cast<unsigned>( position.size() );
+                // level wise growth only visits the active instances
+                const bool use_active = param.grow_policy == 0;
+                const unsigned ndata = static_cast<unsigned>( use_active ? active.size() : position.size() );
                 
                 #pragma omp parallel for schedule( static )
-                for( unsigned i = 0; i < ndata; ++ i ){
+                for( unsigned j = 0; j < ndata; ++ j ){
                     const int tid = omp_get_thread_num();
+                    const bst_uint i = use_active ? active[j] : j;
                     if( position[i] < 0 ) continue; 
-                    stemp[tid][ position[i] ].sum_grad += grad[i];
-                    stemp[tid][ position[i] ].sum_hess += hess[i];
+                    stemp[tid][ position[i] ].sum_grad += gpair[i].grad;
+                    stemp[tid][ position[i] ].sum_hess += gpair[i].hess;
                 }
 
                 for( size_t j = 0; j < qexpand.size(); ++ j ){
@@ -116,15 +255,73 @@ namespace xgboost{
                 }
             }
         private:
-            // enumerate the split values of specific feature
+            // evaluate the buffered candidates of feature fid and update the best split of their nodes in scan order
+            inline void UpdateBest( SplitCandBuffer &cbuf, const unsigned fid, std::vector<ThreadEntry> &temp, bool is_forward_search ){
+                cbuf.Eval( param, kernel );
+                for( size_t i = 0; i < cbuf.Size(); ++ i ){
+                    temp[ cbuf.nid[i] ].best.Update( cbuf.loss_chg[i], fid, cbuf.split_value[i], !is_forward_search );
+                }
+                cbuf.Clear();
+            }
+            // instances are visited in feature order, fetch position and gradient of a later instance while working on this one
+            template<typename Iter>
+            inline void PrefetchAhead( const Iter &it ){
+                const bst_uint pidx = it.rindex_ahead( static_cast<size_t>( param.prefetch_dist ) );
+                utils::Prefetch( &position[ pidx ] );
+                utils::Prefetch( &gpair[ pidx ] );
+            }
+            // enumerate the split values of specific feature, return number of entries visited
             template<typename Iter>
-            inline void EnumerateSplit( Iter it, const unsigned fid, std::vector<ThreadEntry> &temp, bool is_forward_search ){
+            inline size_t EnumerateSplit( Iter it, const unsigned fid, std::vector<ThreadEntry> &temp,
+                                          SplitCandBuffer &cbuf, bool is_forward_search ){
                 // clear all the temp statistics
                 for( size_t j = 0; j < qexpand.size(); ++ j ){
                     temp[ qexpand[j] ].ClearStats();
                 }
-                
+                const size_t nvisit = this->ScanSplit( it, fid, temp, cbuf, is_forward_search );
+                this->FinishSplit( fid, temp, is_forward_search, qexpand );
+                return nvisit;
+            }
+            // enumerate the split values of the features in bundle b along the shared column, the statistics
+            // of each feature are finished and cleared only for the nodes it hits, return number of entries visited
+            inline size_t EnumerateBundle( unsigned b, std::vector<ThreadEntry> &temp, SplitCandBuffer &cbuf, std::vector<int> &nodes ){
+                for( size_t j = 0; j < qexpand.size(); ++ j ){
+                    temp[ qexpand[j] ].ClearStats();
+                }
+                size_t nvisit = 0;
+                for( unsigned k = bundle->bundle_ptr[b]; k < bundle->bundle_ptr[b+1]; ++ k ){
+                    const unsigned fid = bundle->feat[k];
+                    if( feat_mask[ fid ] != 2 ) continue;
+                    if( param.need_forward_search() ){
+                        nvisit += this->EnumerateBundleFeat( this->BundleCol(k), fid, temp, cbuf, nodes, true );
+                    }
+                    if( param.need_backward_search() ){
+                        nvisit += this->EnumerateBundleFeat( this->ReverseBundleCol(k), fid, temp, cbuf, nodes, false );
+                    }
+                }
+                return nvisit;
+            }
+            // enumerate the split values of one bundled feature, temp is left clear for the next feature
+            template<typename Iter>
+            inline size_t EnumerateBundleFeat( Iter it, const unsigned fid, std::vector<ThreadEntry> &temp,
+                                               SplitCandBuffer &cbuf, std::vector<int> &nodes, bool is_forward_search ){
+                nodes.clear();
+                const size_t nvisit = this->ScanSplit( it, fid, temp, cbuf, is_forward_search, &nodes );
+                this->FinishSplit( fid, temp, is_forward_search, nodes );
+                for( size_t j = 0; j < nodes.size(); ++ j ){
+                    temp[ nodes[j] ].ClearStats();
+                }
+                return nvisit;
+            }
+            // scan entries of a feature from the statistics in temp, nodes hit first in the scan are added to hit
+            // if it is not NULL, return number of entries visited
+            template<typename Iter>
+            inline size_t ScanSplit( Iter it, const unsigned fid, std::vector<ThreadEntry> &temp,
+                                     SplitCandBuffer &cbuf, bool is_forward_search, std::vector<int> *hit = NULL ){
+                size_t nvisit = 0;
                 while( it.Next() ){
+                    ++ nvisit;
+                    if( param.prefetch_dist != 0 ) this->PrefetchAhead( it );
                     const bst_uint ridx = it.rindex();
                     const int nid = position[ ridx ];
                     if( nid < 0 ) continue;
@@ -134,12 +331,93 @@ namespace xgboost{
 
                     // test if first hit, this is fine, because we set 0 during init
                     if( e.sum_hess == 0.0 ){
-                        e.sum_grad = grad[ ridx ];
-                        e.sum_hess = hess[ ridx ];
+                        e.sum_grad = gpair[ ridx ].grad;
+                        e.sum_hess = gpair[ ridx ].hess;
                         e.last_fvalue = fvalue;
+                        if( hit != NULL ) hit->push_back( nid );
                     }else{
                         // try to find a split
                         if( fabsf(fvalue - e.last_fvalue) > rt_2eps && e.sum_hess >= param.min_child_weight ){
+                            const double csum_hess = snode[ nid ].sum_hess - e.sum_hess;
+                            if( csum_hess >= param.min_child_weight ){
+                                const double csum_grad = snode[nid].sum_grad - e.sum_grad; 
+                                // loss change is evaluated later together with other candidates
+                                if( cbuf.Push( e.sum_grad, e.sum_hess, csum_grad, csum_hess, snode[nid].weight, snode[nid].root_gain,
+                                               nid, (fvalue + e.last_fvalue) * 0.5f ) ){
+                                    this->UpdateBest( cbuf, fid, temp, is_forward_search );
+                                }
+                            }
+                        }
+                        // update the statistics
+                        e.sum_grad += gpair[ ridx ].grad;
+                        e.sum_hess += gpair[ ridx ].hess;
+                        e.last_fvalue = fvalue;
+                    }
+                }
+                this->UpdateBest( cbuf, fid, temp, is_forward_search );
+                return nvisit;
+            }
+            // after the scan of a feature, check if it is possible to include all sum statistics of nodes
+            inline void FinishSplit( const unsigned fid, std::vector<ThreadEntry> &temp, bool is_forward_search,
+                                     const std::vector<int> &nodes ){
+                for( size_t i = 0; i < nodes.size(); ++ i ){
+                    const int nid = nodes[ i ];
+                    ThreadEntry &e = temp[ nid ];
+                    const double csum_hess = snode[nid].sum_hess - e.sum_hess;
+
+                    if( e.sum_hess >= param.min_child_weight && csum_hess >= param.min_child_weight ){
+                        const double csum_grad = snode[nid].sum_grad - e.sum_grad; 
+                        const double loss_chg = 
+                            + param.CalcGain( e.sum_grad, e.sum_hess, snode[nid].weight ) 
+                            + param.CalcGain(  csum_grad,  csum_hess, snode[nid].weight )
+                            - snode[nid].root_gain;
+                        const float delta = is_forward_search ? rt_eps:-rt_eps;
+                        e.best.Update( loss_chg, fid, e.last_fvalue + delta, !is_forward_search );
+                    }
+                }
+            }
+
+            // enumerate the candidate splits of specific feature proposed by ProposeCuts, return number of entries visited
+            template<typename Iter>
+            inline size_t EnumerateSplitApprox( Iter it, const unsigned fid, const unsigned fslot, std::vector<ThreadEntry> &temp, bool is_forward_search ){
+                // clear all the temp statistics
+                for( size_t j = 0; j < qexpand.size(); ++ j ){
+                    temp[ qexpand[j] ].ClearStats();
+                }
+                
+                size_t nvisit = 0;
+                while( it.Next() ){
+                    ++ nvisit;
+                    if( param.prefetch_dist != 0 ) this->PrefetchAhead( it );
+                    const bst_uint ridx = it.rindex();
+                    const int nid = position[ ridx ];
+                    if( nid < 0 ) continue;
+
+                    const float fvalue = it.fvalue();           
+                    ThreadEntry &e = temp[ nid ];
+                    const std::vector<float> &cut = fcut[ fslot * cut_nslot + this->NodeSlot( nid ) ];
+                    const unsigned ncut = static_cast<unsigned>( cut.size() );
+
+                    // test if first hit, this is fine, because we set 0 during init
+                    if( e.sum_hess == 0.0 ){
+                        e.sum_grad = gpair[ ridx ].grad;
+                        e.sum_hess = gpair[ ridx ].hess;
+                        e.last_fvalue = fvalue;
+                        e.cut_pos = static_cast<unsigned>( std::upper_bound( cut.begin(), cut.end(), fvalue ) - cut.begin() );
+                    }else{
+                        // check whether there is a candidate split between last_fvalue and fvalue
+                        bool cross; float split_value = 0.0f;
+                        if( is_forward_search ){
+                            cross = e.cut_pos < ncut && cut[ e.cut_pos ] <= fvalue;
+                            while( e.cut_pos < ncut && cut[ e.cut_pos ] <= fvalue ) ++ e.cut_pos;
+                            if( cross ) split_value = cut[ e.cut_pos - 1 ];
+                        }else{
+                            cross = e.cut_pos != 0 && cut[ e.cut_pos - 1 ] > fvalue;
+                            while( e.cut_pos != 0 && cut[ e.cut_pos - 1 ] > fvalue ) -- e.cut_pos;
+                            if( cross ) split_value = cut[ e.cut_pos ];
+                        }
+                        // try to find a split
+                        if( cross && e.sum_hess >= param.min_child_weight ){
                             const double csum_hess = snode[ nid ].sum_hess - e.sum_hess;
                             if( csum_hess >= param.min_child_weight ){
                                 const double csum_grad = snode[nid].sum_grad - e.sum_grad; 
@@ -147,12 +425,12 @@ namespace xgboost{
                                     + param.CalcGain( e.sum_grad, e.sum_hess, snode[nid].weight ) 
                                     + param.CalcGain( csum_grad , csum_hess , snode[nid].weight )
                                     - snode[nid].root_gain;
-                                e.best.Update( loss_chg, fid, (fvalue + e.last_fvalue) * 0.5f, !is_forward_search );
+                                e.best.Update( loss_chg, fid, split_value, !is_forward_search );
                             }
                         }
                         // update the statistics
-                        e.sum_grad += grad[ ridx ];
-                        e.sum_hess += hess[ ridx ];
+                        e.sum_grad += gpair[ ridx ].grad;
+                        e.sum_hess += gpair[ ridx ].hess;
                         e.last_fvalue = fvalue;
                     }
                 }
@@ -172,23 +450,258 @@ namespace xgboost{
                         e.best.Update( loss_chg, fid, e.last_fvalue + delta, !is_forward_search );
                     }
                 }
+                return nvisit;
             }
-
-            // find splits at current level
-            inline void FindSplit( int depth ){
-                const unsigned nsize = static_cast<unsigned>( feat_index.size() );
+            // candidate slot of node, in per tree mode all nodes share the candidates of the roots
+            inline unsigned NodeSlot( int nid ) const{
+                return param.approx_method == 2 ? node_slot[ nid ] : 0;
+            }
+            // propose candidate splits of each feature for nodes in qexpand, using hessian weighted quantiles
+            inline void ProposeCuts( void ){
+                cut_nslot = param.approx_method == 2 ? static_cast<unsigned>( qexpand.size() ) : 1;
+                node_slot.resize( tree.param.num_nodes, 0 );
+                for( size_t j = 0; j < qexpand.size(); ++ j ){
+                    node_slot[ qexpand[j] ] = param.approx_method == 2 ? static_cast<unsigned>( j ) : 0;
+                }
+                fcut.resize( feat_index.size() * cut_nslot );
                 
-                #pragma omp parallel for schedule( dynamic, 1 )
-                for( unsigned i = 0; i < nsize; ++ i ){
-                    const unsigned fid = feat_index[i];
+                for( unsigned b = 0; b < block_feat.size(); ++ b ){
+                    if( block_feat[b].size() == 0 ) continue;
+                    smat.FetchColBlock( b );
+                    const std::vector<unsigned> &findex = block_feat[b];
+                    const unsigned nsize = static_cast<unsigned>( findex.size() );
+                    #pragma omp parallel
+                    {
+                        std::vector<WQSummary> sbuilder( cut_nslot );
+                        WQSummary tmp;
+                        #pragma omp for schedule( dynamic, 1 )
+                        for( unsigned j = 0; j < nsize; ++ j ){
+                            const unsigned i = findex[j];
+                            for( unsigned k = 0; k < cut_nslot; ++ k ){
+                                sbuilder[k].Clear();
+                            }
+                            // values come in sorted order, so the summary of each node is exact before pruning
+                            for( typename FMatrix::ColIter it = this->SortedCol( feat_index[i] ); it.Next(); ){
+                                const bst_uint ridx = it.rindex();
+                                const int nid = position[ ridx ];
+                                if( nid < 0 ) continue;
+                                sbuilder[ this->NodeSlot( nid ) ].PushSorted( it.fvalue(), gpair[ ridx ].hess );
+                            }
+                            for( unsigned k = 0; k < cut_nslot; ++ k ){
+                                this->ProposeCut( sbuilder[k], tmp, fcut[ i * cut_nslot + k ] );
+                            }
+                        }
+                    }
+                }
+            }
+
+            // find splits for features of one column block, findex are positions in feat_index
+            inline void FindSplitBlock( const std::vector<unsigned> &findex ){
+                std::vector<unsigned> whole;
+                this->ScheduleCols( findex, whole );
+                size_t nvisit = segs.size() != 0 ? this->FindSplitSegments() : 0;
+                const unsigned nsize = static_cast<unsigned>( whole.size() );
+                const unsigned nfeat = static_cast<unsigned>( feat_index.size() );
+                #pragma omp parallel for schedule( dynamic, 1 ) reduction( +:nvisit )
+                for( unsigned j = 0; j < nsize; ++ j ){
+                    const unsigned i = whole[j];
                     const int tid = omp_get_thread_num();
+                    if( i >= nfeat ){
+                        nvisit += this->EnumerateBundle( bundle_order[ i - nfeat ], stemp[tid], cand_buf[tid], bundle_nodes[tid] );
+                        continue;
+                    }
+                    const unsigned fid = feat_index[i];
+                    if( param.approx_method != 0 ){
+                        if( param.need_forward_search() ){
+                            nvisit += this->EnumerateSplitApprox( this->SortedCol(fid), fid, i, stemp[tid], true );
+                        }
+                        if( param.need_backward_search() ){
+                            nvisit += this->EnumerateSplitApprox( this->ReverseSortedCol(fid), fid, i, stemp[tid], false );
+                        }
+                        continue;
+                    }
                     if( param.need_forward_search() ){
-                        this->EnumerateSplit( smat.GetSortedCol(fid), fid, stemp[tid], true );
+                        nvisit += this->EnumerateSplit( this->SortedCol(fid), fid, stemp[tid], cand_buf[tid], true );
                     }
                     if( param.need_backward_search() ){
-                        this->EnumerateSplit( smat.GetReverseSortedCol(fid), fid, stemp[tid], false );
+                        nvisit += this->EnumerateSplit( this->ReverseSortedCol(fid), fid, stemp[tid], cand_buf[tid], false );
+                    }
+                }
+                scan_entry += nvisit;
+            }
+            // number of entries in sorted column fid
+            inline size_t SortedColSize( unsigned fid ) const{
+                if( ccol_ptr.size() == 0 ) return smat.GetColSize( fid );
+                return ccol_ptr[ fid + 1 ] - ccol_ptr[ fid ];
+            }
+            // number of entries in the shared column of bundle b
+            inline size_t BundleColSize( unsigned b ) const{
+                if( bcol_ptr.size() == 0 ) return bundle->BundleSize( b );
+                return bcol_ptr[ bundle->bundle_ptr[b+1] ] - bcol_ptr[ bundle->bundle_ptr[b] ];
+            }
+            /*!
+             * \brief plan the scan of features in findex and of the bundles, columns holding more than a thread's share
+             *        of entries are cut into segments in segs, the rest are put in whole, longest first so threads finish
+             *        together, bundle j of bundle_order is put in whole as feat_index.size() + j and is never cut
+             */
+            inline void ScheduleCols( const std::vector<unsigned> &findex, std::vector<unsigned> &whole ){
+                std::vector< std::pair<size_t, unsigned> > cost( findex.size() );
+                size_t total = 0;
+                for( size_t j = 0; j < findex.size(); ++ j ){
+                    cost[j] = std::make_pair( this->SortedColSize( feat_index[ findex[j] ] ), findex[j] );
+                    total += cost[j].first;
+                }
+                const unsigned nfeat = static_cast<unsigned>( feat_index.size() );
+                for( size_t j = 0; j < bundle_order.size(); ++ j ){
+                    cost.push_back( std::make_pair( this->BundleColSize( bundle_order[j] ), nfeat + static_cast<unsigned>( j ) ) );
+                    total += cost.back().first;
+                }
+                std::sort( cost.begin(), cost.end(), std::greater< std::pair<size_t, unsigned> >() );
+                const size_t seg_len = std::max( total / this->nthread, static_cast<size_t>( param.col_segment_len ) );
+                const bool allow_seg = param.approx_method == 0 && param.col_segment_len > 0 && this->nthread > 1;
+                whole.clear(); segs.clear();
+                for( size_t j = 0; j < cost.size(); ++ j ){
+                    const size_t len = cost[j].first;
+                    if( !allow_seg || len <= seg_len || cost[j].second >= nfeat ){
+                        whole.push_back( cost[j].second ); continue;
+                    }
+                    const unsigned fid = feat_index[ cost[j].second ];
+                    // iterators point one before the current entry, so dptr_ + 1 is the first entry
+                    const typename FMatrix::REntry *begin = this->SortedCol( fid ).dptr_ + 1;
+                    const size_t nseg = ( len + seg_len - 1 ) / seg_len;
+                    for( size_t k = 0; k < nseg; ++ k ){
+                        Segment sg;
+                        sg.fid = fid;
+                        sg.begin = begin + len * k / nseg;
+                        sg.end = begin + len * ( k + 1 ) / nseg;
+                        sg.head = k == 0; sg.tail = k + 1 == nseg;
+                        segs.push_back( sg );
+                    }
+                }
+            }
+            /*!
+             * \brief enumerate splits of the column segments in segs, each segment is scanned by one thread,
+             *        starting from the sums of the segments before it in the scan direction
+             * \return number of entries visited
+             */
+            inline size_t FindSplitSegments( void ){
+                const unsigned nseg = static_cast<unsigned>( segs.size() );
+                const size_t nexpand = qexpand.size();
+                qindex.resize( tree.param.num_nodes );
+                for( size_t j = 0; j < nexpand; ++ j ){
+                    qindex[ qexpand[j] ] = static_cast<int>( j );
+                }
+                size_t nvisit = 0;
+                // pass 1: statistics of each node in each segment
+                seg_stat.resize( nseg * nexpand );
+                #pragma omp parallel for schedule( dynamic, 1 ) reduction( +:nvisit )
+                for( unsigned k = 0; k < nseg; ++ k ){
+                    SegStat *st = &seg_stat[ k * nexpand ];
+                    std::fill( st, st + nexpand, SegStat() );
+                    for( typename FMatrix::ColIter it( segs[k].begin - 1, segs[k].end - 1 ); it.Next(); ){
+                        ++ nvisit;
+                        if( param.prefetch_dist != 0 ) this->PrefetchAhead( it );
+                        const bst_uint ridx = it.rindex();
+                        const int nid = position[ ridx ];
+                        if( nid < 0 ) continue;
+                        st[ qindex[nid] ].Add( gpair[ ridx ], it.fvalue() );
+                    }
+                }
+                // the state each segment starts from, forward scan in [0, nseg), backward scan in [nseg, 2*nseg)
+                seg_start.resize( 2 * nseg * nexpand );
+                for( unsigned head = 0; head < nseg; ){
+                    unsigned tail = head + 1;
+                    while( !segs[ tail - 1 ].tail ) ++ tail;
+                    for( size_t j = 0; j < nexpand; ++ j ){
+                        SegStat run;
+                        for( unsigned k = head; k < tail; ++ k ){
+                            seg_start[ k * nexpand + j ] = run;
+                            run.Append( seg_stat[ k * nexpand + j ], true );
+                        }
+                        run = SegStat();
+                        for( unsigned k = tail; k != head; -- k ){
+                            seg_start[ ( nseg + k - 1 ) * nexpand + j ] = run;
+                            run.Append( seg_stat[ ( k - 1 ) * nexpand + j ], false );
+                        }
+                    }
+                    head = tail;
+                }
+                // pass 2: enumerate the splits of each segment in each direction
+                seg_best.resize( 2 * nseg * nexpand );
+                #pragma omp parallel for schedule( dynamic, 1 ) reduction( +:nvisit )
+                for( unsigned t = 0; t < 2 * nseg; ++ t ){
+                    const bool is_forward_search = t < nseg;
+                    if( is_forward_search ? !param.need_forward_search() : !param.need_backward_search() ) continue;
+                    const Segment &sg = segs[ t % nseg ];
+                    const int tid = omp_get_thread_num();
+                    std::vector<ThreadEntry> &temp = seg_temp[ tid ];
+                    temp.resize( tree.param.num_nodes );
+                    for( size_t j = 0; j < nexpand; ++ j ){
+                        const SegStat &st = seg_start[ t * nexpand + j ];
+                        ThreadEntry &e = temp[ qexpand[j] ];
+                        e.sum_grad = st.sum_grad; e.sum_hess = st.sum_hess;
+                        e.last_fvalue = st.last_fvalue; e.best = SplitEntry();
+                    }
+                    if( is_forward_search ){
+                        nvisit += this->ScanSplit( typename FMatrix::ColIter( sg.begin - 1, sg.end - 1 ), sg.fid, temp, cand_buf[tid], true );
+                        if( sg.tail ) this->FinishSplit( sg.fid, temp, true, qexpand );
+                    }else{
+                        nvisit += this->ScanSplit( typename FMatrix::ColBackIter( sg.end, sg.begin ), sg.fid, temp, cand_buf[tid], false );
+                        if( sg.head ) this->FinishSplit( sg.fid, temp, false, qexpand );
+                    }
+                    for( size_t j = 0; j < nexpand; ++ j ){
+                        seg_best[ t * nexpand + j ] = temp[ qexpand[j] ].best;
                     }
                 }
+                // merge in scan order, so that ties are resolved as in a single scan of the column
+                for( unsigned head = 0; head < nseg; ){
+                    unsigned tail = head + 1;
+                    while( !segs[ tail - 1 ].tail ) ++ tail;
+                    for( size_t j = 0; j < nexpand; ++ j ){
+                        SplitEntry &best = stemp[0][ qexpand[j] ].best;
+                        for( unsigned k = head; k < tail; ++ k ){
+                            best.Update( seg_best[ k * nexpand + j ] );
+                        }
+                        for( unsigned k = tail; k != head; -- k ){
+                            best.Update( seg_best[ ( nseg + k - 1 ) * nexpand + j ] );
+                        }
+                    }
+                    head = tail;
+                }
+                return nvisit;
+            }
+            // move instances of split nodes whose feature is present to the right child, for split features in [begin, end)
+            inline void ResetPosition( const unsigned *begin, const unsigned *end ){
+                const unsigned nfeats = static_cast<unsigned>( end - begin );
+                #pragma omp parallel for schedule( dynamic, 1 )
+                for( unsigned i = 0; i < nfeats; ++ i ){
+                    const unsigned fid = begin[i];
+                    for( typename FMatrix::ColIter it = this->SortedCol( fid ); it.Next(); ){
+                        const bst_uint ridx = it.rindex();
+                        int nid = position[ ridx ];
+                        if( nid < 0 ) continue;
+                        // go back to parent, correct those who are not default
+                        nid = tree[ nid ].parent();
+                        if( tree[ nid ].split_index() == fid ){
+                            if( it.fvalue() < tree[nid].split_cond() ){
+                                position[ ridx ] = tree[ nid ].cleft();
+                            }else{
+                                position[ ridx ] = tree[ nid ].cright();
+                            }
+                        }
+                    }
+                }
+            }
+            // find the best split of nodes in qexpand
+            inline void FindSplit( void ){
+                // columns are visited block by block, a single block holds all columns when they are in memory
+                for( unsigned b = 0; b < block_level.size(); ++ b ){
+                    if( block_level[b].size() == 0 && bundle_order.size() == 0 ) continue;
+                    smat.FetchColBlock( b );
+                    const double start = omp_get_wtime();
+                    this->FindSplitBlock( block_level[b] );
+                    scan_time += omp_get_wtime() - start;
+                }
 
                 // after this each thread's stemp will get the best candidates, aggregate results
                 for( size_t i = 0; i < qexpand.size(); ++ i ){
@@ -197,8 +710,13 @@ namespace xgboost{
                     for( int tid = 0; tid < this->nthread; ++ tid ){
                         e.best.Update( stemp[ tid ][ nid ].best );
                     }
-                    
-                    // now we know the solution in snode[ nid ], set split
+                }
+            }
+            // set split of nodes in qexpand, nodes without a useful split become leaves
+            inline void ApplySplit( void ){
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    const int nid = qexpand[ i ];
+                    NodeEntry &e = snode[ nid ];
                     if( e.best.loss_chg > rt_eps ){
                         tree.AddChilds( nid );
                         tree[ nid ].set_split( e.best.split_index(), e.best.split_value, e.best.default_left() );
@@ -206,50 +724,262 @@ namespace xgboost{
                         tree[ nid ].set_leaf( e.weight * param.learning_rate );
                     }  
                 }
-
-                {// reset position 
-                    // step 1, set default direct nodes to default, and leaf nodes to -1, 
-                    const unsigned ndata = static_cast<unsigned>( position.size() );
-                    #pragma omp parallel for schedule( static )
-                    for( unsigned i = 0; i < ndata; ++ i ){
-                        const int nid = position[i];
-                        if( nid >= 0 ){
-                            if( tree[ nid ].is_leaf() ){
-                                position[i] = -1;
-                            }else{
-                                // push to default branch, correct latter
-                                position[i] = tree[nid].default_left() ? tree[nid].cleft(): tree[nid].cright();
-                            }
+            }
+            // move instances of nodes in qexpand to the children, instances in leaf nodes get ~nid
+            inline void UpdatePosition( void ){
+                // step 1, set default direct nodes to default, and instances in leaf nodes to ~nid
+                const bool use_active = param.grow_policy == 0;
+                const unsigned ndata = static_cast<unsigned>( use_active ? active.size() : position.size() );
+                #pragma omp parallel for schedule( static )
+                for( unsigned j = 0; j < ndata; ++ j ){
+                    const bst_uint i = use_active ? active[j] : j;
+                    const int nid = position[i];
+                    if( nid >= 0 ){
+                        if( tree[ nid ].is_leaf() ){
+                            position[i] = ~nid;
+                        }else{
+                            // push to default branch, correct latter
+                            position[i] = tree[nid].default_left() ? tree[nid].cleft(): tree[nid].cright();
                         }
                     }
+                }
+                if( use_active ){
+                    // instances in leaves leave the active set
+                    size_t top = 0;
+                    for( size_t j = 0; j < active.size(); ++ j ){
+                        if( position[ active[j] ] >= 0 ) active[ top ++ ] = active[j];
+                    }
+                    active.resize( top );
+                }
 
-                    // step 2, classify the non-default data into right places
-                    std::vector<unsigned> fsplits;
+                // step 2, classify the non-default data into right places
+                std::vector<unsigned> fsplits;
+
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    const int nid = qexpand[i];
+                    if( !tree[nid].is_leaf() ) fsplits.push_back( tree[nid].split_index() );
+                }
+                std::sort( fsplits.begin(), fsplits.end() );
+                fsplits.resize( std::unique( fsplits.begin(), fsplits.end() ) - fsplits.begin() );
+                if( fsplits.size() == 0 ) return;
 
+                // only the blocks holding split features are visited
+                const unsigned *fbegin = &fsplits[0], *fend = fbegin + fsplits.size();
+                for( unsigned b = 0; b < smat.NumColBlock() && fbegin != fend; ++ b ){
+                    const unsigned *p = std::lower_bound( fbegin, fend, static_cast<unsigned>( smat.ColBlockBegin( b + 1 ) ) );
+                    if( p == fbegin ) continue;
+                    smat.FetchColBlock( b );
+                    this->ResetPosition( fbegin, p );
+                    fbegin = p;
+                }
+            }
+            // sorted column fid, only holds the active instances once the columns are compacted
+            inline typename FMatrix::ColIter SortedCol( unsigned fid ) const{
+                if( bundle != NULL && bundle->IsBundled( fid ) ) return this->BundleCol( bundle->fpos[fid] );
+                if( ccol_ptr.size() == 0 ) return smat.GetSortedCol( fid );
+                return typename FMatrix::ColIter( &ccol[0] + ccol_ptr[fid] - 1, &ccol[0] + ccol_ptr[fid+1] - 1 );
+            }
+            // reverse sorted column fid, only holds the active instances once the columns are compacted
+            inline typename FMatrix::ColBackIter ReverseSortedCol( unsigned fid ) const{
+                if( bundle != NULL && bundle->IsBundled( fid ) ) return this->ReverseBundleCol( bundle->fpos[fid] );
+                if( ccol_ptr.size() == 0 ) return smat.GetReverseSortedCol( fid );
+                return typename FMatrix::ColBackIter( &ccol[0] + ccol_ptr[fid+1], &ccol[0] + ccol_ptr[fid] );
+            }
+            // range of feature at position k of the bundle index in the shared column of its bundle
+            inline typename FMatrix::ColIter BundleCol( unsigned k ) const{
+                if( bcol_ptr.size() == 0 ){
+                    return typename FMatrix::ColIter( &bundle->data[0] + bundle->col_ptr[k] - 1, &bundle->data[0] + bundle->col_ptr[k+1] - 1 );
+                }
+                return typename FMatrix::ColIter( &bcol[0] + bcol_ptr[k] - 1, &bcol[0] + bcol_ptr[k+1] - 1 );
+            }
+            // reverse range of feature at position k of the bundle index in the shared column of its bundle
+            inline typename FMatrix::ColBackIter ReverseBundleCol( unsigned k ) const{
+                if( bcol_ptr.size() == 0 ){
+                    return typename FMatrix::ColBackIter( &bundle->data[0] + bundle->col_ptr[k+1], &bundle->data[0] + bundle->col_ptr[k] );
+                }
+                return typename FMatrix::ColBackIter( &bcol[0] + bcol_ptr[k+1], &bcol[0] + bcol_ptr[k] );
+            }
+            /*! 
+             * \brief copy the entries of active instances out of the sorted columns when few instances are active,
+             *        so that later levels scan columns in time proportional to the active instances,
+             *        only done in level wise growth when the columns are in memory
+             */
+            inline void CompactCols( void ){
+                if( param.grow_policy != 0 || smat.NumColBlock() != 1 ) return;
+                if( !( active.size() < param.col_compact_ratio * num_compact ) ) return;
+                const unsigned ncol = static_cast<unsigned>( smat.NumCol() );
+                const unsigned nsize = static_cast<unsigned>( feat_index.size() );
+                std::vector<size_t> cptr( ncol + 1, 0 );
+                #pragma omp parallel for schedule( dynamic, 1 )
+                for( unsigned i = 0; i < nsize; ++ i ){
+                    const unsigned fid = feat_index[i];
+                    size_t cnt = 0;
+                    for( typename FMatrix::ColIter it = this->SortedCol( fid ); it.Next(); ){
+                        if( position[ it.rindex() ] >= 0 ) ++ cnt;
+                    }
+                    cptr[ fid + 1 ] = cnt;
+                }
+                // the first entry is a sentinel, so that the iterators never point before the data
+                cptr[0] = 1;
+                for( unsigned fid = 0; fid < ncol; ++ fid ){
+                    cptr[ fid + 1 ] += cptr[ fid ];
+                }
+                std::vector<typename FMatrix::REntry> cdata( cptr[ ncol ] );
+                #pragma omp parallel for schedule( dynamic, 1 )
+                for( unsigned i = 0; i < nsize; ++ i ){
+                    const unsigned fid = feat_index[i];
+                    size_t top = cptr[ fid ];
+                    for( typename FMatrix::ColIter it = this->SortedCol( fid ); it.Next(); ){
+                        if( position[ it.rindex() ] >= 0 ){
+                            cdata[ top ++ ] = typename FMatrix::REntry( it.rindex(), it.fvalue() );
+                        }
+                    }
+                }
+                ccol.swap( cdata ); ccol_ptr.swap( cptr );
+                if( bundle != NULL ) this->CompactBundles();
+                num_compact = active.size();
+            }
+            // compact the shared columns of bundles in the same way, the layout of the bundle index is kept
+            inline void CompactBundles( void ){
+                const unsigned nsize = static_cast<unsigned>( bundle->feat.size() );
+                std::vector<size_t> cptr( nsize + 1, 0 );
+                #pragma omp parallel for schedule( dynamic, 64 )
+                for( unsigned k = 0; k < nsize; ++ k ){
+                    size_t cnt = 0;
+                    for( typename FMatrix::ColIter it = this->BundleCol( k ); it.Next(); ){
+                        if( position[ it.rindex() ] >= 0 ) ++ cnt;
+                    }
+                    cptr[ k + 1 ] = cnt;
+                }
+                cptr[0] = 1;
+                for( unsigned k = 0; k < nsize; ++ k ){
+                    cptr[ k + 1 ] += cptr[ k ];
+                }
+                std::vector<typename FMatrix::REntry> cdata( cptr[ nsize ] );
+                #pragma omp parallel for schedule( dynamic, 64 )
+                for( unsigned k = 0; k < nsize; ++ k ){
+                    size_t top = cptr[ k ];
+                    for( typename FMatrix::ColIter it = this->BundleCol( k ); it.Next(); ){
+                        if( position[ it.rindex() ] >= 0 ){
+                            cdata[ top ++ ] = typename FMatrix::REntry( it.rindex(), it.fvalue() );
+                        }
+                    }
+                }
+                bcol.swap( cdata ); bcol_ptr.swap( cptr );
+            }
+            /*! 
+             * \brief mark instances of waiting nodes as inactive ~nid, so that column scans skip them,
+             *        if nid >= 0, the instances of nid are activated again
+             */
+            inline void SetActiveNode( int nid ){
+                const unsigned ndata = static_cast<unsigned>( position.size() );
+                #pragma omp parallel for schedule( static )
+                for( unsigned i = 0; i < ndata; ++ i ){
+                    if( position[i] >= 0 ){
+                        position[i] = ~position[i];
+                    }else if( position[i] == ~nid ){
+                        position[i] = nid;
+                    }
+                }
+            }
+            /*!
+             * \brief hybrid mode, hand nodes in qexpand with fewer than hybrid_row_size instances to row based expansion,
+             *        which grows their subtrees to the remaining depth, their instances leave the active set
+             * \param depth depth of nodes in qexpand
+             * \param stat_max_depth maximum depth of the tree, updated with the depth of the handed subtrees
+             */
+            inline void HandOffSmallNodes( int depth, int &stat_max_depth ){
+                std::vector<size_t> cnt( tree.param.num_nodes, 0 );
+                for( size_t j = 0; j < active.size(); ++ j ){
+                    ++ cnt[ position[ active[j] ] ];
+                }
+                // PerTreeNode: index of handed node, -1 if the node stays in qexpand
+                std::vector<int> hindex( tree.param.num_nodes, -1 );
+                std::vector<int> nodes;
+                std::vector<size_t> rptr( 1, 0 );
+                size_t top = 0;
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    const int nid = qexpand[i];
+                    if( cnt[ nid ] < static_cast<size_t>( param.hybrid_row_size ) ){
+                        hindex[ nid ] = static_cast<int>( nodes.size() );
+                        nodes.push_back( nid );
+                        rptr.push_back( rptr.back() + cnt[ nid ] );
+                    }else{
+                        qexpand[ top ++ ] = nid;
+                    }
+                }
+                if( nodes.size() == 0 ) return;
+                qexpand.resize( top );
+                // instances of handed nodes keep increasing order, the rest stay active
+                std::vector<bst_uint> rows( rptr.back() );
+                std::vector<size_t> fill( rptr.begin(), rptr.end() - 1 );
+                top = 0;
+                for( size_t j = 0; j < active.size(); ++ j ){
+                    const bst_uint ridx = active[j];
+                    const int k = hindex[ position[ ridx ] ];
+                    if( k >= 0 ){
+                        rows[ fill[k] ++ ] = ridx;
+                    }else{
+                        active[ top ++ ] = ridx;
+                    }
+                }
+                active.resize( top );
+                RowTreeMaker<FMatrix> maker( tree, param, gpair, smat, root_index, constrain, row_space );
+                const int sub_depth = maker.ExpandSubtrees( nodes, rows, rptr, param.max_depth - depth, snode, position, feat_mask );
+                stat_max_depth = std::max( stat_max_depth, depth + sub_depth );
+            }
+            // grow the tree by always splitting the candidate leaf with the largest loss change
+            inline void MakeLossGuide( int &stat_max_depth ){
+                ExpandQueue queue;
+                unsigned timestamp = 0;
+                int num_leaves = tree.param.num_roots;
+                this->SetLevelFeat();
+                this->FindSplit();
+                this->SetActiveNode( -1 );
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    queue.push( ExpandEntry( qexpand[i], 0, snode[ qexpand[i] ].best.loss_chg, timestamp ++ ) );
+                }
+                while( !queue.empty() ){
+                    const ExpandEntry e = queue.top(); queue.pop();
+                    if( !this->NeedExpand( e, num_leaves ) ){
+                        tree[ e.nid ].set_leaf( snode[ e.nid ].weight * param.learning_rate );
+                        continue;
+                    }
+                    qexpand.resize( 1 ); qexpand[0] = e.nid;
+                    this->SetActiveNode( e.nid );
+                    this->ApplySplit();
+                    this->UpdatePosition();
+                    this->UpdateQueueExpand( this->qexpand );
+                    this->InitNewNode( this->qexpand );
+                    ++ num_leaves;
+                    stat_max_depth = std::max( stat_max_depth, e.depth + 1 );
+                    if( param.approx_method == 2 ) this->ProposeCuts();
+                    this->SetLevelFeat();
+                    this->FindSplit();
+                    this->SetActiveNode( -1 );
                     for( size_t i = 0; i < qexpand.size(); ++ i ){
-                        const int nid = qexpand[i];
-                        if( !tree[nid].is_leaf() ) fsplits.push_back( tree[nid].split_index() );
+                        queue.push( ExpandEntry( qexpand[i], e.depth + 1, snode[ qexpand[i] ].best.loss_chg, timestamp ++ ) );
                     }
-                    std::sort( fsplits.begin(), fsplits.end() );
-                    fsplits.resize( std::unique( fsplits.begin(), fsplits.end() ) - fsplits.begin() );
-
-                    const unsigned nfeats = static_cast<unsigned>( fsplits.size() );
-                    #pragma omp parallel for schedule( dynamic, 1 )
-                    for( unsigned i = 0; i < nfeats; ++ i ){
-                        const unsigned fid = fsplits[i];
-                        for( typename FMatrix::ColIter it = smat.GetSortedCol( fid ); it.Next(); ){
-                            const bst_uint ridx = it.rindex();
-                            int nid = position[ ridx ];
-                            if( nid == -1 ) continue;
-                            // go back to parent, correct those who are not default
-                            nid = tree[ nid ].parent();
-                            if( tree[ nid ].split_index() == fid ){
-                                if( it.fvalue() < tree[nid].split_cond() ){
-                                    position[ ridx ] = tree[ nid ].cleft();
-                                }else{
-                                    position[ ridx ] = tree[ nid ].cright();
-                                }
-                            }
+                }
+                qexpand.clear();
+            }
+            // sample the features scanned in the next level, and collect them per column block and per bundle
+            inline void SetLevelFeat( void ){
+                std::vector<int> fbuf;
+                this->SampleLevelFeat( feat_mask, fbuf );
+                block_level.resize( block_feat.size() );
+                for( size_t b = 0; b < block_feat.size(); ++ b ){
+                    block_level[b].clear();
+                    for( size_t j = 0; j < block_feat[b].size(); ++ j ){
+                        if( feat_mask[ feat_index[ block_feat[b][j] ] ] == 2 ) block_level[b].push_back( block_feat[b][j] );
+                    }
+                }
+                bundle_order.clear();
+                if( bundle == NULL ) return;
+                for( unsigned b = 0; b < bundle->NumBundle(); ++ b ){
+                    for( unsigned k = bundle->bundle_ptr[b]; k < bundle->bundle_ptr[b+1]; ++ k ){
+                        if( feat_mask[ bundle->feat[k] ] == 2 ){
+                            bundle_order.push_back( b ); break;
                         }
                     }
                 }
@@ -257,8 +987,9 @@ namespace xgboost{
         private:
             // initialize temp data structure
             inline void InitData( void ){
+                scan_entry = 0; scan_time = 0.0;
                 {
-                    position.resize( grad.size() );
+                    position.resize( gpair.size() );
                     if( root_index.size() == 0 ){
                         std::fill( position.begin(), position.end(), 0 );
                     }else{
@@ -268,27 +999,61 @@ namespace xgboost{
                         }
                     }
                     // mark delete for the deleted datas
-                    for( size_t i = 0; i < grad.size(); ++ i ){
-                        if( hess[i] < 0.0f ) position[i] = -1;
+                    for( size_t i = 0; i < gpair.size(); ++ i ){
+                        if( gpair[i].hess < 0.0f ) position[i] = kUnused;
                     }
                     if( param.subsample < 1.0f - 1e-6f ){
-                        for( size_t i = 0; i < grad.size(); ++ i ){
-                            if( hess[i] < 0.0f ) continue;
+                        for( size_t i = 0; i < gpair.size(); ++ i ){
+                            if( gpair[i].hess < 0.0f ) continue;
                             if( random::SampleBinary( param.subsample) == 0 ){
-                                position[ i ] = -1;
+                                position[ i ] = kUnused;
                             }
                         }
                     }
+                    active.clear();
+                    for( size_t i = 0; i < position.size(); ++ i ){
+                        if( position[i] >= 0 ) active.push_back( static_cast<bst_uint>( i ) );
+                    }
+                    ccol.clear(); ccol_ptr.clear();
+                    bcol.clear(); bcol_ptr.clear();
+                    num_compact = position.size();
                 }
                 
                 {// initialize feature index
+                    feat_index.clear();
                     int ncol = static_cast<int>( smat.NumCol() );
                     for( int i = 0; i < ncol; i ++ ){
-                        if( smat.GetSortedCol(i).Next() && constrain.NotBanned(i) ){
+                        if( smat.GetColSize(i) != 0 && constrain.NotBanned(i) ){
                             feat_index.push_back( i );
                         }
                     }
                     random::Shuffle( feat_index );
+                    this->SampleFeat( feat_index, param.colsample_bytree );
+                    feat_mask.clear(); feat_mask.resize( ncol, 0 );
+                    for( size_t i = 0; i < feat_index.size(); ++ i ){
+                        feat_mask[ feat_index[i] ] = 1;
+                    }
+                    // bundled features are scanned with their bundles, they leave feat_index after the shuffle
+                    // so that the random sequence is the same as without bundles
+                    bundle = NULL;
+                    if( param.feature_bundle != 0 && param.approx_method == 0 && smat.NumColBlock() == 1 ){
+                        bundle = &smat.GetBundleIndex();
+                        size_t top = 0;
+                        for( size_t i = 0; i < feat_index.size(); ++ i ){
+                            if( !bundle->IsBundled( feat_index[i] ) ) feat_index[ top ++ ] = feat_index[i];
+                        }
+                        feat_index.resize( top );
+                    }
+                    // group features by column block, keeping the shuffled order within each block
+                    block_feat.resize( smat.NumColBlock() );
+                    for( size_t b = 0; b < block_feat.size(); ++ b ){
+                        block_feat[b].clear();
+                    }
+                    for( size_t i = 0; i < feat_index.size(); ++ i ){
+                        unsigned b = 0;
+                        while( smat.ColBlockBegin( b + 1 ) <= static_cast<size_t>( feat_index[i] ) ) ++ b;
+                        block_feat[b].push_back( static_cast<unsigned>( i ) );
+                    }
                 }
                 {// setup temp space for each thread
                     if( param.nthread != 0 ){
@@ -301,10 +1066,15 @@ namespace xgboost{
 
                     // reserve a small space
                     stemp.resize( this->nthread, std::vector<ThreadEntry>() );
+                    seg_temp.resize( this->nthread, std::vector<ThreadEntry>() );
+                    cand_buf.resize( this->nthread );
+                    bundle_nodes.resize( this->nthread );
+                    kernel = GetLossChgKernel( param.use_simd );
+                    // entries left by the previous tree are cleared, the space is kept
                     for( size_t i = 0; i < stemp.size(); ++ i ){
-                        stemp[i].reserve( 256 );
+                        stemp[i].clear(); stemp[i].reserve( 256 );
                     }
-                    snode.reserve( 256 );
+                    snode.clear(); snode.reserve( 256 );
                 }
                 
                 {// expand query
@@ -317,18 +1087,50 @@ namespace xgboost{
         private:
             // number of omp thread used during training
             int nthread;
-            // Per feature: shuffle index of each feature index
-            std::vector<int> feat_index;
-            // Instance Data: current node position in the tree of each instance
-            std::vector<int> position;
-            // PerThread x PerTreeNode: statistics for per thread construction
-            std::vector< std::vector<ThreadEntry> > stemp;
+            // position of instances that are not used in training
+            static const int kUnused = INT_MIN;
+            // number of instances in the columns when they were last compacted
+            size_t num_compact;
+            // kernel that evaluates loss change of split candidates
+            LossChgKernel kernel;
+            // column entries visited and seconds spent in split enumeration
+            size_t scan_entry;
+            double scan_time;
+            // approximate mode, number of candidate slots: one per node in qexpand for per level mode, one for per tree mode
+            unsigned cut_nslot;
+            // bundles of exclusive features, NULL if features are scanned one by one
+            const typename FMatrix::BundleIndex *bundle;
+            // buffers in the workspace, see Workspace
+            std::vector<int> &feat_index;
+            std::vector< std::vector<unsigned> > &block_feat;
+            std::vector<char> &feat_mask;
+            std::vector< std::vector<unsigned> > &block_level;
+            std::vector<int> &position;
+            std::vector<bst_uint> &active;
+            std::vector<typename FMatrix::REntry> &ccol;
+            std::vector<size_t> &ccol_ptr;
+            std::vector< std::vector<ThreadEntry> > &stemp;
+            std::vector<SplitCandBuffer> &cand_buf;
+            std::vector<Segment> &segs;
+            std::vector<int> &qindex;
+            std::vector<SegStat> &seg_stat;
+            std::vector<SegStat> &seg_start;
+            std::vector<SplitEntry> &seg_best;
+            std::vector< std::vector<ThreadEntry> > &seg_temp;
+            std::vector<unsigned> &node_slot;
+            std::vector< std::vector<float> > &fcut;
+            std::vector<unsigned> &bundle_order;
+            std::vector<typename FMatrix::REntry> &bcol;
+            std::vector<size_t> &bcol_ptr;
+            std::vector< std::vector<int> > &bundle_nodes;
+            typename RowTreeMaker<FMatrix>::Workspace &row_space;
         private:
-            const std::vector<float> &grad;
-            const std::vector<float> &hess;
+            const GPairView          gpair;
             const FMatrix            &smat;
             const std::vector<unsigned> &root_index;
             const utils::FeatConstrain  &constrain;
+            // whether nodes with few instances are handed to row based expansion
+            const bool hybrid;
         };
     };
 };
@@ -0,0 +1,481 @@
+#ifndef XGBOOST_HIST_TREEMAKER_HPP
+#define XGBOOST_HIST_TREEMAKER_HPP
+/*!
+ * \file xgboost_hist_treemaker.hpp
+ * \brief implementation of regression tree maker,
+ *        use gradient histograms over pre-binned features, with OpenMP
+ *        histogram of the larger child is obtained by subtracting the smaller child from parent
+ * \author Tianqi Chen: tianqi.tchen@gmail.com
+ */
+// use openmp
+#include <vector>
+#include "xgboost_tree_model.h"
+#include "../../utils/xgboost_omp.h"
+#include "../../utils/xgboost_random.h"
+#include "../../utils/xgboost_fmap.h"
+#include "xgboost_base_treemaker.hpp"
+
+namespace xgboost{
+    namespace booster{
+        template<typename FMatrix>
+        class HistTreeMaker : protected BaseTreeMaker{
+        public:
+            struct Workspace;
+            HistTreeMaker( RegTree &tree,
+                           const TreeParamTrain &param,
+                           const GPairView &gpair,
+                           const FMatrix &smat,
+                           const std::vector<unsigned> &root_index,
+                           const utils::FeatConstrain  &constrain,
+                           Workspace &wspace )
+                : BaseTreeMaker( tree, param, wspace ),
+                  feat_index( wspace.feat_index ), feat_mask( wspace.feat_mask ), feat_level( wspace.feat_level ),
+                  row_index_set( wspace.row_index_set ), node_bound( wspace.node_bound ),
+                  hist( wspace.hist ), hist_free( wspace.hist_free ), htemp( wspace.htemp ), stemp( wspace.stemp ),
+                  gpair(gpair),
+                  smat(smat), root_index(root_index), constrain(constrain),
+                  bindex( smat.GetBinIndex( param.max_bin ) ) {
+                utils::Assert( smat.NumRow() == gpair.size(), "booster:invalid input" );
+                utils::Assert( root_index.size() == 0 || root_index.size() == gpair.size(), "booster:invalid input" );
+            }
+            inline void Make( int& stat_max_depth, int& stat_num_pruned ){
+                this->InitData();
+                this->InitNewNode( this->qexpand );
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    this->BuildHist( qexpand[i] );
+                }
+                stat_max_depth = 0;
+
+                if( param.grow_policy == 1 ){
+                    this->MakeLossGuide( stat_max_depth );
+                }else{
+                    for( int depth = 0; depth < param.max_depth; ++ depth ){
+                        this->SetLevelFeat();
+                        this->FindSplit();
+                        this->ApplySplit();
+                        this->UpdateHist();
+                        this->UpdateQueueExpand( this->qexpand );
+                        this->InitNewNode( this->qexpand );
+                        // if nothing left to be expand, break
+                        if( qexpand.size() == 0 ) break;
+                        stat_max_depth = depth + 1;
+                    }
+                    // set all the rest expanding nodes to leaf
+                    for( size_t i = 0; i < qexpand.size(); ++ i ){
+                        const int nid = qexpand[i];
+                        tree[ nid ].set_leaf( snode[nid].weight * param.learning_rate );
+                    }
+                }
+                // start prunning the tree
+                stat_num_pruned = this->DoPrune();
+            }
+            /*!
+             * \brief get the leaf each instance reached, call after Make
+             * \param nrow number of instances
+             * \param leaf output leaf of each instance in the pruned tree, -1 if the instance is not used in training
+             */
+            inline void GetLeafPosition( size_t nrow, std::vector<int> &leaf ){
+                leaf.clear(); leaf.resize( nrow, -1 );
+                // leaves before pruning are leaves or deleted nodes now, their bounds cover all used instances
+                for( int nid = 0; nid < (int)node_bound.size(); ++ nid ){
+                    if( !tree[ nid ].is_leaf() ) continue;
+                    const int leaf_id = this->PrunedLeaf( nid );
+                    for( bst_uint i = node_bound[ nid ].first; i < node_bound[ nid ].second; ++ i ){
+                        leaf[ row_index_set[i] ] = leaf_id;
+                    }
+                }
+            }
+        private:
+            /*! \brief gradient statistics of one histogram bin */
+            struct GradStats{
+                /*! \brief sum gradient statistics */
+                double sum_grad;
+                /*! \brief sum hessian statistics */
+                double sum_hess;
+                /*! \brief constructor */
+                GradStats( void ){
+                    this->Clear();
+                }
+                /*! \brief clear statistics */
+                inline void Clear( void ){
+                    sum_grad = sum_hess = 0.0;
+                }
+                /*! \brief add statistics */
+                inline void Add( double grad, double hess ){
+                    sum_grad += grad; sum_hess += hess;
+                }
+            };
+        public:
+            /*! \brief buffers of the histogram tree maker, see BaseTreeMaker::Workspace */
+            struct Workspace : public BaseTreeMaker::Workspace{
+                // Per feature: index of features sampled for the tree, in increasing order
+                std::vector<unsigned> feat_index;
+                // PerFeature: 0 if the feature is not sampled for the tree, 1 if it is, 2 if it is also sampled for the current level
+                std::vector<char> feat_mask;
+                // features in feat_index sampled for the current level
+                std::vector<unsigned> feat_level;
+                // Instance row indexes corresponding to each node
+                std::vector<bst_uint> row_index_set;
+                // lower and upper bound of each nodes' row_index
+                std::vector< std::pair<bst_uint, bst_uint> > node_bound;
+                // PerTreeNode x PerBin: gradient histogram, only kept for nodes in the current level
+                std::vector< std::vector<GradStats> > hist;
+                // histogram space released by nodes that are done, reused by new nodes
+                std::vector< std::vector<GradStats> > hist_free;
+                // PerThread x PerBin: tmp histogram for per thread construction
+                std::vector< std::vector<GradStats> > htemp;
+                // PerThread x PerTreeNode: best split found by each thread
+                std::vector< std::vector<SplitEntry> > stemp;
+            };
+        private:
+            // make leaf nodes for all qexpand, update node statistics, mark leaf value
+            inline void InitNewNode( const std::vector<int> &qexpand ){
+                snode.resize( tree.param.num_nodes, NodeEntry() );
+
+                for( size_t j = 0; j < qexpand.size(); ++j ){
+                    const int nid = qexpand[ j ];
+                    const int begin = static_cast<int>( node_bound[nid].first );
+                    const int end   = static_cast<int>( node_bound[nid].second );
+                    double sum_grad = 0.0, sum_hess = 0.0;
+                    #pragma omp parallel for schedule( static ) reduction( +:sum_grad, sum_hess )
+                    for( int i = begin; i < end; ++i ){
+                        const bst_uint ridx = row_index_set[i];
+                        sum_grad += gpair[ridx].grad; sum_hess += gpair[ridx].hess;
+                    }
+                    // update node statistics
+                    snode[nid].sum_grad = sum_grad;
+                    snode[nid].sum_hess = sum_hess;
+                    snode[nid].root_gain = param.CalcRootGain( sum_grad, sum_hess );
+                    if( !tree[nid].is_root() ){
+                        snode[nid].weight = param.CalcWeight( sum_grad, sum_hess, tree.stat( tree[nid].parent() ).base_weight );
+                        tree.stat(nid).base_weight = snode[nid].weight;
+                    }else{
+                        snode[nid].weight = param.CalcWeight( sum_grad, sum_hess, 0.0f );
+                        tree.stat(nid).base_weight = snode[nid].weight;
+                    }
+                }
+            }
+        private:
+            // build histogram of node nid from the rows that belong to it
+            inline void BuildHist( int nid ){
+                const size_t nbin = bindex.NumBin();
+                const int begin = static_cast<int>( node_bound[nid].first );
+                const int end   = static_cast<int>( node_bound[nid].second );
+                this->AllocHist( nid );
+
+                #pragma omp parallel
+                {
+                    std::vector<GradStats> &thist = htemp[ omp_get_thread_num() ];
+                    std::fill( thist.begin(), thist.end(), GradStats() );
+                    #pragma omp for schedule( static )
+                    for( int i = begin; i < end; ++ i ){
+                        const bst_uint ridx = row_index_set[i];
+                        const double g = gpair[ridx].grad, h = gpair[ridx].hess;
+                        const unsigned char *bin = smat.GetRowBin( ridx );
+                        for( typename FMatrix::RowIter it = smat.GetRow(ridx); it.Next(); ++ bin ){
+                            thist[ bindex.cut_ptr[ it.findex() ] + *bin ].Add( g, h );
+                        }
+                    }
+                }
+                const unsigned ubin = static_cast<unsigned>( nbin );
+                #pragma omp parallel for schedule( static )
+                for( unsigned k = 0; k < ubin; ++ k ){
+                    GradStats s;
+                    for( size_t tid = 0; tid < htemp.size(); ++ tid ){
+                        s.Add( htemp[tid][k].sum_grad, htemp[tid][k].sum_hess );
+                    }
+                    hist[nid][k] = s;
+                }
+            }
+            // get histogram space of nid, from the space released by other nodes when possible
+            inline void AllocHist( int nid ){
+                if( hist.size() < (size_t)tree.param.num_nodes ) hist.resize( tree.param.num_nodes );
+                if( hist[nid].size() == 0 && hist_free.size() != 0 ){
+                    hist[nid].swap( hist_free.back() ); hist_free.pop_back();
+                }
+                hist[nid].resize( bindex.NumBin() );
+            }
+            // release histogram space of nid for reuse
+            inline void FreeHist( int nid ){
+                if( hist[nid].size() == 0 ) return;
+                hist_free.resize( hist_free.size() + 1 );
+                hist_free.back().swap( hist[nid] );
+            }
+            // after split, build histogram of smaller child, and get the larger one by subtraction
+            inline void UpdateHist( void ){
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    const int nid = qexpand[i];
+                    if( !tree[nid].is_leaf() ){
+                        int small = tree[nid].cleft(), large = tree[nid].cright();
+                        if( node_bound[small].second - node_bound[small].first >
+                            node_bound[large].second - node_bound[large].first ){
+                            std::swap( small, large );
+                        }
+                        this->BuildHist( small );
+                        this->AllocHist( large );
+                        const unsigned ubin = static_cast<unsigned>( hist[nid].size() );
+                        const GradStats *ph = &hist[nid][0], *sh = &hist[small][0];
+                        GradStats *lh = &hist[large][0];
+                        #pragma omp parallel for schedule( static )
+                        for( unsigned k = 0; k < ubin; ++ k ){
+                            lh[k].sum_grad = ph[k].sum_grad - sh[k].sum_grad;
+                            lh[k].sum_hess = ph[k].sum_hess - sh[k].sum_hess;
+                        }
+                    }
+                    // parent histogram is no longer needed
+                    this->FreeHist( nid );
+                }
+            }
+        private:
+            // try a split, s is the statistics of the side that does not take missing value
+            inline void TrySplit( SplitEntry &best, const NodeEntry &e, const GradStats &s,
+                                  unsigned fid, float split_value, bool default_left ){
+                const double csum_hess = e.sum_hess - s.sum_hess;
+                if( s.sum_hess >= param.min_child_weight && csum_hess >= param.min_child_weight ){
+                    const double csum_grad = e.sum_grad - s.sum_grad;
+                    const double loss_chg =
+                        + param.CalcGain( s.sum_grad, s.sum_hess, e.weight )
+                        + param.CalcGain( csum_grad , csum_hess , e.weight )
+                        - e.root_gain;
+                    best.Update( loss_chg, fid, split_value, default_left );
+                }
+            }
+            // enumerate the split points of feature fid on histogram of node nid
+            inline void EnumerateSplit( int nid, unsigned fid, SplitEntry &best ){
+                const NodeEntry &e = snode[ nid ];
+                const GradStats *h = &hist[nid][0];
+                const bst_uint begin = bindex.cut_ptr[ fid ], end = bindex.cut_ptr[ fid + 1 ];
+                if( param.need_forward_search() ){
+                    GradStats s;
+                    for( bst_uint k = begin; k < end; ++ k ){
+                        if( h[k].sum_hess == 0.0 ) continue;
+                        s.Add( h[k].sum_grad, h[k].sum_hess );
+                        this->TrySplit( best, e, s, fid, bindex.cut[k], false );
+                    }
+                }
+                if( param.need_backward_search() ){
+                    GradStats s;
+                    for( bst_uint k = end; k > begin; -- k ){
+                        if( h[k-1].sum_hess == 0.0 ) continue;
+                        s.Add( h[k-1].sum_grad, h[k-1].sum_hess );
+                        const float split_value = k - 1 == begin ? bindex.min_val[fid] - rt_eps : bindex.cut[k-2];
+                        this->TrySplit( best, e, s, fid, split_value, true );
+                    }
+                }
+            }
+            // find the best split of nodes in qexpand
+            inline void FindSplit( void ){
+                const unsigned nsize = static_cast<unsigned>( feat_level.size() );
+                for( size_t tid = 0; tid < stemp.size(); ++ tid ){
+                    stemp[tid].resize( tree.param.num_nodes, SplitEntry() );
+                }
+
+                #pragma omp parallel for schedule( dynamic, 1 )
+                for( unsigned i = 0; i < nsize; ++ i ){
+                    const unsigned fid = feat_level[i];
+                    const int tid = omp_get_thread_num();
+                    for( size_t j = 0; j < qexpand.size(); ++ j ){
+                        const int nid = qexpand[j];
+                        this->EnumerateSplit( nid, fid, stemp[tid][nid] );
+                    }
+                }
+
+                // after this each thread's stemp will get the best candidates, aggregate results
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    const int nid = qexpand[ i ];
+                    NodeEntry &e = snode[ nid ];
+                    for( size_t tid = 0; tid < stemp.size(); ++ tid ){
+                        e.best.Update( stemp[ tid ][ nid ] );
+                    }
+                }
+            }
+            // set split of nodes in qexpand and partition their rows, nodes without a useful split become leaves
+            inline void ApplySplit( void ){
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    const int nid = qexpand[ i ];
+                    NodeEntry &e = snode[ nid ];
+                    if( e.best.loss_chg > rt_eps ){
+                        tree.AddChilds( nid );
+                        tree[ nid ].set_split( e.best.split_index(), e.best.split_value, e.best.default_left() );
+                    } else{
+                        tree[ nid ].set_leaf( e.weight * param.learning_rate );
+                    }
+                }
+
+                // re-organize row_index_set of the splitted nodes
+                node_bound.resize( tree.param.num_nodes );
+                const int nexpand = static_cast<int>( qexpand.size() );
+                #pragma omp parallel for schedule( dynamic, 1 )
+                for( int i = 0; i < nexpand; ++ i ){
+                    if( !tree[ qexpand[i] ].is_leaf() ) this->MakeSplit( qexpand[i] );
+                }
+            }
+            // grow the tree by always splitting the candidate leaf with the largest loss change
+            inline void MakeLossGuide( int &stat_max_depth ){
+                ExpandQueue queue;
+                unsigned timestamp = 0;
+                int num_leaves = tree.param.num_roots;
+                this->SetLevelFeat();
+                this->FindSplit();
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    queue.push( ExpandEntry( qexpand[i], 0, snode[ qexpand[i] ].best.loss_chg, timestamp ++ ) );
+                }
+                while( !queue.empty() ){
+                    const ExpandEntry e = queue.top(); queue.pop();
+                    if( !this->NeedExpand( e, num_leaves ) ){
+                        tree[ e.nid ].set_leaf( snode[ e.nid ].weight * param.learning_rate );
+                        this->FreeHist( e.nid );
+                        continue;
+                    }
+                    qexpand.resize( 1 ); qexpand[0] = e.nid;
+                    this->ApplySplit();
+                    this->UpdateHist();
+                    this->UpdateQueueExpand( this->qexpand );
+                    this->InitNewNode( this->qexpand );
+                    ++ num_leaves;
+                    stat_max_depth = std::max( stat_max_depth, e.depth + 1 );
+                    this->SetLevelFeat();
+                    this->FindSplit();
+                    for( size_t i = 0; i < qexpand.size(); ++ i ){
+                        queue.push( ExpandEntry( qexpand[i], e.depth + 1, snode[ qexpand[i] ].best.loss_chg, timestamp ++ ) );
+                    }
+                }
+                qexpand.clear();
+            }
+            // partition the rows of nid into its two children, keep the order of rows
+            inline void MakeSplit( int nid ){
+                const unsigned split_index = tree[nid].split_index();
+                const float    split_value = tree[nid].split_cond();
+
+                std::vector<bst_uint> right;
+                bst_uint top = node_bound[nid].first;
+                for( bst_uint i = node_bound[ nid ].first; i < node_bound[ nid ].second; ++i ){
+                    const bst_uint ridx = row_index_set[i];
+                    bool goleft = tree[ nid ].default_left();
+                    for( typename FMatrix::RowIter it = smat.GetRow(ridx); it.Next(); ){
+                        if( it.findex() == split_index ){
+                            goleft = it.fvalue() < split_value; break;
+                        }
+                    }
+                    if( goleft ) {
+                        row_index_set[ top ++ ] = ridx;
+                    }else{
+                        right.push_back( ridx );
+                    }
+                }
+                node_bound[ tree[nid].cleft() ]  = std::make_pair( node_bound[nid].first, top );
+                node_bound[ tree[nid].cright() ] = std::make_pair( top, node_bound[nid].second );
+                for( size_t i = 0; i < right.size(); ++ i ){
+                    row_index_set[ top ++ ] = right[ i ];
+                }
+            }
+        private:
+            // initialize temp data structure
+            inline void InitData( void ){
+                {// setup temp space for each thread
+                    if( param.nthread != 0 ){
+                        omp_set_num_threads( param.nthread );
+                    }
+                    #pragma omp parallel
+                    {
+                        this->nthread = omp_get_num_threads();
+                    }
+                    stemp.resize( this->nthread, std::vector<SplitEntry>() );
+                    htemp.resize( this->nthread );
+                    // entries left by the previous tree are cleared, the space is kept
+                    for( int i = 0; i < this->nthread; ++ i ){
+                        stemp[i].clear(); htemp[i].resize( bindex.NumBin() );
+                    }
+                    for( size_t nid = 0; nid < hist.size(); ++ nid ){
+                        this->FreeHist( static_cast<int>( nid ) );
+                    }
+                    snode.clear(); snode.reserve( 256 );
+                }
+                {// sample rows, and put them into root nodes
+                    std::vector<bst_uint> valid_index;
+                    for( size_t i = 0; i < gpair.size(); ++i ){
+                        if( gpair[ i ].hess < 0.0f ) continue;
+                        if( param.subsample > 1.0f-1e-6f || random::SampleBinary( param.subsample ) != 0 ){
+                            valid_index.push_back( static_cast<bst_uint>(i) );
+                        }
+                    }
+                    node_bound.resize( tree.param.num_roots );
+                    if( root_index.size() == 0 ){
+                        row_index_set = valid_index;
+                        node_bound[0] = std::make_pair( 0, (bst_uint)row_index_set.size() );
+                    }else{
+                        std::vector<size_t> rptr;
+                        utils::SparseCSRMBuilder<bst_uint> builder( rptr, row_index_set );
+                        builder.InitBudget( tree.param.num_roots );
+                        for( size_t i = 0; i < valid_index.size(); ++i ){
+                            const bst_uint rid = valid_index[ i ];
+                            utils::Assert( root_index[ rid ] < (unsigned)tree.param.num_roots, "root id exceed number of roots" );
+                            builder.AddBudget( root_index[ rid ] );
+                        }
+                        builder.InitStorage();
+                        for( size_t i = 0; i < valid_index.size(); ++i ){
+                            const bst_uint rid = valid_index[ i ];
+                            builder.PushElem( root_index[ rid ], rid );
+                        }
+                        for( size_t i = 1; i < rptr.size(); ++ i ){
+                            node_bound[i-1] = std::make_pair( rptr[ i - 1 ], rptr[ i ] );
+                        }
+                    }
+                }
+                {// initialize feature index
+                    std::vector<int> findex;
+                    unsigned ncol = static_cast<unsigned>( bindex.cut_ptr.size() - 1 );
+                    for( unsigned i = 0; i < ncol; i ++ ){
+                        if( bindex.cut_ptr[i+1] != bindex.cut_ptr[i] && constrain.NotBanned(i) ){
+                            findex.push_back( static_cast<int>( i ) );
+                        }
+                    }
+                    this->SampleFeat( findex, param.colsample_bytree );
+                    feat_mask.clear(); feat_mask.resize( ncol, 0 );
+                    for( size_t i = 0; i < findex.size(); ++ i ){
+                        feat_mask[ findex[i] ] = 1;
+                    }
+                    feat_index.clear();
+                    for( unsigned i = 0; i < ncol; i ++ ){
+                        if( feat_mask[i] != 0 ) feat_index.push_back( i );
+                    }
+                }
+                {// expand query
+                    qexpand.reserve( 256 ); qexpand.clear();
+                    for( int i = 0; i < tree.param.num_roots; ++ i ){
+                        qexpand.push_back( i );
+                    }
+                }
+            }
+            // sample the features scanned in the next level
+            inline void SetLevelFeat( void ){
+                std::vector<int> fbuf;
+                this->SampleLevelFeat( feat_mask, fbuf );
+                feat_level.clear();
+                for( size_t i = 0; i < feat_index.size(); ++ i ){
+                    if( feat_mask[ feat_index[i] ] == 2 ) feat_level.push_back( feat_index[i] );
+                }
+            }
+        private:
+            // number of omp thread used during training
+            int nthread;
+            // buffers in the workspace, see Workspace
+            std::vector<unsigned> &feat_index;
+            std::vector<char> &feat_mask;
+            std::vector<unsigned> &feat_level;
+            std::vector<bst_uint> &row_index_set;
+            std::vector< std::pair<bst_uint, bst_uint> > &node_bound;
+            std::vector< std::vector<GradStats> > &hist;
+            std::vector< std::vector<GradStats> > &hist_free;
+            std::vector< std::vector<GradStats> > &htemp;
+            std::vector< std::vector<SplitEntry> > &stemp;
+        private:
+            const GPairView          gpair;
+            const FMatrix            &smat;
+            const std::vector<unsigned> &root_index;
+            const utils::FeatConstrain  &constrain;
+            const typename FMatrix::BinIndex &bindex;
+        };
+    };
+};
+#endif
@@ -0,0 +1,484 @@
+#ifndef XGBOOST_MULTI_TREEMAKER_HPP
+#define XGBOOST_MULTI_TREEMAKER_HPP
+/*!
+ * \file xgboost_multi_treemaker.hpp
+ * \brief implementation of multi-output regression tree maker,
+ *        one tree fits K gradient channels together, the split gain is summed over channels
+ *        and each node stores a vector of K weights, use a column based approach, with OpenMP
+ * \author Tianqi Chen: tianqi.tchen@gmail.com
+ */
+// use openmp
+#include <vector>
+#include <climits>
+#include <algorithm>
+#include "xgboost_tree_model.h"
+#include "../../utils/xgboost_omp.h"
+#include "../../utils/xgboost_random.h"
+#include "../../utils/xgboost_fmap.h"
+#include "xgboost_base_treemaker.hpp"
+
+namespace xgboost{
+    namespace booster{
+        template<typename FMatrix>
+        class MultiTreeMaker : protected BaseTreeMaker{
+        public:
+            struct Workspace;
+            /*!
+             * \brief constructor
+             * \param gpair gradient pairs of size_leaf_vector channels, the gradients of channel k
+             *        are stored in [ k * nrow, (k+1) * nrow )
+             */
+            MultiTreeMaker( RegTree &tree,
+                            const TreeParamTrain &param,
+                            const GPairView &gpair,
+                            const FMatrix &smat,
+                            const std::vector<unsigned> &root_index,
+                            const utils::FeatConstrain  &constrain,
+                            Workspace &wspace )
+                : BaseTreeMaker( tree, param, wspace ),
+                  feat_index( wspace.feat_index ), block_feat( wspace.block_feat ), feat_mask( wspace.feat_mask ),
+                  block_level( wspace.block_level ), position( wspace.position ),
+                  active( wspace.active ), gbuf( wspace.gbuf ), nstats( wspace.nstats ), node_slot( wspace.node_slot ),
+                  stemp( wspace.stemp ), gtemp( wspace.gtemp ),
+                  gpair(gpair),
+                  smat(smat), root_index(root_index), constrain(constrain),
+                  nchannel( tree.param.size_leaf_vector ), nrow( smat.NumRow() ) {
+                utils::Assert( nchannel > 0, "MultiTreeMaker: size_leaf_vector must be positive" );
+                utils::Assert( nrow * nchannel == gpair.size(), "booster:invalid input" );
+                utils::Assert( root_index.size() == 0 || root_index.size() == nrow, "booster:invalid input" );
+                utils::Assert( smat.HaveColAccess(), "MultiTreeMaker: need column access matrix" );
+                utils::Assert( param.grow_policy == 0, "MultiTreeMaker: only depthwise grow_policy is supported" );
+                utils::Assert( param.use_layerwise == 0, "MultiTreeMaker: use_layerwise is not supported" );
+                utils::Assert( param.approx_method == 0, "MultiTreeMaker: only exact split finding is supported" );
+                utils::Assert( param.feature_bundle == 0, "MultiTreeMaker: feature_bundle is not supported" );
+            }
+            inline void Make( int& stat_max_depth, int& stat_num_pruned ){
+                this->InitData();
+                this->InitNewNode( this->qexpand );
+                stat_max_depth = 0;
+                for( int depth = 0; depth < param.max_depth; ++ depth ){
+                    this->SetLevelFeat();
+                    this->FindSplit();
+                    this->ApplySplit();
+                    this->UpdatePosition();
+                    this->UpdateQueueExpand( this->qexpand );
+                    this->InitNewNode( this->qexpand );
+                    // if nothing left to be expand, break
+                    if( qexpand.size() == 0 ) break;
+                    stat_max_depth = depth + 1;
+                }
+                // set all the rest expanding nodes to leaf, the values are in the leaf vector
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    tree[ qexpand[i] ].set_leaf( 0.0f );
+                }
+                // start prunning the tree
+                stat_num_pruned = this->DoPrune();
+            }
+            /*!
+             * \brief get the leaf each instance reached, call after Make
+             * \param leaf output leaf of each instance in the pruned tree, -1 if the instance is not used in training
+             */
+            inline void GetLeafPosition( std::vector<int> &leaf ) const{
+                leaf.resize( position.size() );
+                const unsigned ndata = static_cast<unsigned>( position.size() );
+                #pragma omp parallel for schedule( static )
+                for( unsigned i = 0; i < ndata; ++ i ){
+                    const int nid = position[i];
+                    if( nid == kUnused ){
+                        leaf[i] = -1;
+                    }else{
+                        leaf[i] = this->PrunedLeaf( nid >= 0 ? nid : ~nid );
+                    }
+                }
+            }
+        private:
+            /*! \brief gradient statistics of one channel */
+            struct GradStats{
+                /*! \brief sum gradient statistics */
+                double sum_grad;
+                /*! \brief sum hessian statistics */
+                double sum_hess;
+                /*! \brief constructor */
+                GradStats( void ){
+                    this->Clear();
+                }
+                /*! \brief clear statistics */
+                inline void Clear( void ){
+                    sum_grad = sum_hess = 0.0;
+                }
+                /*! \brief add statistics */
+                inline void Add( const bst_gpair &p ){
+                    sum_grad += p.grad; sum_hess += p.hess;
+                }
+            };
+            /*! \brief per thread x per node entry to store tmp data */
+            struct ThreadEntry{
+                /*! \brief sum hessian statistics over all channels */
+                double sum_hess;
+                /*! \brief last feature value scanned */
+                float  last_fvalue;
+                /*! \brief current best solution */
+                SplitEntry best;
+                /*! \brief constructor */
+                ThreadEntry( void ){
+                    sum_hess = 0.0;
+                }
+            };
+        public:
+            /*! \brief buffers of the multi-output tree maker, see BaseTreeMaker::Workspace */
+            struct Workspace : public BaseTreeMaker::Workspace{
+                // Per feature: index of features that can be used for split
+                std::vector<int> feat_index;
+                // PerColBlock: positions in feat_index of the features in the block
+                std::vector< std::vector<unsigned> > block_feat;
+                // PerFeature: 0 if the feature is not sampled for the tree, 1 if it is, 2 if it is also sampled for the current level
+                std::vector<char> feat_mask;
+                // PerColBlock: positions in feat_index of the features in the block sampled for the current level
+                std::vector< std::vector<unsigned> > block_level;
+                // Instance Data: current node position in the tree of each instance,
+                // ~nid once the instance is in leaf nid, kUnused if the instance is not used
+                std::vector<int> position;
+                // instances that are still in expanding nodes
+                std::vector<bst_uint> active;
+                // Instance x Channel: gradients of each instance stored together
+                std::vector<bst_gpair> gbuf;
+                // PerTreeNode x Channel: gradient statistics of each node
+                std::vector<GradStats> nstats;
+                // PerTreeNode: slot of nodes in qexpand
+                std::vector<int> node_slot;
+                // PerThread x PerExpandNode: statistics for per thread construction
+                std::vector< std::vector<ThreadEntry> > stemp;
+                // PerThread x PerExpandNode x Channel: gradient statistics for per thread construction
+                std::vector< std::vector<GradStats> > gtemp;
+            };
+        private:
+            // make leaf nodes for all qexpand, update node statistics and node weight vectors
+            inline void InitNewNode( const std::vector<int> &qexpand ){
+                snode.resize( tree.param.num_nodes, NodeEntry() );
+                nstats.resize( tree.param.num_nodes * nchannel );
+                node_slot.resize( tree.param.num_nodes, -1 );
+                for( size_t j = 0; j < qexpand.size(); ++ j ){
+                    node_slot[ qexpand[j] ] = static_cast<int>( j );
+                }
+                const size_t nslot = qexpand.size() * nchannel;
+                for( size_t i = 0; i < gtemp.size(); ++ i ){
+                    gtemp[i].resize( std::max( gtemp[i].size(), nslot ) );
+                    std::fill( gtemp[i].begin(), gtemp[i].begin() + nslot, GradStats() );
+                }
+
+                const unsigned ndata = static_cast<unsigned>( active.size() );
+                #pragma omp parallel for schedule( static )
+                for( unsigned j = 0; j < ndata; ++ j ){
+                    const bst_uint ridx = active[j];
+                    if( position[ ridx ] < 0 ) continue;
+                    GradStats *s = &gtemp[ omp_get_thread_num() ][0] + node_slot[ position[ridx] ] * nchannel;
+                    const bst_gpair *p = &gbuf[0] + ridx * nchannel;
+                    for( size_t k = 0; k < nchannel; ++ k ){
+                        s[k].Add( p[k] );
+                    }
+                }
+
+                for( size_t j = 0; j < qexpand.size(); ++ j ){
+                    const int nid = qexpand[ j ];
+                    GradStats *ns = &nstats[0] + nid * nchannel;
+                    float *vec = tree.leafvec( nid );
+                    double sum_hess = 0.0, root_gain = 0.0;
+                    for( size_t k = 0; k < nchannel; ++ k ){
+                        ns[k].Clear();
+                        for( size_t tid = 0; tid < gtemp.size(); ++ tid ){
+                            ns[k].sum_grad += gtemp[tid][ j * nchannel + k ].sum_grad;
+                            ns[k].sum_hess += gtemp[tid][ j * nchannel + k ].sum_hess;
+                        }
+                        sum_hess += ns[k].sum_hess;
+                        root_gain += param.CalcGain( ns[k].sum_grad, ns[k].sum_hess, 0.0 );
+                        vec[k] = static_cast<float>( param.CalcWeight( ns[k].sum_grad, ns[k].sum_hess, 0.0 ) * param.learning_rate );
+                    }
+                    // scalar weight is not used, the node becomes a leaf with value 0 when pruned
+                    snode[nid].sum_hess = sum_hess;
+                    snode[nid].root_gain = static_cast<float>( root_gain );
+                    snode[nid].weight = 0.0f;
+                    tree.stat(nid).base_weight = 0.0f;
+                }
+            }
+        private:
+            // loss change of splitting node nid into left statistics ls and the rest
+            inline double CalcLossChg( int nid, const GradStats *ls ) const{
+                const GradStats *ns = &nstats[0] + nid * nchannel;
+                double gain = 0.0;
+                for( size_t k = 0; k < nchannel; ++ k ){
+                    gain += param.CalcGain( ls[k].sum_grad, ls[k].sum_hess, 0.0 )
+                        + param.CalcGain( ns[k].sum_grad - ls[k].sum_grad, ns[k].sum_hess - ls[k].sum_hess, 0.0 );
+                }
+                return gain - snode[nid].root_gain;
+            }
+            // enumerate the split values of specific feature, the statistics of all channels are updated in one scan
+            template<typename Iter>
+            inline void EnumerateSplit( Iter it, const unsigned fid, std::vector<ThreadEntry> &temp,
+                                        std::vector<GradStats> &gstat, bool is_forward_search ){
+                // clear all the temp statistics
+                for( size_t j = 0; j < qexpand.size(); ++ j ){
+                    temp[ j ].sum_hess = 0.0;
+                }
+                std::fill( gstat.begin(), gstat.begin() + qexpand.size() * nchannel, GradStats() );
+
+                while( it.Next() ){
+                    const bst_uint ridx = it.rindex();
+                    const int nid = position[ ridx ];
+                    if( nid < 0 ) continue;
+
+                    const float fvalue = it.fvalue();
+                    const int slot = node_slot[ nid ];
+                    ThreadEntry &e = temp[ slot ];
+                    GradStats *s = &gstat[0] + slot * nchannel;
+                    const bst_gpair *p = &gbuf[0] + ridx * nchannel;
+                    // test if first hit, this is fine, because we set 0 during init
+                    if( e.sum_hess != 0.0 && fabsf(fvalue - e.last_fvalue) > rt_2eps && e.sum_hess >= param.min_child_weight ){
+                        // try to find a split
+                        if( snode[ nid ].sum_hess - e.sum_hess >= param.min_child_weight ){
+                            e.best.Update( static_cast<float>( this->CalcLossChg( nid, s ) ), fid,
+                                           (fvalue + e.last_fvalue) * 0.5f, !is_forward_search );
+                        }
+                    }
+                    // update the statistics
+                    for( size_t k = 0; k < nchannel; ++ k ){
+                        s[k].Add( p[k] ); e.sum_hess += p[k].hess;
+                    }
+                    e.last_fvalue = fvalue;
+                }
+                // finish updating all statistics, check if it is possible to include all sum statistics
+                for( size_t j = 0; j < qexpand.size(); ++ j ){
+                    const int nid = qexpand[ j ];
+                    ThreadEntry &e = temp[ j ];
+                    if( e.sum_hess >= param.min_child_weight && snode[nid].sum_hess - e.sum_hess >= param.min_child_weight ){
+                        const float delta = is_forward_search ? rt_eps:-rt_eps;
+                        e.best.Update( static_cast<float>( this->CalcLossChg( nid, &gstat[0] + j * nchannel ) ), fid,
+                                       e.last_fvalue + delta, !is_forward_search );
+                    }
+                }
+            }
+            // find the best split of nodes in qexpand
+            inline void FindSplit( void ){
+                for( size_t i = 0; i < stemp.size(); ++ i ){
+                    stemp[i].resize( qexpand.size() );
+                    std::fill( stemp[i].begin(), stemp[i].end(), ThreadEntry() );
+                }
+                // columns are visited block by block, a single block holds all columns when they are in memory
+                for( unsigned b = 0; b < block_level.size(); ++ b ){
+                    if( block_level[b].size() == 0 ) continue;
+                    smat.FetchColBlock( b );
+                    const std::vector<unsigned> &findex = block_level[b];
+                    const unsigned nsize = static_cast<unsigned>( findex.size() );
+                    #pragma omp parallel for schedule( dynamic, 1 )
+                    for( unsigned i = 0; i < nsize; ++ i ){
+                        const unsigned fid = feat_index[ findex[i] ];
+                        const int tid = omp_get_thread_num();
+                        if( param.need_forward_search() ){
+                            this->EnumerateSplit( smat.GetSortedCol( fid ), fid, stemp[tid], gtemp[tid], true );
+                        }
+                        if( param.need_backward_search() ){
+                            this->EnumerateSplit( smat.GetReverseSortedCol( fid ), fid, stemp[tid], gtemp[tid], false );
+                        }
+                    }
+                }
+                // after this each thread's stemp will get the best candidates, aggregate results
+                for( size_t j = 0; j < qexpand.size(); ++ j ){
+                    NodeEntry &e = snode[ qexpand[j] ];
+                    for( int tid = 0; tid < this->nthread; ++ tid ){
+                        e.best.Update( stemp[ tid ][ j ].best );
+                    }
+                }
+            }
+            // set split of nodes in qexpand, nodes without a useful split become leaves
+            inline void ApplySplit( void ){
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    const int nid = qexpand[ i ];
+                    NodeEntry &e = snode[ nid ];
+                    if( e.best.loss_chg > rt_eps ){
+                        tree.AddChilds( nid );
+                        tree[ nid ].set_split( e.best.split_index(), e.best.split_value, e.best.default_left() );
+                    } else{
+                        tree[ nid ].set_leaf( 0.0f );
+                    }
+                }
+            }
+            // move instances of nodes in qexpand to the children, instances in leaf nodes get ~nid
+            inline void UpdatePosition( void ){
+                // step 1, set default direct nodes to default, and instances in leaf nodes to ~nid
+                const unsigned ndata = static_cast<unsigned>( active.size() );
+                #pragma omp parallel for schedule( static )
+                for( unsigned j = 0; j < ndata; ++ j ){
+                    const bst_uint i = active[j];
+                    const int nid = position[i];
+                    if( tree[ nid ].is_leaf() ){
+                        position[i] = ~nid;
+                    }else{
+                        // push to default branch, correct latter
+                        position[i] = tree[nid].default_left() ? tree[nid].cleft(): tree[nid].cright();
+                    }
+                }
+                // instances in leaves leave the active set
+                size_t top = 0;
+                for( size_t j = 0; j < active.size(); ++ j ){
+                    if( position[ active[j] ] >= 0 ) active[ top ++ ] = active[j];
+                }
+                active.resize( top );
+
+                // step 2, classify the non-default data into right places
+                std::vector<unsigned> fsplits;
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    const int nid = qexpand[i];
+                    if( !tree[nid].is_leaf() ) fsplits.push_back( tree[nid].split_index() );
+                }
+                std::sort( fsplits.begin(), fsplits.end() );
+                fsplits.resize( std::unique( fsplits.begin(), fsplits.end() ) - fsplits.begin() );
+
+                size_t i = 0;
+                for( unsigned b = 0; b < smat.NumColBlock() && i < fsplits.size(); ++ b ){
+                    const size_t begin = i;
+                    while( i < fsplits.size() && fsplits[i] < smat.ColBlockBegin( b + 1 ) ) ++ i;
+                    if( i == begin ) continue;
+                    smat.FetchColBlock( b );
+                    const unsigned nfeats = static_cast<unsigned>( i - begin );
+                    #pragma omp parallel for schedule( dynamic, 1 )
+                    for( unsigned j = 0; j < nfeats; ++ j ){
+                        const unsigned fid = fsplits[ begin + j ];
+                        for( typename FMatrix::ColIter it = smat.GetSortedCol( fid ); it.Next(); ){
+                            const bst_uint ridx = it.rindex();
+                            int nid = position[ ridx ];
+                            if( nid < 0 ) continue;
+                            // go back to parent, correct those who are not default
+                            nid = tree[ nid ].parent();
+                            if( tree[ nid ].split_index() == fid ){
+                                if( it.fvalue() < tree[nid].split_cond() ){
+                                    position[ ridx ] = tree[ nid ].cleft();
+                                }else{
+                                    position[ ridx ] = tree[ nid ].cright();
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            // sample the features scanned in the next level, and collect them per column block
+            inline void SetLevelFeat( void ){
+                std::vector<int> fbuf;
+                this->SampleLevelFeat( feat_mask, fbuf );
+                block_level.resize( block_feat.size() );
+                for( size_t b = 0; b < block_feat.size(); ++ b ){
+                    block_level[b].clear();
+                    for( size_t j = 0; j < block_feat[b].size(); ++ j ){
+                        if( feat_mask[ feat_index[ block_feat[b][j] ] ] == 2 ) block_level[b].push_back( block_feat[b][j] );
+                    }
+                }
+            }
+        private:
+            // initialize temp data structure
+            inline void InitData( void ){
+                {
+                    position.resize( nrow );
+                    if( root_index.size() == 0 ){
+                        std::fill( position.begin(), position.end(), 0 );
+                    }else{
+                        for( size_t i = 0; i < root_index.size(); ++ i ){
+                            position[i] = root_index[i];
+                            utils::Assert( root_index[i] < (unsigned)tree.param.num_roots, "root index exceed setting" );
+                        }
+                    }
+                    // gradients of an instance are put together, so that one scan entry reads them from one place
+                    gbuf.resize( nrow * nchannel );
+                    for( size_t k = 0; k < nchannel; ++ k ){
+                        for( size_t i = 0; i < nrow; ++ i ){
+                            gbuf[ i * nchannel + k ] = gpair[ k * nrow + i ];
+                            // mark delete for the deleted datas
+                            if( gpair[ k * nrow + i ].hess < 0.0f ) position[i] = kUnused;
+                        }
+                    }
+                    if( param.subsample < 1.0f - 1e-6f ){
+                        for( size_t i = 0; i < nrow; ++ i ){
+                            if( position[i] == kUnused ) continue;
+                            if( random::SampleBinary( param.subsample) == 0 ){
+                                position[ i ] = kUnused;
+                            }
+                        }
+                    }
+                    active.clear();
+                    for( size_t i = 0; i < nrow; ++ i ){
+                        if( position[i] >= 0 ) active.push_back( static_cast<bst_uint>( i ) );
+                    }
+                }
+                {// initialize feature index
+                    feat_index.clear();
+                    int ncol = static_cast<int>( smat.NumCol() );
+                    for( int i = 0; i < ncol; i ++ ){
+                        if( smat.GetColSize(i) != 0 && constrain.NotBanned(i) ){
+                            feat_index.push_back( i );
+                        }
+                    }
+                    random::Shuffle( feat_index );
+                    this->SampleFeat( feat_index, param.colsample_bytree );
+                    feat_mask.clear(); feat_mask.resize( ncol, 0 );
+                    for( size_t i = 0; i < feat_index.size(); ++ i ){
+                        feat_mask[ feat_index[i] ] = 1;
+                    }
+                    // group features by column block, keeping the shuffled order within each block
+                    block_feat.resize( smat.NumColBlock() );
+                    for( size_t b = 0; b < block_feat.size(); ++ b ){
+                        block_feat[b].clear();
+                    }
+                    for( size_t i = 0; i < feat_index.size(); ++ i ){
+                        unsigned b = 0;
+                        while( smat.ColBlockBegin( b + 1 ) <= static_cast<size_t>( feat_index[i] ) ) ++ b;
+                        block_feat[b].push_back( static_cast<unsigned>( i ) );
+                    }
+                }
+                {// setup temp space for each thread
+                    if( param.nthread != 0 ){
+                        omp_set_num_threads( param.nthread );
+                    }
+                    #pragma omp parallel
+                    {
+                        this->nthread = omp_get_num_threads();
+                    }
+                    stemp.resize( this->nthread );
+                    gtemp.resize( this->nthread );
+                    // entries left by the previous tree are cleared, the space is kept
+                    snode.clear(); snode.reserve( 256 );
+                    node_slot.clear();
+                }
+                {// expand query
+                    qexpand.reserve( 256 ); qexpand.clear();
+                    for( int i = 0; i < tree.param.num_roots; ++ i ){
+                        qexpand.push_back( i );
+                    }
+                }
+            }
+        private:
+            // number of omp thread used during training
+            int nthread;
+            // position of instances that are not used in training
+            static const int kUnused = INT_MIN;
+            // buffers in the workspace, see Workspace
+            std::vector<int> &feat_index;
+            std::vector< std::vector<unsigned> > &block_feat;
+            std::vector<char> &feat_mask;
+            std::vector< std::vector<unsigned> > &block_level;
+            std::vector<int> &position;
+            std::vector<bst_uint> &active;
+            std::vector<bst_gpair> &gbuf;
+            std::vector<GradStats> &nstats;
+            std::vector<int> &node_slot;
+            std::vector< std::vector<ThreadEntry> > &stemp;
+            std::vector< std::vector<GradStats> > &gtemp;
+        private:
+            const GPairView          gpair;
+            const FMatrix            &smat;
+            const std::vector<unsigned> &root_index;
+            const utils::FeatConstrain  &constrain;
+            // number of gradient channels, the size of leaf vector
+            const size_t nchannel;
+            // number of instances
+            const size_t nrow;
+        };
+    };
+};
+#endif
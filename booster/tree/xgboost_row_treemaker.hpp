@@ -8,6 +8,7 @@
  */
 // use openmp
 #include <vector>
+#include <algorithm>
 #include "xgboost_tree_model.h"
 #include "../../utils/xgboost_omp.h"
 #include "../../utils/xgboost_random.h"
@@ -19,19 +20,23 @@ namespace xgboost{
         template<typename FMatrix>
         class RowTreeMaker : protected BaseTreeMaker{
         public:
+            struct Workspace;
             RowTreeMaker( RegTree &tree,
                           const TreeParamTrain &param, 
-                          const std::vector<float> &grad,
-                          const std::vector<float> &hess,
+                          const GPairView &gpair,
                           const FMatrix &smat, 
                           const std::vector<unsigned> &root_index, 
-                          const utils::FeatConstrain &constrain )
-                : BaseTreeMaker( tree, param ), 
-                  grad(grad), hess(hess), 
+                          const utils::FeatConstrain &constrain,
+                          Workspace &wspace )
+                : BaseTreeMaker( tree, param, wspace ), 
+                  row_index_set( wspace.row_index_set ), node_bound( wspace.node_bound ), col_entry( wspace.col_entry ),
+                  col_slice( wspace.col_slice ), feat_bound( wspace.feat_bound ), col_right( wspace.col_right ),
+                  right_slice( wspace.right_slice ), row_left( wspace.row_left ), root_cut( wspace.root_cut ),
+                  feat_mask( wspace.feat_mask ),
+                  gpair(gpair), 
                   smat(smat), root_index(root_index), constrain(constrain) {
-                utils::Assert( grad.size() == hess.size(), "booster:invalid input" );
-                utils::Assert( smat.NumRow() == hess.size(), "booster:invalid input" );
-                utils::Assert( root_index.size() == 0 || root_index.size() == hess.size(), "booster:invalid input" ); 
+                utils::Assert( smat.NumRow() == gpair.size(), "booster:invalid input" );
+                utils::Assert( root_index.size() == 0 || root_index.size() == gpair.size(), "booster:invalid input" ); 
                 {// setup temp space for each thread
                     if( param.nthread != 0 ){
                         omp_set_num_threads( param.nthread );
@@ -40,8 +45,7 @@ namespace xgboost{
                     {
                         this->nthread = omp_get_num_threads();
                     }
-                    tmp_rptr.resize( this->nthread, std::vector<size_t>() );
-                    snode.reserve( 256 );
+                    kernel = GetLossChgKernel( param.use_simd );
                 }
             }
             inline void Make( int& stat_max_depth, int& stat_num_pruned ){
@@ -49,28 +53,51 @@ namespace xgboost{
                 this->InitNewNode( this->qexpand );
                 stat_max_depth = 0;
                 
-                for( int depth = 0; depth < param.max_depth; ++ depth ){                                        
-                    this->FindSplit( this->qexpand, depth );
-                    this->UpdateQueueExpand( this->qexpand );
-                    this->InitNewNode( this->qexpand );
-                    // if nothing left to be expand, break
-                    if( qexpand.size() == 0 ) break;
-                    stat_max_depth = depth + 1;
-                }
-                // set all the rest expanding nodes to leaf
-                for( size_t i = 0; i < qexpand.size(); ++ i ){
-                    const int nid = qexpand[i];
-                    tree[ nid ].set_leaf( snode[nid].weight * param.learning_rate );
+                if( param.grow_policy == 1 ){
+                    this->MakeLossGuide( stat_max_depth );
+                }else{
+                    for( int depth = 0; depth < param.max_depth; ++ depth ){
+                        this->SetLevelFeat();
+                        this->FindSplitLevel( this->qexpand );
+                        this->UpdateQueueExpand( this->qexpand );
+                        this->InitNewNode( this->qexpand );
+                        // if nothing left to be expand, break
+                        if( qexpand.size() == 0 ) break;
+                        stat_max_depth = depth + 1;
+                    }
+                    // set all the rest expanding nodes to leaf
+                    for( size_t i = 0; i < qexpand.size(); ++ i ){
+                        const int nid = qexpand[i];
+                        tree[ nid ].set_leaf( snode[nid].weight * param.learning_rate );
+                    }
                 }
                 // start prunning the tree
                 stat_num_pruned = this->DoPrune();
             }
+            /*!
+             * \brief get the leaf each instance reached, call after Make
+             * \param nrow number of instances
+             * \param leaf output leaf of each instance in the pruned tree, -1 if the instance is not used in training
+             */
+            inline void GetLeafPosition( size_t nrow, std::vector<int> &leaf ){
+                leaf.clear(); leaf.resize( nrow, -1 );
+                // leaves before pruning are leaves or deleted nodes now, their bounds cover all used instances
+                for( int nid = 0; nid < (int)node_bound.size(); ++ nid ){
+                    if( !tree[ nid ].is_leaf() ) continue;
+                    const int leaf_id = this->PrunedLeaf( nid );
+                    for( bst_uint i = node_bound[ nid ].first; i < node_bound[ nid ].second; ++ i ){
+                        leaf[ row_index_set[i] ] = leaf_id;
+                    }
+                }
+            }
             // expand a specific node
             inline bool Expand( const std::vector<bst_uint> &valid_index, int nid ){
                 if( valid_index.size() == 0 ) return false;
                 this->InitDataExpand( valid_index, nid );
                 this->InitNewNode( this->qexpand );
-                this->FindSplit( nid, tmp_rptr[0] );
+                this->SetLevelFeat();
+                this->FindBestSplit( nid );
+                this->ApplySplit( nid );
 
                 // update node statistics
                 for( size_t i = 0; i < qexpand.size(); ++ i ){
@@ -106,6 +133,87 @@ namespace xgboost{
                 tree.stat( nid ).sum_hess = static_cast<float>( snode[ nid ].sum_hess );
                 tree.CollapseToLeaf( nid, snode[nid].weight * param.learning_rate );
             }
+            /*!
+             * \brief grow the subtrees below leaves handed over by another maker level by level, the subtrees are not pruned
+             * \param nodes leaves to grow from, their statistics must be ready in node_stat
+             * \param rows instances of the leaves, instances of nodes[k] are rows[ rptr[k], rptr[k+1] )
+             * \param rptr bound of the instances of each leaf in rows
+             * \param max_depth maximum depth of the subtrees
+             * \param node_stat statistics of each tree node, statistics of the new nodes are added to it
+             * \param position output, instances in rows get ~nid of the leaf they reach
+             * \param tree_mask features sampled for the tree, nonzero for each sampled feature
+             * \return depth of the deepest subtree
+             */
+            inline int ExpandSubtrees( const std::vector<int> &nodes, const std::vector<bst_uint> &rows,
+                                       const std::vector<size_t> &rptr, int max_depth,
+                                       std::vector<NodeEntry> &node_stat, std::vector<int> &position,
+                                       const std::vector<char> &tree_mask ){
+                row_index_set = rows;
+                feat_mask = tree_mask;
+                feat_mask.resize( tree.param.num_feature, 0 );
+                node_bound.clear();
+                node_bound.resize( tree.param.num_nodes, std::make_pair( 0U, 0U ) );
+                this->ClearCols();
+                for( size_t k = 0; k < nodes.size(); ++ k ){
+                    node_bound[ nodes[k] ] = std::make_pair( (bst_uint)rptr[k], (bst_uint)rptr[k+1] );
+                    this->BuildNodeCols( nodes[k] );
+                }
+                snode.swap( node_stat );
+                qexpand = nodes;
+                int stat_max_depth = 0;
+                for( int depth = 0; depth < max_depth; ++ depth ){
+                    this->SetLevelFeat();
+                    this->FindSplitLevel( this->qexpand );
+                    this->UpdateQueueExpand( this->qexpand );
+                    this->InitNewNode( this->qexpand );
+                    if( qexpand.size() == 0 ) break;
+                    stat_max_depth = depth + 1;
+                }
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    const int nid = qexpand[i];
+                    tree[ nid ].set_leaf( snode[nid].weight * param.learning_rate );
+                }
+                for( int nid = 0; nid < (int)node_bound.size(); ++ nid ){
+                    if( !tree[ nid ].is_leaf() ) continue;
+                    for( bst_uint i = node_bound[ nid ].first; i < node_bound[ nid ].second; ++ i ){
+                        position[ row_index_set[i] ] = ~nid;
+                    }
+                }
+                snode.swap( node_stat );
+                return stat_max_depth;
+            }
+        private:
+            /*! \brief entries of feature findex in a node, col_entry[ begin, end ) sorted by feature value */
+            struct ColSlice{
+                unsigned findex;
+                size_t begin, end;
+                ColSlice( unsigned findex, size_t begin, size_t end )
+                    : findex( findex ), begin( begin ), end( end ){}
+            };
+        public:
+            /*! \brief buffers of the row tree maker, see BaseTreeMaker::Workspace */
+            struct Workspace : public BaseTreeMaker::Workspace{
+                // Instance row indexes corresponding to each node
+                std::vector<bst_uint> row_index_set;
+                // lower and upper bound of each nodes' row_index
+                std::vector< std::pair<bst_uint, bst_uint> > node_bound;
+                // sorted column entries of the nodes, the slices of a node lie in one region split between its children
+                std::vector<FMatrixS::REntry> col_entry;
+                // column slices of the nodes, old slices of split nodes are kept until the next tree
+                std::vector<ColSlice> col_slice;
+                // PerTreeNode: bound of the slices of each node in col_slice, in increasing order of feature index
+                std::vector< std::pair<size_t, size_t> > feat_bound;
+                // temp space of SplitNodeCols: entries and slices of the right child
+                std::vector<FMatrixS::REntry> col_right;
+                std::vector<ColSlice> right_slice;
+                // PerInstance: whether the instance goes to the left child in the split being made
+                std::vector<char> row_left;
+                // per tree approximate mode, PerRoot x PerFeature: candidate split values proposed on each root
+                std::vector< std::vector<float> > root_cut;
+                // PerFeature: 0 if the feature is not sampled for the tree, 1 if it is, 2 if it is also sampled for the current level,
+                // only features sampled for the tree get column slices
+                std::vector<char> feat_mask;
+            };
         private:
             // make leaf nodes for all qexpand, update node statistics, mark leaf value
             inline void InitNewNode( const std::vector<int> &qexpand ){
@@ -117,7 +225,7 @@ namespace xgboost{
 
                     for( bst_uint i = node_bound[nid].first; i < node_bound[nid].second; ++i ){
                         const bst_uint ridx = row_index_set[i];
-                        sum_grad += grad[ridx]; sum_hess += hess[ridx];
+                        sum_grad += gpair[ridx].grad; sum_hess += gpair[ridx].hess;
                     }
                     // update node statistics
                     snode[nid].sum_grad = sum_grad; 
@@ -134,9 +242,18 @@ namespace xgboost{
                 }
             }
         private:
+            // evaluate the buffered candidates of feature fid and update best in scan order
+            inline void UpdateBest( SplitCandBuffer &cbuf, SplitEntry &best, const unsigned fid, bool is_forward_search ){
+                cbuf.Eval( param, kernel );
+                for( size_t i = 0; i < cbuf.Size(); ++ i ){
+                    best.Update( cbuf.loss_chg[i], fid, cbuf.split_value[i], !is_forward_search );
+                }
+                cbuf.Clear();
+            }
             // enumerate the split values of specific feature
             template<typename Iter>
-            inline void EnumerateSplit( Iter it, SplitEntry &best, const int nid, const unsigned fid, bool is_forward_search ){
+            inline void EnumerateSplit( Iter it, SplitEntry &best, SplitCandBuffer &cbuf,
+                                        const int nid, const unsigned fid, bool is_forward_search ){
                 float last_fvalue = 0.0f;
                 double sum_hess = 0.0, sum_grad = 0.0;
                 const NodeEntry enode = snode[ nid ];
@@ -146,12 +263,79 @@ namespace xgboost{
                     const float fvalue = it.fvalue();           
                     
                     if( sum_hess == 0.0 ){
-                        sum_grad = grad[ ridx ];
-                        sum_hess = hess[ ridx ];
+                        sum_grad = gpair[ ridx ].grad;
+                        sum_hess = gpair[ ridx ].hess;
                         last_fvalue = fvalue;
                     }else{
                         // try to find a split
                         if( fabsf(fvalue - last_fvalue) > rt_2eps && sum_hess >= param.min_child_weight ){
+                            const double csum_hess = enode.sum_hess - sum_hess;
+                            if( csum_hess >= param.min_child_weight ){
+                                const double csum_grad = enode.sum_grad - sum_grad; 
+                                // loss change is evaluated later together with other candidates
+                                if( cbuf.Push( sum_grad, sum_hess, csum_grad, csum_hess, enode.weight, enode.root_gain,
+                                               nid, (fvalue + last_fvalue) * 0.5f ) ){
+                                    this->UpdateBest( cbuf, best, fid, is_forward_search );
+                                }
+                            }else{
+                                // the rest part doesn't meet split condition anyway, return 
+                                this->UpdateBest( cbuf, best, fid, is_forward_search );
+                                return;
+                            }
+                        }
+                        // update the statistics
+                        sum_grad += gpair[ ridx ].grad;
+                        sum_hess += gpair[ ridx ].hess;
+                        last_fvalue = fvalue;
+                    }                    
+                }
+                this->UpdateBest( cbuf, best, fid, is_forward_search );
+
+                const double csum_hess = enode.sum_hess - sum_hess;
+                if( sum_hess >= param.min_child_weight && csum_hess >= param.min_child_weight ){
+                    const double csum_grad = enode.sum_grad - sum_grad; 
+                    const double loss_chg = 
+                        + param.CalcGain(   sum_grad,   sum_hess, enode.weight ) 
+                        + param.CalcGain(  csum_grad,  csum_hess, enode.weight )
+                        - snode[nid].root_gain;
+                    const float delta = is_forward_search ? rt_eps:-rt_eps;
+                    best.Update( loss_chg, fid, last_fvalue + delta, !is_forward_search );
+                }
+            }
+            // enumerate the candidate splits of specific feature, the split puts fvalue < cut[k] to the left
+            template<typename Iter>
+            inline void EnumerateSplitApprox( Iter it, SplitEntry &best, const int nid, const unsigned fid, 
+                                              const std::vector<float> &cut, bool is_forward_search ){
+                float last_fvalue = 0.0f;
+                double sum_hess = 0.0, sum_grad = 0.0;
+                const NodeEntry enode = snode[ nid ];
+                const unsigned ncut = static_cast<unsigned>( cut.size() );
+                // position of next candidate after last_fvalue
+                unsigned cut_pos = 0;
+
+                while( it.Next() ){
+                    const bst_uint ridx = it.rindex();
+                    const float fvalue = it.fvalue();           
+                    
+                    if( sum_hess == 0.0 ){
+                        sum_grad = gpair[ ridx ].grad;
+                        sum_hess = gpair[ ridx ].hess;
+                        last_fvalue = fvalue;
+                        cut_pos = static_cast<unsigned>( std::upper_bound( cut.begin(), cut.end(), fvalue ) - cut.begin() );
+                    }else{
+                        // check whether there is a candidate split between last_fvalue and fvalue
+                        bool cross; float split_value = 0.0f;
+                        if( is_forward_search ){
+                            cross = cut_pos < ncut && cut[ cut_pos ] <= fvalue;
+                            while( cut_pos < ncut && cut[ cut_pos ] <= fvalue ) ++ cut_pos;
+                            if( cross ) split_value = cut[ cut_pos - 1 ];
+                        }else{
+                            cross = cut_pos != 0 && cut[ cut_pos - 1 ] > fvalue;
+                            while( cut_pos != 0 && cut[ cut_pos - 1 ] > fvalue ) -- cut_pos;
+                            if( cross ) split_value = cut[ cut_pos ];
+                        }
+                        // try to find a split
+                        if( cross && sum_hess >= param.min_child_weight ){
                             const double csum_hess = enode.sum_hess - sum_hess;
                             if( csum_hess >= param.min_child_weight ){
                                 const double csum_grad = enode.sum_grad - sum_grad; 
@@ -159,15 +343,15 @@ namespace xgboost{
                                     + param.CalcGain(  sum_grad,  sum_hess, enode.weight ) 
                                     + param.CalcGain( csum_grad, csum_hess, enode.weight )
                                     - enode.root_gain;
-                                best.Update( loss_chg, fid, (fvalue + last_fvalue) * 0.5f, !is_forward_search );
+                                best.Update( loss_chg, fid, split_value, !is_forward_search );
                             }else{
                                 // the rest part doesn't meet split condition anyway, return 
                                 return;
                             }
                         }
                         // update the statistics
-                        sum_grad += grad[ ridx ];
-                        sum_hess += hess[ ridx ];
+                        sum_grad += gpair[ ridx ].grad;
+                        sum_hess += gpair[ ridx ].hess;
                         last_fvalue = fvalue;
                     }                    
                 }
@@ -184,44 +368,46 @@ namespace xgboost{
                 }
             }
         private:
-            inline void FindSplit( const std::vector<int> &qexpand, int depth ){
-                int nexpand = (int)qexpand.size();
-                if( depth < 3 ){ 
+            // find the best split of each node in qexpand, in parallel over nodes when there are enough of them,
+            // then apply the splits one node at a time, since adding nodes resizes the tree
+            inline void FindSplitLevel( const std::vector<int> &qexpand ){
+                const int nexpand = (int)qexpand.size();
+                if( nexpand < this->nthread ){
                     for( int i = 0; i < nexpand; ++ i ){
-                        this->FindSplit( qexpand[i], tmp_rptr[0] );
+                        this->FindBestSplit( qexpand[i] );
                     }
                 }else{
-                    // if get to enough depth, parallelize over node
                     #pragma omp parallel for schedule(dynamic,1)
                     for( int i = 0; i < nexpand; ++ i ){
-                        const int tid = omp_get_thread_num();
-                        utils::Assert( tid < (int)tmp_rptr.size(), "BUG: FindSplit, tid exceed tmp_rptr size" );
-                        this->FindSplit( qexpand[i], tmp_rptr[tid] );
+                        this->FindBestSplit( qexpand[i] );
                     }
                 }
+                for( int i = 0; i < nexpand; ++ i ){
+                    this->ApplySplit( qexpand[i] );
+                }
             }
         private:
-            inline void MakeSplit( int nid, unsigned gid ){
+            inline void MakeSplit( int nid ){
                 node_bound.resize( tree.param.num_nodes );
                 // re-organize the row_index_set after split on nid
                 const unsigned split_index = tree[nid].split_index();
                 const float    split_value = tree[nid].split_cond();
+                // instances without the split feature take the default direction
+                for( bst_uint i = node_bound[ nid ].first; i < node_bound[ nid ].second; ++i ){
+                    row_left[ row_index_set[i] ] = tree[ nid ].default_left() ? 1 : 0;
+                }
+                const ColSlice *fs = this->FindNodeCol( nid, split_index );
+                if( fs != NULL ){
+                    for( size_t k = fs->begin; k < fs->end; ++ k ){
+                        row_left[ col_entry[k].findex ] = col_entry[k].fvalue < split_value ? 1 : 0;
+                    }
+                }
 
                 std::vector<bst_uint> right;
                 bst_uint top = node_bound[nid].first;
                 for( bst_uint i = node_bound[ nid ].first; i < node_bound[ nid ].second; ++i ){
                     const bst_uint ridx = row_index_set[i];                    
-                    bool goleft = tree[ nid ].default_left();                    
-                    for( typename FMatrix::RowIter it = smat.GetRow(ridx,gid); it.Next(); ){
-                        if( it.findex() == split_index ){
-                            if( it.fvalue() < split_value ){
-                                goleft = true;  break;
-                            }else{
-                                goleft = false; break;
-                            }
-                        }
-                    }
-                    if( goleft ) {
+                    if( row_left[ ridx ] != 0 ) {
                         row_index_set[ top ++ ] = ridx;
                     }else{
                         right.push_back( ridx );
@@ -234,97 +420,245 @@ namespace xgboost{
                 for( size_t i = 0; i < right.size(); ++ i ){
                     row_index_set[ top ++ ] = right[ i ];
                 }
+                this->SplitNodeCols( nid );
             }
-                        
-            // find splits at current level
-            inline void FindSplit( int nid, std::vector<size_t> &tmp_rptr ){
-                if( tmp_rptr.size() == 0 ){
-                    tmp_rptr.resize( tree.param.num_feature + 1, 0 );
-                }
-                const bst_uint begin = node_bound[ nid ].first;
-                const bst_uint end   = node_bound[ nid ].second;
-                const unsigned ncgroup = smat.NumColGroup();
-                unsigned best_group = 0;
-
-                for( unsigned gid = 0; gid < ncgroup; ++gid ){
-                    // records the columns
-                    std::vector<FMatrixS::REntry> centry;
-                    // records the active features
-                    std::vector<size_t>  aclist;
-                    utils::SparseCSRMBuilder<FMatrixS::REntry,true> builder( tmp_rptr, centry, aclist );
-                    builder.InitBudget( tree.param.num_feature );
-                    for( bst_uint i = begin; i < end; ++i ){
-                        const bst_uint ridx = row_index_set[i];
-                        for( typename FMatrix::RowIter it = smat.GetRow(ridx,gid); it.Next(); ){
-                            const bst_uint findex = it.findex();
-                            if( constrain.NotBanned( findex ) ) builder.AddBudget( findex );
+            /*! 
+             * \brief stably partition the sorted column slices of nid into its children, so the slices of the children stay sorted,
+             *        the left child takes the front of the region of nid, the right child takes the rest, row_left must be ready
+             */
+            inline void SplitNodeCols( int nid ){
+                feat_bound.resize( tree.param.num_nodes );
+                const size_t fbegin = feat_bound[ nid ].first, fend = feat_bound[ nid ].second;
+                const int cleft = tree[ nid ].cleft(), cright = tree[ nid ].cright();
+                if( fbegin == fend ){
+                    feat_bound[ cleft ] = feat_bound[ cright ] = std::make_pair( fbegin, fend );
+                    return;
+                }
+                // left entries are moved forward in place, right entries are buffered and put after them
+                size_t top = col_slice[ fbegin ].begin;
+                col_right.clear();
+                feat_bound[ cleft ].first = col_slice.size();
+                for( size_t j = fbegin; j < fend; ++ j ){
+                    const ColSlice s = col_slice[ j ];
+                    const size_t start = top, rstart = col_right.size();
+                    for( size_t k = s.begin; k < s.end; ++ k ){
+                        if( row_left[ col_entry[k].findex ] != 0 ){
+                            col_entry[ top ++ ] = col_entry[k];
+                        }else{
+                            col_right.push_back( col_entry[k] );
                         }
                     }
-                    builder.InitStorage();
-                    for( bst_uint i = begin; i < end; ++i ){
-                        const bst_uint ridx = row_index_set[i];
-                        for( typename FMatrix::RowIter it = smat.GetRow(ridx,gid); it.Next(); ){
-                            const bst_uint findex = it.findex();
-                            if( constrain.NotBanned( findex ) ) {
-                                builder.PushElem( findex, FMatrixS::REntry( ridx, it.fvalue() ) );
-                            }
-                        }
+                    if( top != start ) col_slice.push_back( ColSlice( s.findex, start, top ) );
+                    // right slices are relative to col_right for now
+                    if( col_right.size() != rstart ) right_slice.push_back( ColSlice( s.findex, rstart, col_right.size() ) );
+                }
+                feat_bound[ cleft ].second = col_slice.size();
+                feat_bound[ cright ].first = col_slice.size();
+                for( size_t j = 0; j < right_slice.size(); ++ j ){
+                    col_slice.push_back( ColSlice( right_slice[j].findex, top + right_slice[j].begin, top + right_slice[j].end ) );
+                }
+                feat_bound[ cright ].second = col_slice.size();
+                right_slice.clear();
+                if( col_right.size() != 0 ){
+                    std::copy( col_right.begin(), col_right.end(), col_entry.begin() + top );
+                }
+            }
+            // set the best split of nid, the node becomes a leaf if the split is not useful
+            inline void ApplySplit( int nid ){
+                if( snode[nid].best.loss_chg > rt_eps ){
+                    const SplitEntry &e = snode[nid].best;
+                    tree.AddChilds( nid );
+                    tree[ nid ].set_split( e.split_index(), e.split_value, e.default_left() );
+                    this->MakeSplit( nid );
+                }else{
+                    tree[ nid ].set_leaf( snode[nid].weight * param.learning_rate );                    
+                }
+            }
+            // grow the tree by always splitting the candidate leaf with the largest loss change
+            inline void MakeLossGuide( int &stat_max_depth ){
+                ExpandQueue queue;
+                unsigned timestamp = 0;
+                int num_leaves = tree.param.num_roots;
+                this->SetLevelFeat();
+                for( size_t i = 0; i < qexpand.size(); ++ i ){
+                    const int nid = qexpand[i];
+                    this->FindBestSplit( nid );
+                    queue.push( ExpandEntry( nid, 0, snode[ nid ].best.loss_chg, timestamp ++ ) );
+                }
+                while( !queue.empty() ){
+                    const ExpandEntry e = queue.top(); queue.pop();
+                    if( !this->NeedExpand( e, num_leaves ) ){
+                        tree[ e.nid ].set_leaf( snode[ e.nid ].weight * param.learning_rate );
+                        continue;
+                    }
+                    this->ApplySplit( e.nid );
+                    qexpand.resize( 1 ); qexpand[0] = e.nid;
+                    this->UpdateQueueExpand( this->qexpand );
+                    this->InitNewNode( this->qexpand );
+                    ++ num_leaves;
+                    stat_max_depth = std::max( stat_max_depth, e.depth + 1 );
+                    this->SetLevelFeat();
+                    for( size_t i = 0; i < qexpand.size(); ++ i ){
+                        const int nid = qexpand[i];
+                        this->FindBestSplit( nid );
+                        queue.push( ExpandEntry( nid, e.depth + 1, snode[ nid ].best.loss_chg, timestamp ++ ) );
                     }
-                    // --- end of building column major matrix ---                    
-                    // after this point, tmp_rptr and entry is ready to use                    
-                    int naclist = (int)aclist.size();
-                    // best entry for each thread
-                    SplitEntry nbest, tbest;
-                    #pragma omp parallel private(tbest)
-                    { 
-                        #pragma omp for schedule(dynamic,1)
-                        for( int j = 0; j < naclist; ++j ){
-                            bst_uint findex = static_cast<bst_uint>( aclist[j] );
-                            // local sort can be faster when the features are sparse
-                            std::sort( centry.begin() + tmp_rptr[findex], centry.begin() + tmp_rptr[findex+1], FMatrixS::REntry::cmp_fvalue );
+                }
+                qexpand.clear();
+            }
+            // find the best split of nid from its sorted column slices
+            inline void FindBestSplit( int nid ){
+                const size_t fbegin = feat_bound[ nid ].first;
+                const int nslice = static_cast<int>( feat_bound[ nid ].second - fbegin );
+                // in per tree approximate mode, candidates are proposed on the root and reused by its descendants
+                int cut_root = -1;
+                if( param.approx_method == 1 && root_cut.size() != 0 ){
+                    cut_root = nid;
+                    while( !tree[ cut_root ].is_root() ) cut_root = tree[ cut_root ].parent();
+                }
+                // best entry for each thread
+                SplitEntry nbest, tbest;
+                #pragma omp parallel private(tbest)
+                { 
+                    // thread local space for approximate mode
+                    WQSummary sbuilder, stmp;
+                    std::vector<float> tcut;
+                    // split candidates waiting for evaluation
+                    SplitCandBuffer cbuf;
+                    #pragma omp for schedule(dynamic,1)
+                    for( int j = 0; j < nslice; ++j ){
+                        const ColSlice &fs = col_slice[ fbegin + j ];
+                        const bst_uint findex = fs.findex;
+                        if( feat_mask[ findex ] != 2 ) continue;
+                        const FMatrixS::REntry *begin = &col_entry[0] + fs.begin, *end = &col_entry[0] + fs.end;
+                        if( param.approx_method != 0 ){
+                            std::vector<float> &cut = cut_root < 0 ? tcut : root_cut[ cut_root * tree.param.num_feature + findex ];
+                            if( cut_root < 0 || cut_root == nid ){
+                                sbuilder.Clear();
+                                for( const FMatrixS::REntry *p = begin; p != end; ++ p ){
+                                    sbuilder.PushSorted( p->fvalue, gpair[ p->findex ].hess );
+                                }
+                                this->ProposeCut( sbuilder, stmp, cut );
+                            }
                             if( param.need_forward_search() ){
-                                this->EnumerateSplit( FMatrixS::ColIter( &centry[tmp_rptr[findex]]-1, &centry[tmp_rptr[findex+1]] - 1 ),
-                                                      tbest, nid, findex, true );
+                                this->EnumerateSplitApprox( FMatrixS::ColIter( begin - 1, end - 1 ), tbest, nid, findex, cut, true );
                             }
                             if( param.need_backward_search() ){
-                                this->EnumerateSplit( FMatrixS::ColBackIter( &centry[tmp_rptr[findex+1]], &centry[tmp_rptr[findex]] ),
-                                                      tbest, nid, findex, false );
+                                this->EnumerateSplitApprox( FMatrixS::ColBackIter( end, begin ), tbest, nid, findex, cut, false );
                             }
+                            continue;
                         }
-                        #pragma omp critical 
-                        {
-                            nbest.Update( tbest );
+                        if( param.need_forward_search() ){
+                            this->EnumerateSplit( FMatrixS::ColIter( begin - 1, end - 1 ), tbest, cbuf, nid, findex, true );
+                        }
+                        if( param.need_backward_search() ){
+                            this->EnumerateSplit( FMatrixS::ColBackIter( end, begin ), tbest, cbuf, nid, findex, false );
                         }
                     }
-                    // if current solution gives the best 
-                    if( snode[nid].best.Update( nbest ) ){
-                        best_group = gid;
+                    #pragma omp critical 
+                    {
+                        nbest.Update( tbest );
                     }
-                    // cleanup tmp_rptr for next usage
-                    builder.Cleanup();    
                 }
-                
-                // at this point, we already know the best split
-                if( snode[nid].best.loss_chg > rt_eps ){
-                    const SplitEntry &e = snode[nid].best;
-                    tree.AddChilds( nid );
-                    tree[ nid ].set_split( e.split_index(), e.split_value, e.default_left() );
-                    this->MakeSplit( nid, best_group );
-                }else{
-                    tree[ nid ].set_leaf( snode[nid].weight * param.learning_rate );                    
+                snode[nid].best.Update( nbest );
+            }
+        private:
+            // drop all column slices, the first entry of col_entry is a sentinel, so that iterators never point before the data
+            inline void ClearCols( void ){
+                col_entry.resize( 1 ); col_slice.clear();
+                feat_bound.clear();
+                feat_bound.resize( tree.param.num_nodes, std::make_pair( (size_t)0, (size_t)0 ) );
+                row_left.resize( gpair.size() );
+            }
+            // build the sorted column slices of nid from its instances, needed for nodes that are not split by this maker
+            inline void BuildNodeCols( int nid ){
+                const unsigned nfeat = static_cast<unsigned>( tree.param.num_feature );
+                const bst_uint begin = node_bound[ nid ].first, end = node_bound[ nid ].second;
+                const unsigned ncgroup = smat.NumColGroup();
+                std::vector<size_t> fptr( nfeat + 1, 0 );
+                for( unsigned gid = 0; gid < ncgroup; ++ gid ){
+                    for( bst_uint i = begin; i < end; ++ i ){
+                        for( typename FMatrix::RowIter it = smat.GetRow( row_index_set[i], gid ); it.Next(); ){
+                            const bst_uint findex = it.findex();
+                            utils::Assert( findex < nfeat, "input feature execeed bound" );
+                            if( feat_mask[ findex ] != 0 ) ++ fptr[ findex + 1 ];
+                        }
+                    }
+                }
+                const size_t base = col_entry.size();
+                feat_bound[ nid ].first = col_slice.size();
+                fptr[0] = base;
+                for( unsigned f = 0; f < nfeat; ++ f ){
+                    if( fptr[ f + 1 ] != 0 ){
+                        col_slice.push_back( ColSlice( f, fptr[f], fptr[f] + fptr[ f + 1 ] ) );
+                    }
+                    fptr[ f + 1 ] += fptr[ f ];
                 }
+                feat_bound[ nid ].second = col_slice.size();
+                col_entry.resize( fptr[ nfeat ] );
+                for( unsigned gid = 0; gid < ncgroup; ++ gid ){
+                    for( bst_uint i = begin; i < end; ++ i ){
+                        const bst_uint ridx = row_index_set[i];
+                        for( typename FMatrix::RowIter it = smat.GetRow( ridx, gid ); it.Next(); ){
+                            const bst_uint findex = it.findex();
+                            if( feat_mask[ findex ] != 0 ){
+                                col_entry[ fptr[ findex ] ++ ] = FMatrixS::REntry( ridx, it.fvalue() );
+                            }
+                        }
+                    }
+                }
+                const size_t fbegin = feat_bound[ nid ].first;
+                const int nslice = static_cast<int>( feat_bound[ nid ].second - fbegin );
+                #pragma omp parallel for schedule(dynamic,1)
+                for( int j = 0; j < nslice; ++ j ){
+                    const ColSlice &fs = col_slice[ fbegin + j ];
+                    std::sort( col_entry.begin() + fs.begin, col_entry.begin() + fs.end, FMatrixS::REntry::cmp_fvalue );
+                }
+            }
+            // the column slice of feature findex in nid, NULL if no instance of nid has the feature
+            inline const ColSlice *FindNodeCol( int nid, unsigned findex ) const{
+                // slices of a node are in increasing order of feature index
+                size_t lo = feat_bound[ nid ].first, hi = feat_bound[ nid ].second;
+                while( lo < hi ){
+                    const size_t mid = ( lo + hi ) / 2;
+                    if( col_slice[ mid ].findex < findex ){
+                        lo = mid + 1;
+                    }else{
+                        hi = mid;
+                    }
+                }
+                if( lo != feat_bound[ nid ].second && col_slice[ lo ].findex == findex ) return &col_slice[ lo ];
+                return NULL;
             }
         private:
+            // sample the features of the tree by colsample_bytree among the features that are not banned
+            inline void InitFeatMask( void ){
+                std::vector<int> findex;
+                for( int i = 0; i < tree.param.num_feature; ++ i ){
+                    if( constrain.NotBanned( i ) ) findex.push_back( i );
+                }
+                this->SampleFeat( findex, param.colsample_bytree );
+                feat_mask.clear(); feat_mask.resize( tree.param.num_feature, 0 );
+                for( size_t i = 0; i < findex.size(); ++ i ){
+                    feat_mask[ findex[i] ] = 1;
+                }
+            }
+            // sample the features scanned in the next level
+            inline void SetLevelFeat( void ){
+                std::vector<int> fbuf;
+                this->SampleLevelFeat( feat_mask, fbuf );
+            }
             // initialize temp data structure
             inline void InitData( void ){
                 std::vector<bst_uint> valid_index;
-                for( size_t i = 0; i < grad.size(); ++i ){
-                    if( hess[ i ] < 0.0f ) continue;
+                for( size_t i = 0; i < gpair.size(); ++i ){
+                    if( gpair[ i ].hess < 0.0f ) continue;
                     if( param.subsample > 1.0f-1e-6f || random::SampleBinary( param.subsample ) != 0 ){
                         valid_index.push_back( static_cast<bst_uint>(i) );
                     }
                 }
                 node_bound.resize( tree.param.num_roots );
+                snode.clear(); snode.reserve( 256 );
 
                 if( root_index.size() == 0 ){
                     row_index_set = valid_index;
@@ -355,28 +689,48 @@ namespace xgboost{
                         qexpand.push_back( i );
                     }
                 }
+                this->InitFeatMask();
+                this->ClearCols();
+                for( int i = 0; i < tree.param.num_roots; ++ i ){
+                    this->BuildNodeCols( i );
+                }
+                if( param.approx_method == 1 ){
+                    root_cut.resize( tree.param.num_roots * tree.param.num_feature );
+                }else{
+                    root_cut.clear();
+                }
             }
 
             // initialize temp data structure
             inline void InitDataExpand( const std::vector<bst_uint> &valid_index, int nid ){
                 row_index_set = valid_index;                
-                node_bound.resize( tree.param.num_nodes );
+                node_bound.clear(); node_bound.resize( tree.param.num_nodes );
+                snode.clear();
                 node_bound[ nid ] = std::make_pair( 0, (bst_uint)row_index_set.size() );
+                this->InitFeatMask();
+                this->ClearCols();
+                this->BuildNodeCols( nid );
              
                 qexpand.clear(); qexpand.push_back( nid );
             }
         private:
             // number of omp thread used during training
             int nthread;
-            // tmp row pointer, per thread, used for tmp data construction
-            std::vector< std::vector<size_t> > tmp_rptr;
-            // Instance row indexes corresponding to each node
-            std::vector<bst_uint> row_index_set;
-            // lower and upper bound of each nodes' row_index
-            std::vector< std::pair<bst_uint, bst_uint> > node_bound;
+            // buffers in the workspace, see Workspace
+            std::vector<bst_uint> &row_index_set;
+            std::vector< std::pair<bst_uint, bst_uint> > &node_bound;
+            std::vector<FMatrixS::REntry> &col_entry;
+            std::vector<ColSlice> &col_slice;
+            std::vector< std::pair<size_t, size_t> > &feat_bound;
+            std::vector<FMatrixS::REntry> &col_right;
+            std::vector<ColSlice> &right_slice;
+            std::vector<char> &row_left;
+            std::vector< std::vector<float> > &root_cut;
+            std::vector<char> &feat_mask;
+            // kernel that evaluates loss change of split candidates
+            LossChgKernel kernel;
         private:
-            const std::vector<float> &grad;
-            const std::vector<float> &hess;
+            const GPairView          gpair;
             const FMatrix            &smat;
             const std::vector<unsigned> &root_index;
             const utils::FeatConstrain  &constrain;
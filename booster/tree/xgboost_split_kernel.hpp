@@ -0,0 +1,213 @@
+#ifndef XGBOOST_SPLIT_KERNEL_HPP
+#define XGBOOST_SPLIT_KERNEL_HPP
+/*!
+ * \file xgboost_split_kernel.hpp
+ * \brief kernels that evaluate the loss change of a block of split candidates,
+ *        the SIMD versions are selected at runtime by CPU feature detection,
+ *        so the binary still runs on machines that only have SSE2
+ * \author Tianqi Chen: tianqi.tchen@gmail.com
+ */
+#include <vector>
+#include "xgboost_tree_model.h"
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define XGBOOST_SPLIT_SIMD 1
+#include <immintrin.h>
+#else
+#define XGBOOST_SPLIT_SIMD 0
+#endif
+
+namespace xgboost{
+    namespace booster{
+        /*!
+         * \brief kernel that computes loss change of n split candidates, the loss change of candidate i is
+         *        CalcGain( lgrad, lhess, weight ) + CalcGain( rgrad, rhess, weight ) - root_gain
+         */
+        typedef void (*LossChgKernel)( const TreeParamTrain &param,
+                                       const double *lgrad, const double *lhess,
+                                       const double *rgrad, const double *rhess,
+                                       const double *weight, const double *root_gain,
+                                       size_t n, float *loss_chg );
+        /*! \brief scalar kernel, same arithmetic as TreeParamTrain::CalcGain */
+        inline void CalcLossChgScalar( const TreeParamTrain &param,
+                                       const double *lgrad, const double *lhess,
+                                       const double *rgrad, const double *rhess,
+                                       const double *weight, const double *root_gain,
+                                       size_t n, float *loss_chg ){
+            for( size_t i = 0; i < n; ++ i ){
+                loss_chg[i] = static_cast<float>( + param.CalcGain( lgrad[i], lhess[i], weight[i] )
+                                                  + param.CalcGain( rgrad[i], rhess[i], weight[i] )
+                                                  - root_gain[i] );
+            }
+        }
+#if XGBOOST_SPLIT_SIMD
+        // the SIMD kernels must round exactly like the scalar code, so multiply and add are never fused
+        /*! \brief AVX2 version of CalcGain on 4 candidates */
+        __attribute__((target("avx2"), optimize("fp-contract=off")))
+        inline __m256d CalcGainAVX2( const TreeParamTrain &param, __m256d g, __m256d h, __m256d w ){
+            const __m256d zero = _mm256_setzero_pd();
+            if( param.use_layerwise != 0 ) g = _mm256_add_pd( g, _mm256_mul_pd( h, w ) );
+            __m256d num, den;
+            if( param.reg_method == 1 || param.reg_method == 3 ){
+                const __m256d lambda = _mm256_set1_pd( param.reg_method == 1 ? param.reg_lambda : 0.5 * param.reg_lambda );
+                // ThresholdL1
+                __m256d t = _mm256_blendv_pd( zero, _mm256_sub_pd( g, lambda ), _mm256_cmp_pd( g, lambda, _CMP_GT_OQ ) );
+                const __m256d nlambda = _mm256_sub_pd( zero, lambda );
+                t = _mm256_blendv_pd( t, _mm256_add_pd( g, lambda ), _mm256_cmp_pd( g, nlambda, _CMP_LT_OQ ) );
+                num = _mm256_mul_pd( t, t );
+                den = param.reg_method == 1 ? h : _mm256_add_pd( h, lambda );
+            }else{
+                num = _mm256_mul_pd( g, g );
+                den = param.reg_method == 2 ? _mm256_add_pd( h, _mm256_set1_pd( param.reg_lambda ) ) : h;
+            }
+            // gain is 0 when the hessian is below min_child_weight
+            const __m256d valid = _mm256_cmp_pd( h, _mm256_set1_pd( param.min_child_weight ), _CMP_GE_OQ );
+            return _mm256_and_pd( _mm256_div_pd( num, den ), valid );
+        }
+        /*! \brief AVX2 kernel, the tail is processed with masked loads */
+        __attribute__((target("avx2"), optimize("fp-contract=off")))
+        inline void CalcLossChgAVX2( const TreeParamTrain &param,
+                                     const double *lgrad, const double *lhess,
+                                     const double *rgrad, const double *rhess,
+                                     const double *weight, const double *root_gain,
+                                     size_t n, float *loss_chg ){
+            for( size_t i = 0; i < n; i += 4 ){
+                if( i + 4 <= n ){
+                    const __m256d w = _mm256_loadu_pd( weight + i );
+                    const __m256d l = CalcGainAVX2( param, _mm256_loadu_pd( lgrad + i ), _mm256_loadu_pd( lhess + i ), w );
+                    const __m256d r = CalcGainAVX2( param, _mm256_loadu_pd( rgrad + i ), _mm256_loadu_pd( rhess + i ), w );
+                    const __m256d loss = _mm256_sub_pd( _mm256_add_pd( l, r ), _mm256_loadu_pd( root_gain + i ) );
+                    _mm_storeu_ps( loss_chg + i, _mm256_cvtpd_ps( loss ) );
+                }else{
+                    const int rest = static_cast<int>( n - i );
+                    const __m256i mask = _mm256_set_epi64x( rest > 3 ? -1 : 0, rest > 2 ? -1 : 0, rest > 1 ? -1 : 0, -1 );
+                    const __m256d w = _mm256_maskload_pd( weight + i, mask );
+                    const __m256d l = CalcGainAVX2( param, _mm256_maskload_pd( lgrad + i, mask ), _mm256_maskload_pd( lhess + i, mask ), w );
+                    const __m256d r = CalcGainAVX2( param, _mm256_maskload_pd( rgrad + i, mask ), _mm256_maskload_pd( rhess + i, mask ), w );
+                    const __m256d loss = _mm256_sub_pd( _mm256_add_pd( l, r ), _mm256_maskload_pd( root_gain + i, mask ) );
+                    float tmp[4];
+                    _mm_storeu_ps( tmp, _mm256_cvtpd_ps( loss ) );
+                    for( int k = 0; k < rest; ++ k ){
+                        loss_chg[ i + k ] = tmp[k];
+                    }
+                }
+            }
+        }
+        /*! \brief AVX-512 version of CalcGain on 8 candidates */
+        __attribute__((target("avx512f"), optimize("fp-contract=off")))
+        inline __m512d CalcGainAVX512( const TreeParamTrain &param, __m512d g, __m512d h, __m512d w ){
+            if( param.use_layerwise != 0 ) g = _mm512_add_pd( g, _mm512_mul_pd( h, w ) );
+            __m512d num, den;
+            if( param.reg_method == 1 || param.reg_method == 3 ){
+                const __m512d lambda = _mm512_set1_pd( param.reg_method == 1 ? param.reg_lambda : 0.5 * param.reg_lambda );
+                const __m512d nlambda = _mm512_sub_pd( _mm512_setzero_pd(), lambda );
+                // ThresholdL1
+                __m512d t = _mm512_maskz_sub_pd( _mm512_cmp_pd_mask( g, lambda, _CMP_GT_OQ ), g, lambda );
+                t = _mm512_mask_add_pd( t, _mm512_cmp_pd_mask( g, nlambda, _CMP_LT_OQ ), g, lambda );
+                num = _mm512_mul_pd( t, t );
+                den = param.reg_method == 1 ? h : _mm512_add_pd( h, lambda );
+            }else{
+                num = _mm512_mul_pd( g, g );
+                den = param.reg_method == 2 ? _mm512_add_pd( h, _mm512_set1_pd( param.reg_lambda ) ) : h;
+            }
+            // gain is 0 when the hessian is below min_child_weight
+            const __mmask8 valid = _mm512_cmp_pd_mask( h, _mm512_set1_pd( param.min_child_weight ), _CMP_GE_OQ );
+            return _mm512_maskz_div_pd( valid, num, den );
+        }
+        /*! \brief AVX-512 kernel, the tail is processed with masked loads */
+        __attribute__((target("avx512f"), optimize("fp-contract=off")))
+        inline void CalcLossChgAVX512( const TreeParamTrain &param,
+                                       const double *lgrad, const double *lhess,
+                                       const double *rgrad, const double *rhess,
+                                       const double *weight, const double *root_gain,
+                                       size_t n, float *loss_chg ){
+            for( size_t i = 0; i < n; i += 8 ){
+                const __mmask8 mask = i + 8 <= n ? static_cast<__mmask8>( 0xFF ) : static_cast<__mmask8>( ( 1U << ( n - i ) ) - 1U );
+                const __m512d w = _mm512_maskz_loadu_pd( mask, weight + i );
+                const __m512d l = CalcGainAVX512( param, _mm512_maskz_loadu_pd( mask, lgrad + i ), _mm512_maskz_loadu_pd( mask, lhess + i ), w );
+                const __m512d r = CalcGainAVX512( param, _mm512_maskz_loadu_pd( mask, rgrad + i ), _mm512_maskz_loadu_pd( mask, rhess + i ), w );
+                const __m512d loss = _mm512_sub_pd( _mm512_add_pd( l, r ), _mm512_maskz_loadu_pd( mask, root_gain + i ) );
+                if( mask == 0xFF ){
+                    _mm256_storeu_ps( loss_chg + i, _mm512_maskz_cvtpd_ps( mask, loss ) );
+                }else{
+                    float tmp[8];
+                    _mm256_storeu_ps( tmp, _mm512_maskz_cvtpd_ps( mask, loss ) );
+                    for( size_t k = i; k < n; ++ k ){
+                        loss_chg[k] = tmp[ k - i ];
+                    }
+                }
+            }
+        }
+#endif
+        /*!
+         * \brief select the loss change kernel supported by the CPU
+         * \param use_simd whether SIMD kernels can be used, the scalar kernel is returned if 0
+         */
+        inline LossChgKernel GetLossChgKernel( int use_simd ){
+#if XGBOOST_SPLIT_SIMD
+            if( use_simd != 0 ){
+                if( __builtin_cpu_supports( "avx512f" ) ) return CalcLossChgAVX512;
+                if( __builtin_cpu_supports( "avx2" ) ) return CalcLossChgAVX2;
+            }
+#endif
+            return CalcLossChgScalar;
+        }
+
+        /*!
+         * \brief buffer of split candidates found in a feature scan, the loss changes are evaluated block by block,
+         *        the candidates keep the scan order, so the best split is updated in the same order as a scalar scan
+         */
+        class SplitCandBuffer{
+        public:
+            /*! \brief number of candidates evaluated together */
+            static const size_t kBlockSize = 256;
+            /*! \brief constructor */
+            SplitCandBuffer( void ) : size_( 0 ){
+                lgrad.resize( kBlockSize ); lhess.resize( kBlockSize );
+                rgrad.resize( kBlockSize ); rhess.resize( kBlockSize );
+                weight.resize( kBlockSize ); root_gain.resize( kBlockSize );
+                nid.resize( kBlockSize ); split_value.resize( kBlockSize ); loss_chg.resize( kBlockSize );
+            }
+            /*! \return number of candidates in buffer */
+            inline size_t Size( void ) const{
+                return size_;
+            }
+            /*! \brief remove all candidates */
+            inline void Clear( void ){
+                size_ = 0;
+            }
+            /*!
+             * \brief add a candidate
+             * \return whether the buffer is full and should be evaluated
+             */
+            inline bool Push( double sum_grad, double sum_hess, double csum_grad, double csum_hess,
+                              double node_weight, double node_root_gain, int node_id, float value ){
+                lgrad[ size_ ] = sum_grad; lhess[ size_ ] = sum_hess;
+                rgrad[ size_ ] = csum_grad; rhess[ size_ ] = csum_hess;
+                weight[ size_ ] = node_weight; root_gain[ size_ ] = node_root_gain;
+                nid[ size_ ] = node_id; split_value[ size_ ] = value;
+                return ++ size_ == kBlockSize;
+            }
+            /*! \brief evaluate the loss change of all candidates in buffer */
+            inline void Eval( const TreeParamTrain &param, LossChgKernel kernel ){
+                if( size_ == 0 ) return;
+                kernel( param, &lgrad[0], &lhess[0], &rgrad[0], &rhess[0], &weight[0], &root_gain[0], size_, &loss_chg[0] );
+            }
+        public:
+            /*! \brief statistics of left and right side of each candidate */
+            std::vector<double> lgrad, lhess, rgrad, rhess;
+            /*! \brief weight and root gain of the node of each candidate */
+            std::vector<double> weight, root_gain;
+            /*! \brief node of each candidate */
+            std::vector<int> nid;
+            /*! \brief split value of each candidate */
+            std::vector<float> split_value;
+            /*! \brief loss change of each candidate, set by Eval */
+            std::vector<float> loss_chg;
+        private:
+            /*! \brief number of candidates */
+            size_t size_;
+        };
+    };
+};
+#endif
@@ -90,7 +90,7 @@ namespace xgboost{
             struct SCEntry{
                 // feature value 
                 float    fvalue;
-                // row index in grad
+                // row index in gpair
                 unsigned rindex;
                 SCEntry(){}
                 SCEntry( float fvalue, unsigned rindex ){
@@ -105,8 +105,7 @@ namespace xgboost{
             const TreeParamTrain &param;
             // parameters, reference
             RegTree &tree;
-            std::vector<float> &grad;
-            std::vector<float> &hess;
+            GPairView gpair;
             const FMatrix &smat;
             const std::vector<unsigned> &group_id;
         private:
@@ -151,8 +150,8 @@ namespace xgboost{
                 for( unsigned i = 0; i < tsk.len; i ++ ){
                     const unsigned ridx = tsk.idset[i];
                     if( compute ){
-                        sum_grad += grad[ ridx ];
-                        sum_hess += hess[ ridx ];
+                        sum_grad += gpair[ ridx ].grad;
+                        sum_hess += gpair[ ridx ].hess;
                     }
                 }
                 tree.stat( tsk.nid ).sum_hess = static_cast<float>( sum_hess );
@@ -217,8 +216,8 @@ namespace xgboost{
                     double csum_grad = 0.0, csum_hess = 0.0;
                     for( size_t j = start; j < end; j ++ ){
                         const unsigned ridx = entry[ j ].rindex;
-                        csum_grad += grad[ ridx ];
-                        csum_hess += hess[ ridx ];
+                        csum_grad += gpair[ ridx ].grad;
+                        csum_hess += gpair[ ridx ].hess;
                         // check for split
                         if( j == end - 1 || entry[j].fvalue + rt_2eps < entry[ j + 1 ].fvalue ){
                             if( csum_hess < param.min_child_weight ) continue;
@@ -243,8 +242,8 @@ namespace xgboost{
                     double csum_grad = 0.0, csum_hess = 0.0;
                     for( size_t j = end; j > start; j -- ){
                         const unsigned ridx = entry[ j - 1 ].rindex;
-                        csum_grad += grad[ ridx ];
-                        csum_hess += hess[ ridx ];
+                        csum_grad += gpair[ ridx ].grad;
+                        csum_hess += gpair[ ridx ].hess;
                         // check for split
                         if( j == start + 1 || entry[ j - 2 ].fvalue + rt_2eps < entry[ j - 1 ].fvalue ){
                             if( csum_hess < param.min_child_weight ) continue;
@@ -295,8 +294,8 @@ namespace xgboost{
                 double rsum_grad = 0.0, rsum_hess = 0.0;            
                 for( unsigned i = 0; i < tsk.len; i ++ ){
                     const unsigned ridx = tsk.idset[i];
-                    rsum_grad  += grad[ ridx ];
-                    rsum_hess  += hess[ ridx ];
+                    rsum_grad  += gpair[ ridx ].grad;
+                    rsum_hess  += gpair[ ridx ].hess;
                     
                     for( typename FMatrix::RowIter it = smat.GetRow(ridx); it.Next(); ){
                         builder.AddBudget( it.findex() );
@@ -360,7 +359,7 @@ namespace xgboost{
                     if( param.subsample > 1.0f - 1e-6f ){ 
                         idset.resize( 0 );
                         for( size_t i = 0; i < ngrads; i ++ ){
-                            if( hess[i] < 0.0f ) continue;
+                            if( gpair[i].hess < 0.0f ) continue;
                             idset.push_back( (unsigned)i );
                         } 
                     }else{
@@ -381,7 +380,7 @@ namespace xgboost{
                     builder.InitBudget( tree.param.num_roots );
                     for( size_t i = 0; i < group_id.size(); i ++ ){
                         // drop invalid elements
-                        if( hess[ i ] < 0.0f ) continue;
+                        if( gpair[ i ].hess < 0.0f ) continue;
                         utils::Assert( group_id[ i ] < (unsigned)tree.param.num_roots, 
                                        "group id exceed number of roots" );
                         builder.AddBudget( group_id[ i ] );
@@ -389,7 +388,7 @@ namespace xgboost{
                     builder.InitStorage();
                     for( size_t i = 0; i < group_id.size(); i ++ ){
                         // drop invalid elements
-                        if( hess[ i ] < 0.0f ) continue;
+                        if( gpair[ i ].hess < 0.0f ) continue;
                         builder.PushElem( group_id[ i ], static_cast<unsigned>(i) );
                     }
                     for( size_t i = 1; i < rptr.size(); i ++ ){
@@ -403,15 +402,14 @@ namespace xgboost{
         public:
             RTreeUpdater( const TreeParamTrain &pparam, 
                           RegTree &ptree,
-                          std::vector<float> &pgrad,
-                          std::vector<float> &phess,
+                          GPairView pgpair,
                           const FMatrix &psmat, 
                           const std::vector<unsigned> &pgroup_id ):
-                param( pparam ), tree( ptree ), grad( pgrad ), hess( phess ),
+                param( pparam ), tree( ptree ), gpair( pgpair ),
                 smat( psmat ), group_id( pgroup_id ){
             }
             inline int do_boost( int &num_pruned ){
-                this->init_tasks( grad.size() );
+                this->init_tasks( gpair.size() );
                 this->max_depth = 0;
                 this->num_pruned = 0;
                 Task tsk;
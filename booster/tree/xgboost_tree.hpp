@@ -25,6 +25,9 @@ namespace xgboost{
 #include "xgboost_svdf_tree.hpp"
 #include "xgboost_col_treemaker.hpp"
 #include "xgboost_row_treemaker.hpp"
+#include "xgboost_hist_treemaker.hpp"
+#include "xgboost_multi_treemaker.hpp"
+#include "xgboost_tree_ensemble.hpp"
 
 namespace xgboost{
     namespace booster{
@@ -35,6 +38,7 @@ namespace xgboost{
         public:
             RegTreeTrainer( void ){ 
                 silent = 0; tree_maker = 1; 
+                wspace = NULL; nthread_share = 0;
                 // interact mode
                 interact_type = 0;
                 interact_node = 0;
@@ -70,49 +74,93 @@ namespace xgboost{
                 tree.InitModel();
             }
         public:
-            virtual void DoBoost( std::vector<float> &grad, 
-                                  std::vector<float> &hess,
+            virtual void DoBoost( GPairView gpair,
                                   const FMatrix &smat,
                                   const std::vector<unsigned> &root_index ){
-                utils::Assert( grad.size() < UINT_MAX, "number of instance exceed what we can handle" );
+                // the thread share replaces the nthread parameter for this call only
+                const int nthread = param.nthread;
+                if( nthread_share != 0 ) param.nthread = nthread_share;
+                this->Boost( gpair, smat, root_index );
+                param.nthread = nthread;
+            }
+        private:
+            inline void Boost( GPairView gpair,
+                               const FMatrix &smat,
+                               const std::vector<unsigned> &root_index ){
+                utils::Assert( gpair.size() < UINT_MAX, "number of instance exceed what we can handle" );
+                train_leaf.clear();
 
                 // interactive update 
                 if( interact_type != 0 ){
                     switch( interact_type ){
-                    case 1: this->ExpandNode( grad, hess, smat, root_index, interact_node ); return;
-                    case 2: this->CollapseNode( grad, hess, smat, root_index, interact_node ); return;
+                    case 1: this->ExpandNode( gpair, smat, root_index, interact_node ); return;
+                    case 2: this->CollapseNode( gpair, smat, root_index, interact_node ); return;
                     default: utils::Error("unknown interact type");
                     }
                 }
 
                 if( !silent ){
-                    printf( "\nbuild GBRT with %u instances\n", (unsigned)grad.size() );
+                    printf( "\nbuild GBRT with %u instances\n", (unsigned)smat.NumRow() );
                 }
                 int num_pruned;
+                Workspace tmp_space;
+                Workspace &ws = wspace != NULL ? *wspace : tmp_space;
+                // trees with leaf vector fit all gradient channels together
+                if( tree.param.size_leaf_vector != 0 ){
+                    utils::Assert( param.sample_method == 0, "multi-output tree does not support sample_method" );
+                    utils::Assert( tree_maker == 1, "multi-output tree only supports tree_maker=1" );
+                    MultiTreeMaker<FMatrix> maker( tree, param, gpair, smat, root_index, constrain, ws.multi );
+                    maker.Make( tree.param.max_depth, num_pruned );
+                    maker.GetLeafPosition( train_leaf );
+                    this->AverageLeaf();
+                    if( !silent ){
+                        printf( "multi-output tree train end, %d outputs, %d extra nodes, %d pruned nodes, max_depth=%d\n",
+                                tree.param.size_leaf_vector, tree.num_extra_nodes(), num_pruned, tree.MaxDepth() );
+                    }
+                    return;
+                }
+                if( param.sample_method == 1 ){
+                    gpair = this->SampleGOSS( gpair, ws );
+                }
                 switch( tree_maker ){
                 case 0: {
                     utils::Assert( !constrain.HasConstrain(), "tree maker 0 does not support constrain" );
-                    RTreeUpdater<FMatrix> updater( param, tree, grad, hess, smat, root_index );
+                    utils::Assert( param.grow_policy == 0, "tree maker 0 does not support lossguide grow_policy" );
+                    RTreeUpdater<FMatrix> updater( param, tree, gpair, smat, root_index );
                     tree.param.max_depth = updater.do_boost( num_pruned );
                     break;
                 }
-                case 1:{
-                    ColTreeMaker<FMatrix> maker( tree, param, grad, hess, smat, root_index, constrain );
+                case 1: case 4:{
+                    ColTreeMaker<FMatrix> maker( tree, param, gpair, smat, root_index, constrain, ws.col, tree_maker == 4 );
                     maker.Make( tree.param.max_depth, num_pruned );
+                    maker.GetLeafPosition( train_leaf );
+                    if( !silent ){
+                        printf( "split scan: %lu entries in %.3f sec, %.2f M entries/sec\n", (unsigned long)maker.NumScanEntry(),
+                                maker.ScanTime(), maker.NumScanEntry() / std::max( maker.ScanTime(), 1e-9 ) * 1e-6 );
+                    }
                     break;
                 }
                 case 2:{
-                    RowTreeMaker<FMatrix> maker( tree, param, grad, hess, smat, root_index, constrain );
+                    RowTreeMaker<FMatrix> maker( tree, param, gpair, smat, root_index, constrain, ws.row );
                     maker.Make( tree.param.max_depth, num_pruned );
+                    maker.GetLeafPosition( gpair.size(), train_leaf );
                     break;
                 }                    
+                case 3:{
+                    HistTreeMaker<FMatrix> maker( tree, param, gpair, smat, root_index, constrain, ws.hist );
+                    maker.Make( tree.param.max_depth, num_pruned );
+                    maker.GetLeafPosition( gpair.size(), train_leaf );
+                    break;
+                }
                 default: utils::Error("unknown tree maker");
                 }
+                this->AverageLeaf();
                 if( !silent ){
                     printf( "tree train end, %d roots, %d extra nodes, %d pruned nodes ,max_depth=%d\n", 
                             tree.param.num_roots, tree.num_extra_nodes(), num_pruned, tree.MaxDepth() );
                 }
             }            
+        public:
             virtual float Predict( const FMatrix &fmat, bst_uint ridx, unsigned gid = 0 ){
                 ThreadEntry &e = this->InitTmp();
                 this->PrepareTmp( fmat.GetRow(ridx), e );
@@ -120,6 +168,20 @@ namespace xgboost{
                 this->DropTmp( fmat.GetRow(ridx), e );
                 return tree[ pid ].leaf_value();          
             }
+            /*!
+             * \brief predict output k of the leaf vector, used by multi-output trees
+             * \param fmat feature matrix
+             * \param ridx row index
+             * \param gid root index of the row
+             * \param k index in the leaf vector
+             */
+            inline float PredictOutput( const FMatrix &fmat, bst_uint ridx, unsigned gid, int k ){
+                ThreadEntry &e = this->InitTmp();
+                this->PrepareTmp( fmat.GetRow(ridx), e );
+                int pid = this->GetLeafIndex( e.feat, e.funknown, gid );
+                this->DropTmp( fmat.GetRow(ridx), e );
+                return tree.leafvec( pid )[ k ];
+            }
             virtual int GetLeafIndex( const std::vector<float> &feat,
                                       const std::vector<bool>  &funknown,
                                       unsigned gid = 0 ){
@@ -159,14 +221,112 @@ namespace xgboost{
             virtual void DumpModel( FILE *fo, const utils::FeatMap &fmap, bool with_stats ){
                 tree.DumpModel( fo, fmap, with_stats );
             }
+            /*! \return the tree, used to build flattened ensemble for prediction */
+            inline const RegTree &GetTree( void ) const{
+                return tree;
+            }
+            /*!
+             * \brief take the leaf each instance reached in last DoBoost, the leaf is not kept after this call
+             * \param leaf output leaf of each instance, -1 if unknown, empty if the tree maker does not record it
+             */
+            inline void TakeTrainLeaf( std::vector<int> &leaf ){
+                leaf.swap( train_leaf );
+                // release the space, the booster is kept in the model
+                std::vector<int>().swap( train_leaf );
+            }
+        public:
+            /*! \brief buffers of the tree makers, see BaseTreeMaker::Workspace */
+            struct Workspace{
+                // gradient pairs after gradient based one side sampling
+                std::vector<bst_gpair> sample_gpair;
+                // instances ordered by absolute gradient in sampling
+                std::vector<bst_uint> sample_index;
+                typename ColTreeMaker<FMatrix>::Workspace col;
+                typename RowTreeMaker<FMatrix>::Workspace row;
+                typename HistTreeMaker<FMatrix>::Workspace hist;
+                typename MultiTreeMaker<FMatrix>::Workspace multi;
+            };
+            /*!
+             * \brief set the workspace used by DoBoost, the owner keeps it across boosters so that
+             *        the buffers of tree makers are reused in each boosting round, 
+             *        if not set, DoBoost uses a temporal workspace
+             * \param wspace the workspace, NULL to stop using it
+             */
+            inline void SetWorkspace( Workspace *wspace ){
+                this->wspace = wspace;
+            }
+            /*!
+             * \brief set the number of threads used by the following DoBoost calls in place of the nthread parameter,
+             *        set by the owner when several trees are trained concurrently, the nthread parameter is kept
+             * \param nthread number of threads, 0 to use the nthread parameter again
+             */
+            inline void SetThreadShare( int nthread ){
+                this->nthread_share = nthread;
+            }
+        private:
+            // order instances by decreasing absolute gradient, ties broken by instance index
+            struct CmpAbsGrad{
+                const GPairView &gpair;
+                CmpAbsGrad( const GPairView &gpair ) : gpair( gpair ){}
+                inline bool operator()( bst_uint a, bst_uint b ) const{
+                    const float ga = fabsf( gpair[a].grad ), gb = fabsf( gpair[b].grad );
+                    if( ga != gb ) return ga > gb;
+                    return a < b;
+                }
+            };
+            /*!
+             * \brief gradient based one side sampling: keep the top_rate fraction of instances with the largest absolute gradient,
+             *        sample other_rate of all instances from the rest and scale their statistics up, so the sums stay unbiased,
+             *        instances that are not sampled get negative hessian, which tree makers skip
+             * \param gpair gradient pairs of the instances
+             * \param ws workspace that holds the sampled gradient pairs
+             * \return view of the sampled gradient pairs
+             */
+            inline GPairView SampleGOSS( GPairView gpair, Workspace &ws ){
+                utils::Assert( param.top_rate >= 0.0f && param.other_rate >= 0.0f && param.top_rate + param.other_rate <= 1.0f,
+                               "GOSS: top_rate and other_rate must be non-negative, and sum up to at most 1" );
+                std::vector<bst_gpair> &sgpair = ws.sample_gpair;
+                std::vector<bst_uint> &sindex = ws.sample_index;
+                const size_t ndata = gpair.size();
+                sgpair.resize( ndata ); sindex.clear();
+                for( size_t i = 0; i < ndata; ++ i ){
+                    sgpair[i] = gpair[i];
+                    if( gpair[i].hess >= 0.0f ) sindex.push_back( static_cast<bst_uint>( i ) );
+                }
+                const size_t ntop = std::min( static_cast<size_t>( param.top_rate * sindex.size() ), sindex.size() );
+                if( ntop == sindex.size() ) return GPairView( sgpair );
+                // the first ntop instances get the largest absolute gradients
+                std::nth_element( sindex.begin(), sindex.begin() + ntop, sindex.end(), CmpAbsGrad( gpair ) );
+                const double prob = param.top_rate < 1.0f ? param.other_rate / ( 1.0 - param.top_rate ) : 1.0;
+                const float scale = static_cast<float>( 1.0 / prob );
+                for( size_t j = ntop; j < sindex.size(); ++ j ){
+                    bst_gpair &p = sgpair[ sindex[j] ];
+                    if( random::SampleBinary( prob ) != 0 ){
+                        p.grad *= scale; p.hess *= scale;
+                    }else{
+                        p.hess = -1.0f;
+                    }
+                }
+                return GPairView( sgpair );
+            }
+            // trees grown in one round from the same gradients each take 1/num_parallel_tree of their leaf values
+            inline void AverageLeaf( void ){
+                if( param.num_parallel_tree <= 1 ) return;
+                const float scale = 1.0f / param.num_parallel_tree;
+                for( int nid = 0; nid < tree.param.num_nodes; ++ nid ){
+                    if( tree[ nid ].is_leaf() ) tree[ nid ].set_leaf( tree[ nid ].leaf_value() * scale, tree[ nid ].cright() );
+                    for( int k = 0; k < tree.param.size_leaf_vector; ++ k ){
+                        tree.leafvec( nid )[ k ] *= scale;
+                    }
+                }
+            }
         private:
-            inline void CollapseNode( std::vector<float> &grad, 
-                                      std::vector<float> &hess,
+            inline void CollapseNode( GPairView gpair,
                                       const FMatrix &fmat,
                                       const std::vector<unsigned> &root_index, 
                                       int nid ){
                 std::vector<bst_uint> valid_index;
-                for( size_t i = 0; i < grad.size(); i ++ ){
+                for( size_t i = 0; i < gpair.size(); i ++ ){
                     ThreadEntry &e = this->InitTmp();
                     this->PrepareTmp( fmat.GetRow(i), e );
                     int pid = root_index.size() == 0 ? 0 : (int)root_index[i];
@@ -180,19 +340,19 @@ namespace xgboost{
                     }
                     this->DropTmp( fmat.GetRow(i), e );
                 }
-                RowTreeMaker<FMatrix> maker( tree, param, grad, hess, fmat, root_index, constrain ); 
+                typename RowTreeMaker<FMatrix>::Workspace ws;
+                RowTreeMaker<FMatrix> maker( tree, param, gpair, fmat, root_index, constrain, ws ); 
                 maker.Collapse( valid_index, nid );
                 if( !silent ){
                     printf( "tree collapse end, max_depth=%d\n", tree.param.max_depth );
                 }                
             }
-            inline void ExpandNode( std::vector<float> &grad, 
-                                    std::vector<float> &hess,
+            inline void ExpandNode( GPairView gpair,
                                     const FMatrix &fmat,
                                     const std::vector<unsigned> &root_index, 
                                     int nid ){
                 std::vector<bst_uint> valid_index;
-                for( size_t i = 0; i < grad.size(); i ++ ){
+                for( size_t i = 0; i < gpair.size(); i ++ ){
                     ThreadEntry &e = this->InitTmp();
                     this->PrepareTmp( fmat.GetRow(i), e );
                     unsigned rtidx = root_index.size() == 0 ? 0 : root_index[i]; 
@@ -200,7 +360,8 @@ namespace xgboost{
                     this->DropTmp( fmat.GetRow(i), e );
                     if( pid == nid ) valid_index.push_back( static_cast<bst_uint>(i) ); 
                 }
-                RowTreeMaker<FMatrix> maker( tree, param, grad, hess, fmat, root_index, constrain ); 
+                typename RowTreeMaker<FMatrix>::Workspace ws;
+                RowTreeMaker<FMatrix> maker( tree, param, gpair, fmat, root_index, constrain, ws ); 
                 bool success =  maker.Expand( valid_index, nid );
                 if( !silent ){
                     printf( "tree expand end, success=%d, max_depth=%d\n", (int)success, tree.MaxDepth() );
@@ -220,6 +381,12 @@ namespace xgboost{
             int interact_node;         
             // feature constrain
             utils::FeatConstrain  constrain;   
+            // leaf of each instance in last DoBoost, -1 if unknown
+            std::vector<int> train_leaf;
+            // workspace set by the owner, NULL if not set
+            Workspace *wspace;
+            // number of threads set by the owner in place of nthread, 0 if not set
+            int nthread_share;
         private:
             struct ThreadEntry{
                 std::vector<float> feat;
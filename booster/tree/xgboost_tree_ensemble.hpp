@@ -0,0 +1,176 @@
+#ifndef XGBOOST_TREE_ENSEMBLE_HPP
+#define XGBOOST_TREE_ENSEMBLE_HPP
+/*!
+ * \file xgboost_tree_ensemble.hpp
+ * \brief read-only flattened copy of an ensemble of regression trees, used for batch prediction,
+ *        nodes of all trees are stored breadth first in contiguous arrays,
+ *        each row is scattered into a dense vector once for all trees,
+ *        and rows are scored in blocks that stay in cache while all trees are applied
+ * \author Tianqi Chen: tianqi.tchen@gmail.com
+ */
+#include <vector>
+#include <algorithm>
+#include "xgboost_tree_model.h"
+#include "../../utils/xgboost_omp.h"
+
+namespace xgboost{
+    namespace booster{
+        /*! \brief flattened ensemble of regression trees */
+        class FlatTreeEnsemble{
+        public:
+            /*! \brief constructor */
+            FlatTreeEnsemble( void ){
+                this->Clear();
+            }
+            /*! \brief remove all trees */
+            inline void Clear( void ){
+                sindex.clear(); split_cond.clear(); cleft.clear(); leaf_value.clear();
+                tree_begin.clear(); tree_group.clear();
+                tree_nvec.clear(); tree_vec_begin.clear(); leaf_vector.clear();
+                num_feature = 0;
+            }
+            /*! \return number of trees */
+            inline size_t NumTree( void ) const{
+                return tree_begin.size();
+            }
+            /*!
+             * \brief append a tree, the roots of the tree keep their index relative to the tree,
+             *        and the two children of a node are stored next to each other
+             * \param tree the tree
+             * \param bst_group booster group the tree belongs to, -1 for multi-output tree that gives all groups
+             */
+            inline void AddTree( const RegTree &tree, int bst_group ){
+                const int begin = static_cast<int>( cleft.size() );
+                const int nvec = tree.param.size_leaf_vector;
+                tree_begin.push_back( begin );
+                tree_group.push_back( bst_group );
+                tree_nvec.push_back( nvec );
+                tree_vec_begin.push_back( leaf_vector.size() );
+                num_feature = std::max( num_feature, tree.param.num_feature );
+                // queue of node ids in the tree, position in queue is the position in flat arrays
+                std::vector<int> queue;
+                for( int rid = 0; rid < tree.param.num_roots; ++ rid ){
+                    queue.push_back( rid );
+                }
+                for( size_t i = 0; i < queue.size(); ++ i ){
+                    const RegTree::Node &n = tree[ queue[i] ];
+                    if( n.is_leaf() ){
+                        sindex.push_back( 0 ); split_cond.push_back( 0.0f );
+                        cleft.push_back( -1 ); leaf_value.push_back( n.leaf_value() );
+                    }else{
+                        sindex.push_back( n.split_index() | ( n.default_left() ? 1U << 31 : 0U ) );
+                        split_cond.push_back( n.split_cond() );
+                        cleft.push_back( begin + static_cast<int>( queue.size() ) );
+                        leaf_value.push_back( 0.0f );
+                        queue.push_back( n.cleft() );
+                        queue.push_back( n.cright() );
+                    }
+                    if( nvec != 0 ){
+                        const float *vec = tree.leafvec( queue[i] );
+                        leaf_vector.insert( leaf_vector.end(), vec, vec + nvec );
+                    }
+                }
+            }
+            /*!
+             * \brief predict all rows of a matrix, sum of trees in the booster group is added in tree order
+             * \param fmat feature matrix
+             * \param root_index root id of each row, can be empty which means all rows start from root 0
+             * \param bst_group booster group to predict, -1 to predict all groups in one pass over the trees
+             * \param preds output prediction of each row, size must be fmat.NumRow(),
+             *        when all groups are predicted, the size is num_group * fmat.NumRow() and prediction of group g is in [ g * NumRow(), (g+1) * NumRow() )
+             * \param num_group number of booster groups, only used when all groups are predicted
+             */
+            template<typename FMatrix>
+            inline void Predict( const FMatrix &fmat, const std::vector<unsigned> &root_index,
+                                 int bst_group, float *preds, int num_group = 1 ) const{
+                const size_t nfeat = static_cast<size_t>( std::max( num_feature, 1 ) );
+                // keep dense features of a block within 256KB of cache, 5 bytes per feature, at most 64 rows
+                const size_t max_block_row = 64, block_bytes = 256 << 10;
+                const size_t nblock_row = std::max( static_cast<size_t>(1),
+                                                    std::min( max_block_row, block_bytes / ( nfeat * 5 ) ) );
+                const unsigned nrow = static_cast<unsigned>( fmat.NumRow() );
+                const unsigned nblock = static_cast<unsigned>( ( nrow + nblock_row - 1 ) / nblock_row );
+                #pragma omp parallel
+                {
+                    std::vector<float> feat( nfeat * nblock_row );
+                    std::vector<unsigned char> known( nfeat * nblock_row, 0 );
+                    #pragma omp for schedule( dynamic, 1 )
+                    for( unsigned b = 0; b < nblock; ++ b ){
+                        const size_t rbegin = static_cast<size_t>( b ) * nblock_row;
+                        const size_t rend = std::min( rbegin + nblock_row, static_cast<size_t>( nrow ) );
+                        for( size_t r = rbegin; r < rend; ++ r ){
+                            const size_t off = ( r - rbegin ) * nfeat;
+                            typename FMatrix::RowIter it = fmat.GetRow( r );
+                            while( it.Next() ){
+                                utils::Assert( it.findex() < nfeat, "input feature execeed bound" );
+                                feat[ off + it.findex() ] = it.fvalue();
+                                known[ off + it.findex() ] = 1;
+                            }
+                            for( int g = 0; g < ( bst_group < 0 ? num_group : 1 ); ++ g ){
+                                preds[ g * static_cast<size_t>( nrow ) + r ] = 0.0f;
+                            }
+                        }
+                        for( size_t t = 0; t < tree_begin.size(); ++ t ){
+                            // multi-output trees belong to all groups
+                            if( bst_group >= 0 && tree_group[t] >= 0 && tree_group[t] != bst_group ) continue;
+                            for( size_t r = rbegin; r < rend; ++ r ){
+                                const size_t off = ( r - rbegin ) * nfeat;
+                                int nid = tree_begin[t] + ( root_index.size() == 0 ? 0 : static_cast<int>( root_index[r] ) );
+                                while( cleft[ nid ] != -1 ){
+                                    const unsigned s = sindex[ nid ];
+                                    const size_t fid = off + ( s & ( ( 1U << 31 ) - 1U ) );
+                                    if( known[ fid ] == 0 ){
+                                        nid = cleft[ nid ] + ( ( s >> 31 ) != 0 ? 0 : 1 );
+                                    }else{
+                                        nid = cleft[ nid ] + ( feat[ fid ] < split_cond[ nid ] ? 0 : 1 );
+                                    }
+                                }
+                                if( tree_nvec[t] == 0 ){
+                                    preds[ ( bst_group < 0 ? tree_group[t] : 0 ) * static_cast<size_t>( nrow ) + r ] += leaf_value[ nid ];
+                                }else{
+                                    const float *vec = &leaf_vector[0] + tree_vec_begin[t] + static_cast<size_t>( nid - tree_begin[t] ) * tree_nvec[t];
+                                    if( bst_group >= 0 ){
+                                        preds[ r ] += vec[ bst_group ];
+                                    }else{
+                                        for( int k = 0; k < tree_nvec[t]; ++ k ){
+                                            preds[ k * static_cast<size_t>( nrow ) + r ] += vec[ k ];
+                                        }
+                                    }
+                                }
+                            }
+                        }
+                        for( size_t r = rbegin; r < rend; ++ r ){
+                            const size_t off = ( r - rbegin ) * nfeat;
+                            typename FMatrix::RowIter it = fmat.GetRow( r );
+                            while( it.Next() ){
+                                known[ off + it.findex() ] = 0;
+                            }
+                        }
+                    }
+                }
+            }
+        private:
+            /*! \brief split feature of each node, highest bit is set if missing value goes left */
+            std::vector<unsigned> sindex;
+            /*! \brief split condition of each node */
+            std::vector<float> split_cond;
+            /*! \brief left child of each node, right child is cleft + 1, -1 for leaf */
+            std::vector<int> cleft;
+            /*! \brief leaf value of each node */
+            std::vector<float> leaf_value;
+            /*! \brief position of first node of each tree */
+            std::vector<int> tree_begin;
+            /*! \brief booster group of each tree, -1 for multi-output tree */
+            std::vector<int> tree_group;
+            /*! \brief size of leaf vector of each tree, 0 if the tree has scalar leaves */
+            std::vector<int> tree_nvec;
+            /*! \brief position of the leaf vector of the first node of each tree */
+            std::vector<size_t> tree_vec_begin;
+            /*! \brief leaf vector of each node of multi-output trees */
+            std::vector<float> leaf_vector;
+            /*! \brief maximum number of features used by the trees */
+            int num_feature;
+        };
+    };
+};
+#endif
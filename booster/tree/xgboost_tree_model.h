@@ -37,11 +37,14 @@ namespace xgboost{
                 int max_depth;
                 /*! \brief  number of features used for tree construction */
                 int num_feature;
+                /*! \brief size of the vector stored in each node of multi-output trees, 0 means no leaf vector */
+                int size_leaf_vector;
                 /*! \brief reserved part */
-                int reserved[ 32 ];
+                int reserved[ 31 ];
                 /*! \brief constructor */
                 Param( void ){
                     max_depth = 0;
+                    size_leaf_vector = 0;
                     memset( reserved, 0, sizeof( reserved ) );
                 }
                 /*! 
@@ -52,6 +55,7 @@ namespace xgboost{
                 inline void SetParam( const char *name, const char *val ){
                     if( !strcmp("num_roots", name ) )    num_roots = atoi( val );
                     if( !strcmp("num_feature", name ) )  num_feature = atoi( val );
+                    if( !strcmp("size_leaf_vector", name ) ) size_leaf_vector = atoi( val );
                 }
             };
             /*! \brief tree node */
@@ -160,6 +164,8 @@ namespace xgboost{
             std::vector<Node> nodes;
             // stats of nodes
             std::vector<TNodeStat> stats;
+            // leaf vector of nodes, size_leaf_vector values per node, empty if size_leaf_vector is 0
+            std::vector<float> leaf_vector;
         protected:
             // free node space, used during training process
             std::vector<int>  deleted_nodes;
@@ -175,6 +181,7 @@ namespace xgboost{
                 int nd = param.num_nodes ++;
                 nodes.resize( param.num_nodes );
                 stats.resize( param.num_nodes );
+                leaf_vector.resize( param.num_nodes * param.size_leaf_vector );
                 return nd;
             }
             // delete a tree node
@@ -227,15 +234,29 @@ namespace xgboost{
             inline Node &operator[]( int nid ){
                 return nodes[ nid ];
             }
+            /*! \brief get node given nid */
+            inline const Node &operator[]( int nid ) const{
+                return nodes[ nid ];
+            }
             /*! \brief get node statistics given nid */
             inline NodeStat &stat( int nid ){
                 return stats[ nid ];
             }
+            /*! \brief get leaf vector of node nid, only valid if size_leaf_vector is not 0 */
+            inline float *leafvec( int nid ){
+                return &leaf_vector[0] + nid * param.size_leaf_vector;
+            }
+            /*! \brief get leaf vector of node nid, only valid if size_leaf_vector is not 0 */
+            inline const float *leafvec( int nid ) const{
+                return &leaf_vector[0] + nid * param.size_leaf_vector;
+            }
             /*! \brief initialize the model */
             inline void InitModel( void ){
                 param.num_nodes = param.num_roots;
                 nodes.resize( param.num_nodes );
                 stats.resize( param.num_nodes );
+                leaf_vector.clear();
+                leaf_vector.resize( param.num_nodes * param.size_leaf_vector, 0.0f );
                 for( int i = 0; i < param.num_nodes; i ++ ){
                     nodes[i].set_leaf( 0.0f );
                     nodes[i].set_parent( -1 );
@@ -250,6 +271,11 @@ namespace xgboost{
                 nodes.resize( param.num_nodes ); stats.resize( param.num_nodes );
                 utils::Assert( fi.Read( &nodes[0], sizeof(Node) * nodes.size() ) > 0, "TreeModel::Node" );
                 utils::Assert( fi.Read( &stats[0], sizeof(NodeStat) * stats.size() ) > 0, "TreeModel::Node" );
+                // models without leaf vector do not store the section
+                leaf_vector.resize( param.num_nodes * param.size_leaf_vector );
+                if( leaf_vector.size() != 0 ){
+                    utils::Assert( fi.Read( &leaf_vector[0], sizeof(float) * leaf_vector.size() ) > 0, "TreeModel::LeafVector" );
+                }
 
                 deleted_nodes.resize( 0 );
                 for( int i = param.num_roots; i < param.num_nodes; i ++ ){
@@ -267,6 +293,10 @@ namespace xgboost{
                 fo.Write( &param, sizeof(Param) );
                 fo.Write( &nodes[0], sizeof(Node) * nodes.size() );
                 fo.Write( &stats[0], sizeof(NodeStat) * nodes.size() );
+                if( leaf_vector.size() != 0 ){
+                    utils::Assert( leaf_vector.size() == nodes.size() * param.size_leaf_vector );
+                    fo.Write( &leaf_vector[0], sizeof(float) * leaf_vector.size() );
+                }
             }
             /*! 
              * \brief add child nodes to node
@@ -334,7 +364,18 @@ namespace xgboost{
                 for( int  i = 0;  i < depth; ++ i ){
                     fprintf( fo, "\t" );
                 }
-                if( nodes[ nid ].is_leaf() ){
+                if( nodes[ nid ].is_leaf() && param.size_leaf_vector != 0 ){
+                    const float *vec = this->leafvec( nid );
+                    fprintf( fo, "%d:leaf=[%f", nid, vec[0] );
+                    for( int k = 1; k < param.size_leaf_vector; ++ k ){
+                        fprintf( fo, ",%f", vec[k] );
+                    }
+                    fprintf( fo, "] " );
+                    if( with_stats ){
+                        stat( nid ).Print( fo, true );
+                    }
+                    fprintf( fo, "\n" );
+                }else if( nodes[ nid ].is_leaf() ){
                     fprintf( fo, "%d:leaf=%f ", nid, nodes[ nid ].leaf_value() );
                     if( with_stats ){
                         stat( nid ).Print( fo, true );
@@ -413,9 +454,47 @@ namespace xgboost{
             int   use_layerwise;
             // number of threads to be used for tree construction, if OpenMP is enabled, if equals 0, use system default
             int nthread;
+            // maximum number of bins per feature, used by histogram tree maker
+            int max_bin;
+            // approximate split finding: 0 exact enumeration, 1 propose candidate splits once per tree, 2 once per level
+            int approx_method;
+            // accuracy of the weighted quantile sketch used to propose candidate splits
+            float sketch_eps;
+            // tree growing policy: 0 expand level by level, 1 always expand the leaf with largest loss change
+            int grow_policy;
+            // maximum number of leaves of a tree in loss guided growth, 0 means no limit
+            int max_leaves;
+            // column tree maker, compact the sorted columns to the instances still being expanded
+            // once their fraction drops below this ratio, 0 means never compact
+            float col_compact_ratio;
+            // whether to evaluate split candidates with SIMD kernels when the CPU supports them
+            int use_simd;
+            // column tree maker, prefetch gradient and position of the instance this many entries
+            // ahead in the column scan, 0 means no prefetch
+            int prefetch_dist;
+            // column tree maker, columns holding more than a thread's share of entries are cut into segments
+            // of at least this many entries that are scanned concurrently, 0 means never cut
+            int col_segment_len;
+            // hybrid tree maker, nodes with fewer instances than this are grown by row based expansion
+            int hybrid_row_size;
+            // row sampling method: 0 uniform sampling by subsample, 1 gradient based one side sampling
+            int sample_method;
+            // gradient based one side sampling, fraction of instances with largest absolute gradient that are kept
+            float top_rate;
+            // gradient based one side sampling, fraction of all instances sampled from the rest
+            float other_rate;
+            // column tree maker, scan bundles of mutually exclusive sparse features as one column,
+            // only used in exact split finding with the columns in memory
+            int feature_bundle;
+            // number of trees grown in one round from the same gradients, their leaf values are averaged
+            int num_parallel_tree;
+            // fraction of the features sampled for each tree, and of those for each level of the tree
+            float colsample_bytree;
+            float colsample_bylevel;
             /*! \brief constructor */
             TreeParamTrain( void ){
                 learning_rate = 0.3f;
+                min_split_loss = 0.0f;
                 min_child_weight = 1.0f;
                 max_depth = 6;
                 reg_lambda = 1.0f;
@@ -424,6 +503,23 @@ namespace xgboost{
                 subsample = 1.0f;
                 use_layerwise = 0;
                 nthread = 0;
+                max_bin = 256;
+                approx_method = 0;
+                sketch_eps = 0.03f;
+                grow_policy = 0;
+                max_leaves = 0;
+                col_compact_ratio = 0.5f;
+                use_simd = 1;
+                prefetch_dist = 16;
+                col_segment_len = 65536;
+                hybrid_row_size = 1024;
+                sample_method = 0;
+                top_rate = 0.2f;
+                other_rate = 0.1f;
+                feature_bundle = 0;
+                num_parallel_tree = 1;
+                colsample_bytree = 1.0f;
+                colsample_bylevel = 1.0f;
             }
             /*! 
              * \brief set parameters from outside 
@@ -445,6 +541,33 @@ namespace xgboost{
                 if( !strcmp( name, "subsample") )         subsample  = (float)atof( val );
                 if( !strcmp( name, "use_layerwise") )     use_layerwise = atoi( val );
                 if( !strcmp( name, "nthread") )           nthread = atoi( val );
+                if( !strcmp( name, "max_bin") )           max_bin = atoi( val );
+                if( !strcmp( name, "sketch_eps") )        sketch_eps = (float)atof( val );
+                if( !strcmp( name, "max_leaves") )        max_leaves = atoi( val );
+                if( !strcmp( name, "col_compact_ratio") ) col_compact_ratio = (float)atof( val );
+                if( !strcmp( name, "use_simd") )          use_simd = atoi( val );
+                if( !strcmp( name, "prefetch_dist") )     prefetch_dist = atoi( val );
+                if( !strcmp( name, "col_segment_len") )   col_segment_len = atoi( val );
+                if( !strcmp( name, "hybrid_row_size") )   hybrid_row_size = atoi( val );
+                if( !strcmp( name, "top_rate") )          top_rate = (float)atof( val );
+                if( !strcmp( name, "other_rate") )        other_rate = (float)atof( val );
+                if( !strcmp( name, "feature_bundle") )    feature_bundle = atoi( val );
+                if( !strcmp( name, "num_parallel_tree") ) num_parallel_tree = atoi( val );
+                if( !strcmp( name, "colsample_bytree") )  colsample_bytree = (float)atof( val );
+                if( !strcmp( name, "colsample_bylevel") ) colsample_bylevel = (float)atof( val );
+                if( !strcmp( name, "sample_method") ) {
+                    if( !strcmp( val, "uniform") ) sample_method = 0;
+                    if( !strcmp( val, "goss") )    sample_method = 1;
+                }
+                if( !strcmp( name, "grow_policy") ) {
+                    if( !strcmp( val, "depthwise") ) grow_policy = 0;
+                    if( !strcmp( val, "lossguide") ) grow_policy = 1;
+                }
+                if( !strcmp( name, "approx") ) {
+                    if( !strcmp( val, "none") )   approx_method = 0;
+                    if( !strcmp( val, "tree") )   approx_method = 1;
+                    if( !strcmp( val, "level") )  approx_method = 2;
+                }
                 if( !strcmp( name, "default_direction") ) {
                     if( !strcmp( val, "learn") )  default_direction = 0;
                     if( !strcmp( val, "left") )   default_direction = 1;
@@ -59,15 +59,13 @@ namespace xgboost{
         public:
             /*!
              * \brief do gradient boost training for one step, using the information given,
-             *        Note: content of grad and hess can change after DoBoost
-             * \param grad first order gradient of each instance
-             * \param hess second order gradient of each instance
+             *        Note: content of gpair can change after DoBoost
+             * \param gpair first and second order gradient of each instance
              * \param feats features of each instance
              * \param root_index pre-partitioned root index of each instance,
              *          root_index.size() can be 0 which indicates that no pre-partition involved
              */
-            virtual void DoBoost(std::vector<float> &grad,
-                std::vector<float> &hess,
+            virtual void DoBoost(GPairView gpair,
                 const FMatrix &feats,
                 const std::vector<unsigned> &root_index) = 0;
             /*!
@@ -9,8 +9,18 @@
 
 #include <vector>
 #include <climits>
+#include <algorithm>
+#include <cstring>
+#ifdef _MSC_VER
+typedef unsigned __int64 uint64_t;
+#else
+#include <inttypes.h>
+#endif
+#include "../utils/xgboost_omp.h"
 #include "../utils/xgboost_utils.h"
 #include "../utils/xgboost_stream.h"
+#include "../utils/xgboost_mmap.h"
+#include "../utils/xgboost_colpage.h"
 #include "../utils/xgboost_matrix_csr.h"
 
 namespace xgboost{
@@ -23,6 +33,51 @@ namespace xgboost{
         typedef float bst_float;
         /*! \brief debug option for booster */
         const bool bst_debug = false;
+        /*!
+         * \brief gradient statistics of one instance,
+         *        first and second order gradient are stored next to each other so that one load fetches both
+         */
+        struct bst_gpair{
+            /*! \brief first order gradient */
+            bst_float grad;
+            /*! \brief second order gradient */
+            bst_float hess;
+            /*! \brief default constructor */
+            bst_gpair(void){}
+            /*! \brief constructor */
+            bst_gpair(bst_float grad, bst_float hess):grad(grad), hess(hess){}
+        };
+        /*!
+         * \brief view of a contiguous range of gradient pairs owned by the caller,
+         *        used to hand the gradient of one booster group to a booster without copy
+         */
+        struct GPairView{
+        public:
+            /*! \brief empty view */
+            GPairView(void):dptr_(NULL), len_(0){}
+            /*! \brief view over len pairs starting from dptr */
+            GPairView(bst_gpair *dptr, size_t len):dptr_(dptr), len_(len){}
+            /*! \brief view over the whole vector */
+            GPairView(std::vector<bst_gpair> &vec)
+                :dptr_(vec.size() == 0 ? NULL : &vec[0]), len_(vec.size()){}
+            /*! \return number of instances in the view */
+            inline size_t size(void) const{
+                return len_;
+            }
+            /*! \brief access i-th pair */
+            inline bst_gpair &operator[](size_t i){
+                return dptr_[i];
+            }
+            /*! \brief access i-th pair */
+            inline const bst_gpair &operator[](size_t i) const{
+                return dptr_[i];
+            }
+        private:
+            /*! \brief start of the range */
+            bst_gpair *dptr_;
+            /*! \brief length of the range */
+            size_t len_;
+        };
     };
 };
 
@@ -66,6 +121,11 @@ namespace xgboost{
                 inline bst_uint  rindex(void) const;
                 /*! \return feature value in current position */
                 inline bst_float fvalue(void) const;
+                /*!
+                 * \param dist number of positions to look ahead in the iteration order
+                 * \return row index dist positions ahead, row index of the last position if the column ends before
+                 */
+                inline bst_uint rindex_ahead(size_t dist) const;
             };
             /*! \brief backward iterator over column */
             struct ColBackIter : public ColIter {};
@@ -101,7 +161,7 @@ namespace xgboost{
              */
             inline RowIter GetRow(size_t ridx, unsigned gid) const;
 
-            /*! \return whether column access is enabled */
+            /*! \return whether column access is enabled, implementations may build it on first call */
             inline bool HaveColAccess(void) const;
             /*!
              * \brief get column iterator, the columns must be sorted by feature value
@@ -115,6 +175,29 @@ namespace xgboost{
              * \return reverse column iterator
              */
             inline ColBackIter GetReverseSortedCol(size_t ridx) const;
+            /*!
+             * \brief get number of column blocks, column iterators are only valid for columns
+             *        of the block made accessible by FetchColBlock
+             * \return number of column blocks
+             */
+            inline unsigned NumColBlock(void) const{
+                return 1;
+            }
+            /*!
+             * \param bid block id, NumColBlock() gives the end of last block
+             * \return first column of the block
+             */
+            inline size_t ColBlockBegin(unsigned bid) const;
+            /*!
+             * \brief make columns of a block accessible
+             * \param bid block id
+             */
+            inline void FetchColBlock(unsigned bid) const{}
+            /*!
+             * \param cidx column index
+             * \return number of entries in the column, does not need the block of the column
+             */
+            inline size_t GetColSize(size_t cidx) const;
         };
     };
 };
@@ -122,7 +205,8 @@ namespace xgboost{
 namespace xgboost{
     namespace booster{
         /*!
-         * \brief feature matrix to store training instance, in sparse CSR format
+         * \brief feature matrix to store training instance, in sparse CSR format,
+         *        the content is either held in the vectors or served from a memory mapped binary file
          */
         class FMatrixS : public FMatrix<FMatrixS>{
         public:
@@ -176,6 +260,9 @@ namespace xgboost{
                 inline bst_uint  rindex(void) const{
                     return this->findex();
                 }
+                inline bst_uint  rindex_ahead(size_t dist) const{
+                    return dist < static_cast<size_t>(end_ - dptr_) ? dptr_[dist].findex : end_->findex;
+                }
             };
             /*! \brief reverse column iterator */
             struct ColBackIter : public ColIter{
@@ -188,35 +275,151 @@ namespace xgboost{
                         --dptr_; return true;
                     }
                 }
+                // shadows ColIter::rindex_ahead
+                inline bst_uint  rindex_ahead(size_t dist) const{
+                    return dist < static_cast<size_t>(dptr_ - end_) ? (dptr_ - dist)->findex : end_->findex;
+                }
             };
+            /*!
+             * \brief quantized index of the matrix, each column is cut into at most max_bin bins,
+             *        bin k of a column holds values in [cut[k-1], cut[k]), used by histogram based tree maker
+             */
+            struct BinIndex{
+                /*! \brief maximum number of bins per column, 0 means the index is not built */
+                int max_bin;
+                /*! \brief bins of column i are in [cut_ptr[i], cut_ptr[i+1]) */
+                std::vector<bst_uint>  cut_ptr;
+                /*! \brief upper bound of each bin, exclusive */
+                std::vector<bst_float> cut;
+                /*! \brief minimum value of each column */
+                std::vector<bst_float> min_val;
+                /*! \brief bin of each entry relative to cut_ptr of its column, aligned with row entries */
+                std::vector<unsigned char> row_bin;
+                /*! \brief constructor */
+                BinIndex(void) : max_bin(0){}
+                /*! \return total number of bins */
+                inline size_t NumBin(void) const{
+                    return cut.size();
+                }
+                /*! \brief clear the index */
+                inline void Clear(void){
+                    max_bin = 0;
+                    cut_ptr.clear(); cut.clear(); min_val.clear(); row_bin.clear();
+                }
+            };
+            /*!
+             * \brief bundles of mutually exclusive sparse columns, no row has entries in two columns of one bundle,
+             *        the sorted columns of a bundle are stored next to each other in one shared column,
+             *        column feat[k] takes the range [col_ptr[k], col_ptr[k+1]) of data,
+             *        columns that are not bundled with any other column are left out
+             */
+            struct BundleIndex{
+                /*! \brief whether the index is built */
+                bool built;
+                /*! \brief columns of bundle b are feat[bundle_ptr[b]] to feat[bundle_ptr[b+1]-1], in increasing order */
+                std::vector<bst_uint> bundle_ptr;
+                /*! \brief bundled columns */
+                std::vector<bst_uint> feat;
+                /*! \brief position of each column in feat, kNotBundled if the column is not bundled */
+                std::vector<bst_uint> fpos;
+                /*! \brief range of each bundled column in data */
+                std::vector<size_t> col_ptr;
+                /*! \brief entries of the shared columns, the first entry is a sentinel so iterators never point before the data */
+                std::vector<REntry> data;
+                /*! \brief constructor */
+                BundleIndex(void) : built(false){}
+                /*! \return number of bundles */
+                inline size_t NumBundle(void) const{
+                    return bundle_ptr.size() != 0 ? bundle_ptr.size() - 1 : 0;
+                }
+                /*! \return whether column fid is in a bundle */
+                inline bool IsBundled(size_t fid) const{
+                    return fid < fpos.size() && fpos[fid] != kNotBundled;
+                }
+                /*! \return number of entries in bundle b */
+                inline size_t BundleSize(size_t b) const{
+                    return col_ptr[bundle_ptr[b + 1]] - col_ptr[bundle_ptr[b]];
+                }
+                /*! \brief clear the index */
+                inline void Clear(void){
+                    built = false;
+                    bundle_ptr.clear(); feat.clear(); fpos.clear(); col_ptr.clear(); data.clear();
+                }
+            };
+            /*! \brief position of columns that are not bundled */
+            static const bst_uint kNotBundled = UINT_MAX;
+            /*! \brief number of most recent bundles a column tries to join */
+            static const unsigned kBundleSearch = 64;
+            /*!
+             * \brief header of the versioned binary format, all fields have fixed width,
+             *        offsets are relative to the start of header and aligned to kBinaryAlign,
+             *        pointers are stored as uint64_t
+             */
+            struct BinaryHeader{
+                /*! \brief magic number, kBinaryMagic */
+                unsigned magic;
+                /*! \brief version of the format */
+                unsigned version;
+                /*! \brief number of rows */
+                uint64_t num_row;
+                /*! \brief number of entries */
+                uint64_t num_entry;
+                /*! \brief size of column pointer, 0 if column access is not stored */
+                uint64_t num_col_ptr;
+                /*! \brief offset of row pointer, row data, column pointer, column data, and end of the block */
+                uint64_t offset[5];
+                /*! \brief number of columns, 0 in files that do not record it */
+                uint64_t num_col;
+                /*! \brief reserved field */
+                uint64_t reserved[7];
+            };
+            /*! \brief magic number of the versioned binary format */
+            static const unsigned kBinaryMagic = 0x4d425847U;
+            /*! \brief current version of the binary format */
+            static const unsigned kBinaryVersion = 1;
+            /*! \brief alignment of sections in the binary format */
+            static const unsigned kBinaryAlign = 64;
         public:
             /*! \brief constructor */
-            FMatrixS(void){ this->Clear(); }
+            FMatrixS(void) : page_(NULL){ this->Clear(); }
+            /*! \brief destructor */
+            ~FMatrixS(void){ this->ClearColPage(); }
             /*!  \brief get number of rows */
             inline size_t NumRow(void) const{
-                return row_ptr_.size() - 1;
+                return num_row_;
             }
             /*!
              * \brief get number of nonzero entries
              * \return number of nonzero entries
              */
             inline size_t NumEntry(void) const{
-                return row_data_.size();
+                return num_entry_;
             }
             /*! \brief clear the storage */
             inline void Clear(void){
+                this->ClearColPage();
+                mmap_.Close();
                 row_ptr_.clear();
                 row_ptr_.push_back(0);
                 row_data_.clear();
                 col_ptr_.clear();
                 col_data_.clear();
+                bin_.Clear();
+                bundle_.Clear();
+                num_col_ = 0;
+                this->SyncRowView();
+                this->SyncColView();
+            }
+            /*! \return whether the content is served from a memory mapped file */
+            inline bool IsMapped(void) const{
+                return mmap_.IsOpen();
             }
             /*! \brief get sparse part of current row */
             inline Line operator[](size_t sidx) const{
                 Line sp;
                 utils::Assert(!bst_debug || sidx < this->NumRow(), "row id exceed bound");
-                sp.len = static_cast<bst_uint>(row_ptr_[sidx + 1] - row_ptr_[sidx]);
-                sp.data_ = &row_data_[row_ptr_[sidx]];
+                sp.len = static_cast<bst_uint>(rptr_[sidx + 1] - rptr_[sidx]);
+                sp.data_ = rdata_ + rptr_[sidx];
                 return sp;
             }
             /*!
@@ -231,19 +434,38 @@ namespace xgboost{
                                  const std::vector<bst_float> &fvalue,
                                  unsigned fstart = 0, unsigned fend = UINT_MAX){
                 utils::Assert(findex.size() == fvalue.size());
+                utils::Assert(!this->IsMapped(), "FMatrixS: can not add row to memory mapped matrix");
                 unsigned cnt = 0;
                 for (size_t i = 0; i < findex.size(); i++){
                     if (findex[i] < fstart || findex[i] >= fend) continue;
                     row_data_.push_back(REntry(findex[i], fvalue[i]));
+                    num_col_ = std::max(num_col_, static_cast<size_t>(findex[i]) + 1);
                     cnt++;
                 }
                 row_ptr_.push_back(row_ptr_.back() + cnt);
+                this->SyncRowView();
+                return row_ptr_.size() - 2;
+            }
+            /*!
+             * \brief add a row to the matrix
+             * \param data entries of the row
+             * \param len number of entries
+             * \return the row id added line
+             */
+            inline size_t AddRow(const REntry *data, size_t len){
+                utils::Assert(!this->IsMapped(), "FMatrixS: can not add row to memory mapped matrix");
+                row_data_.insert(row_data_.end(), data, data + len);
+                row_ptr_.push_back(row_ptr_.back() + len);
+                for (size_t i = 0; i < len; i++){
+                    num_col_ = std::max(num_col_, static_cast<size_t>(data[i].findex) + 1);
+                }
+                this->SyncRowView();
                 return row_ptr_.size() - 2;
             }
             /*!  \brief get row iterator*/
             inline RowIter GetRow(size_t ridx) const{
                 utils::Assert(!bst_debug || ridx < this->NumRow(), "row id exceed bound");
-                return RowIter(&row_data_[row_ptr_[ridx]] - 1, &row_data_[row_ptr_[ridx + 1]] - 1);
+                return RowIter(rdata_ + rptr_[ridx] - 1, rdata_ + rptr_[ridx + 1] - 1);
             }
             /*!  \brief get row iterator*/
             inline RowIter GetRow(size_t ridx, unsigned gid) const{
@@ -251,79 +473,299 @@ namespace xgboost{
                 return FMatrixS::GetRow(ridx);
             }
         public:
-            /*! \return whether column access is enabled */
+            /*!
+             * \return whether column access is enabled, the column copy is built from rows
+             *         on first call, so matrices that are only used for prediction never build it,
+             *         the build is not locked, call it once before threads share the matrix
+             */
             inline bool HaveColAccess(void) const{
-                return col_ptr_.size() != 0 && col_data_.size() == row_data_.size();
+                if (!this->ColBuilt()) this->InitColAccess();
+                return true;
+            }
+            /*! \return whether the column copy is built, in memory or in a page file */
+            inline bool ColBuilt(void) const{
+                return num_col_ptr_ != 0 && num_col_entry_ == num_entry_;
             }
-            /*!  \brief get number of colmuns */
+            /*! \return whether the columns are kept in a page file */
+            inline bool IsColPaged(void) const{
+                return page_ != NULL;
+            }
+            /*!  \brief get number of colmuns, maximum feature index plus one */
             inline size_t NumCol(void) const{
-                utils::Assert(this->HaveColAccess());
-                return col_ptr_.size() - 1;
+                return num_col_;
+            }
+            /*!
+             * \brief get number of column blocks, GetSortedCol can only access the columns of
+             *        the block fetched by FetchColBlock, all columns are in one block when they are in memory
+             */
+            inline unsigned NumColBlock(void) const{
+                return page_ == NULL ? 1 : page_->NumBlock();
+            }
+            /*!
+             * \param bid block id, can be NumColBlock() to get the end of last block
+             * \return first column of the block
+             */
+            inline size_t ColBlockBegin(unsigned bid) const{
+                if (page_ == NULL || bid == page_->NumBlock()) return bid == 0 ? 0 : num_col_;
+                return page_->BlockBegin(bid);
+            }
+            /*!
+             * \brief make columns of block bid accessible, the next block is read in background,
+             *        must not be called in parallel region
+             * \param bid block id
+             */
+            inline void FetchColBlock(unsigned bid) const{
+                if (page_ == NULL) return;
+                const utils::ColPageFile<REntry>::Block &b = page_->Fetch(bid);
+                cdata_ = b.data.size() != 0 ? &b.data[0] : NULL;
+                cbase_ = b.ebegin;
+                col_block_ = bid;
+            }
+            /*! \return number of entries in column cidx, the column does not need to be fetched */
+            inline size_t GetColSize(size_t cidx) const{
+                return cptr_[cidx + 1] - cptr_[cidx];
             }
             /*!  \brief get col iterator*/
             inline ColIter GetSortedCol(size_t cidx) const{
                 utils::Assert(!bst_debug || cidx < this->NumCol(), "col id exceed bound");
-                return ColIter(&col_data_[col_ptr_[cidx]] - 1, &col_data_[col_ptr_[cidx + 1]] - 1);
+                utils::Assert(!bst_debug || page_ == NULL || (cidx >= ColBlockBegin(col_block_) && cidx < ColBlockBegin(col_block_ + 1)), "column is not fetched");
+                return ColIter(cdata_ + (cptr_[cidx] - cbase_) - 1, cdata_ + (cptr_[cidx + 1] - cbase_) - 1);
             }
             /*!  \brief get col iterator */
             inline ColBackIter GetReverseSortedCol(size_t cidx) const{
                 utils::Assert(!bst_debug || cidx < this->NumCol(), "col id exceed bound");
-                return ColBackIter(&col_data_[col_ptr_[cidx + 1]], &col_data_[col_ptr_[cidx]]);
+                utils::Assert(!bst_debug || page_ == NULL || (cidx >= ColBlockBegin(col_block_) && cidx < ColBlockBegin(col_block_ + 1)), "column is not fetched");
+                return ColBackIter(cdata_ + (cptr_[cidx + 1] - cbase_), cdata_ + (cptr_[cidx] - cbase_));
             }
             /*!
-             * \brief intialize the data so that we have both column and row major
-             *        access, call this whenever we need column access
+             * \brief intialize the data after rows are changed, the column copy is dropped
+             *        and built again when column access is needed
              */
             inline void InitData(void){
-                utils::SparseCSRMBuilder<REntry> builder(col_ptr_, col_data_);
-                builder.InitBudget(0);
-                for (size_t i = 0; i < this->NumRow(); i++){
-                    for (RowIter it = this->GetRow(i); it.Next();){
-                        builder.AddBudget(it.findex());
-                    }
+                bin_.Clear();
+                bundle_.Clear();
+                // rows may have been filled directly through row_ptr_ and row_data_
+                if (!this->IsMapped()) this->SyncRowView();
+                this->ClearColPage();
+                col_ptr_.clear(); col_data_.clear();
+                this->SyncColView();
+                num_col_ = this->CalcNumCol();
+            }
+            /*!
+             * \brief build column access now, each column is sorted by feature value,
+             *        call this before SaveBinary to store the columns in the buffer
+             */
+            inline void InitColAccess(void) const{
+                this->ClearColPage();
+                std::vector<size_t> rbegin;
+                std::vector< std::vector<size_t> > tpos;
+                this->CountCol(rbegin, tpos, col_ptr_);
+                col_data_.resize(num_entry_);
+                this->ScatterCol(0, num_col_, rbegin, tpos, col_data_.size() != 0 ? &col_data_[0] : NULL, 0);
+                tpos.clear();
+                this->SyncColView();
+                this->SortCol(0, num_col_, col_data_.size() != 0 ? &col_data_[0] : NULL, 0);
+            }
+            /*!
+             * \brief build column access in a page file instead of memory, the columns are cut into
+             *        blocks of whole columns, only a bounded number of blocks are kept in memory,
+             *        the rows are used to build each block and should be memory mapped
+             *        if they do not fit in memory either
+             * \param fname name of the page file, the file is removed when the matrix is cleared
+             * \param block_bytes size of each block, a column larger than that takes a block of its own
+             * \param cache_bytes memory used to cache blocks, at least two blocks are cached
+             */
+            inline void InitColPage(const char *fname, size_t block_bytes, size_t cache_bytes){
+                this->ClearColPage();
+                col_data_.clear();
+                std::vector<size_t> rbegin;
+                std::vector< std::vector<size_t> > tpos;
+                this->CountCol(rbegin, tpos, col_ptr_);
+                page_ = new utils::ColPageFile<REntry>();
+                page_->Create(fname);
+                std::vector<REntry> buf;
+                const size_t max_len = std::max(block_bytes / sizeof(REntry), static_cast<size_t>(1));
+                for (size_t cbegin = 0; cbegin < num_col_;){
+                    size_t cend = cbegin + 1;
+                    while (cend < num_col_ && col_ptr_[cend + 1] - col_ptr_[cbegin] <= max_len) ++cend;
+                    // each block is transposed with one pass over the rows
+                    const size_t ebegin = col_ptr_[cbegin];
+                    buf.resize(col_ptr_[cend] - ebegin);
+                    REntry *out = buf.size() != 0 ? &buf[0] : NULL;
+                    this->ScatterCol(cbegin, cend, rbegin, tpos, out, ebegin);
+                    this->SortCol(cbegin, cend, out, ebegin);
+                    page_->AddBlock(cbegin, cend, ebegin, out, buf.size());
+                    cbegin = cend;
                 }
-                builder.InitStorage();
-                for (size_t i = 0; i < this->NumRow(); i++){
-                    for (RowIter it = this->GetRow(i); it.Next();){
-                        builder.PushElem(it.findex(), REntry((bst_uint)i, it.fvalue()));
+                std::vector<REntry>().swap(buf);
+                page_->Finish(cache_bytes);
+                cptr_ = &col_ptr_[0];
+                cdata_ = NULL; cbase_ = 0;
+                num_col_ptr_ = col_ptr_.size();
+                num_col_entry_ = num_entry_;
+                if (page_->NumBlock() != 0) this->FetchColBlock(0);
+            }
+            /*!
+             * \brief get quantized index of the matrix, the index is built on first call
+             *        and rebuilt when max_bin changes, requires column access,
+             *        can be called by boosters trained concurrently
+             * \param max_bin maximum number of bins per column, must be in [2,256]
+             * \return the bin index
+             */
+            inline const BinIndex &GetBinIndex(int max_bin) const{
+                #pragma omp critical (fmatrix_lazy_index)
+                {
+                    if (bin_.max_bin != max_bin){
+                        this->InitBinIndex(max_bin);
                     }
                 }
-                // sort columns
-                unsigned ncol = static_cast<unsigned>(this->NumCol());
-                #pragma omp parallel for schedule(static)
-                for (unsigned i = 0; i < ncol; i++){
-                    std::sort(&col_data_[col_ptr_[i]], &col_data_[col_ptr_[i + 1]], REntry::cmp_fvalue);
+                return bin_;
+            }
+            /*!
+             * \brief get bins of one row, aligned with entries returned by GetRow(ridx),
+             *        GetBinIndex must be called before
+             * \param ridx row index
+             * \return pointer to local bin of each entry
+             */
+            inline const unsigned char *GetRowBin(size_t ridx) const{
+                return &bin_.row_bin[0] + rptr_[ridx];
+            }
+            /*!
+             * \brief get bundles of mutually exclusive columns, the index is built on first call,
+             *        requires column access with the columns in memory, can be called by boosters trained concurrently
+             * \return the bundle index
+             */
+            inline const BundleIndex &GetBundleIndex(void) const{
+                #pragma omp critical (fmatrix_lazy_index)
+                {
+                    if (!bundle_.built){
+                        this->InitBundleIndex();
+                    }
                 }
+                return bundle_;
             }
             /*!
-             * \brief save data to binary stream
-             *        note: since we have size_t in ptr,
-             *              the function is not consistent between 64bit and 32bit machine
+             * \brief save data to binary stream, in the versioned format described by BinaryHeader
              * \param fo output stream
              */
             inline void SaveBinary(utils::IStream &fo) const{
-                FMatrixS::SaveBinary(fo, row_ptr_, row_data_);
-                int col_access = this->HaveColAccess() ? 1 : 0;
-                fo.Write(&col_access, sizeof(int));
-                if (col_access != 0){
-                    FMatrixS::SaveBinary(fo, col_ptr_, col_data_);
+                BinaryHeader h;
+                memset(&h, 0, sizeof(h));
+                h.magic = kBinaryMagic;
+                h.version = kBinaryVersion;
+                h.num_row = num_row_;
+                h.num_entry = num_entry_;
+                h.num_col_ptr = this->ColBuilt() && !this->IsColPaged() ? num_col_ptr_ : 0;
+                h.num_col = num_col_;
+                uint64_t pos = sizeof(BinaryHeader);
+                h.offset[0] = pos = AlignPos(pos); pos += (h.num_row + 1) * sizeof(uint64_t);
+                h.offset[1] = pos = AlignPos(pos); pos += h.num_entry * sizeof(REntry);
+                h.offset[2] = pos = AlignPos(pos); pos += h.num_col_ptr * sizeof(uint64_t);
+                h.offset[3] = pos = AlignPos(pos); pos += (h.num_col_ptr != 0 ? h.num_entry : 0) * sizeof(REntry);
+                h.offset[4] = AlignPos(pos);
+
+                fo.Write(&h, sizeof(h));
+                pos = sizeof(h);
+                WritePad(fo, pos, h.offset[0]);
+                WritePtr(fo, rptr_, num_row_ + 1);
+                pos += (h.num_row + 1) * sizeof(uint64_t);
+                WritePad(fo, pos, h.offset[1]);
+                if (num_entry_ != 0) fo.Write(rdata_, num_entry_ * sizeof(REntry));
+                pos += h.num_entry * sizeof(REntry);
+                if (h.num_col_ptr != 0){
+                    WritePad(fo, pos, h.offset[2]);
+                    WritePtr(fo, cptr_, num_col_ptr_);
+                    pos += h.num_col_ptr * sizeof(uint64_t);
+                    WritePad(fo, pos, h.offset[3]);
+                    if (num_entry_ != 0) fo.Write(cdata_, num_entry_ * sizeof(REntry));
+                    pos += h.num_entry * sizeof(REntry);
                 }
+                WritePad(fo, pos, h.offset[4]);
             }
             /*!
-             * \brief load data from binary stream
-             *        note: since we have size_t in ptr,
-             *              the function is not consistent between 64bit and 32bit machin
+             * \brief load data from binary stream, the content is copied into the vectors,
+             *        accepts both the versioned format and the legacy format that stores size_t pointers
              * \param fi input stream
              */
             inline void LoadBinary(utils::IStream &fi){
-                FMatrixS::LoadBinary(fi, row_ptr_, row_data_);
-                int col_access;
-                fi.Read(&col_access, sizeof(int));
-                if (col_access != 0){
-                    FMatrixS::LoadBinary(fi, col_ptr_, col_data_);
-                }else{
-                    this->InitData();                    
+                this->Clear();
+                BinaryHeader h;
+                utils::Assert(fi.Read(&h.magic, sizeof(unsigned)) != 0, "Load FMatrixS");
+                if (h.magic != kBinaryMagic){
+                    this->LoadLegacyBinary(fi, h.magic); return;
                 }
+                utils::Assert(fi.Read(&h.version, sizeof(h) - sizeof(unsigned)) != 0, "Load FMatrixS");
+                utils::Assert(h.version == kBinaryVersion, "FMatrixS: unsupported binary format version");
+                uint64_t pos = sizeof(h);
+                SkipPad(fi, pos, h.offset[0]);
+                ReadPtr(fi, row_ptr_, h.num_row + 1);
+                pos += (h.num_row + 1) * sizeof(uint64_t);
+                SkipPad(fi, pos, h.offset[1]);
+                row_data_.resize(h.num_entry);
+                if (row_data_.size() != 0){
+                    utils::Assert(fi.Read(&row_data_[0], row_data_.size() * sizeof(REntry)) != 0, "Load FMatrixS");
+                }
+                pos += h.num_entry * sizeof(REntry);
+                this->SyncRowView();
+                if (h.num_col_ptr != 0){
+                    SkipPad(fi, pos, h.offset[2]);
+                    ReadPtr(fi, col_ptr_, h.num_col_ptr);
+                    pos += h.num_col_ptr * sizeof(uint64_t);
+                    SkipPad(fi, pos, h.offset[3]);
+                    col_data_.resize(h.num_entry);
+                    if (col_data_.size() != 0){
+                        utils::Assert(fi.Read(&col_data_[0], col_data_.size() * sizeof(REntry)) != 0, "Load FMatrixS");
+                    }
+                    pos += h.num_entry * sizeof(REntry);
+                    this->SyncColView();
+                }
+                SkipPad(fi, pos, h.offset[4]);
+                num_col_ = h.num_col != 0 ? static_cast<size_t>(h.num_col) : this->CalcNumCol();
+            }
+            /*!
+             * \brief map a binary file in the versioned format, rows and columns are served
+             *        directly from the mapping without copying, the mapping is released by Clear
+             * \param fname name of the file
+             * \return size of the matrix block in the file, the rest of the file starts there,
+             *         0 if the file can not be mapped, or is not in the versioned format
+             */
+            inline size_t LoadMMap(const char *fname){
+                this->Clear();
+                // the mapping can only be used as it is when the pointer type matches the stored one
+                if (sizeof(size_t) != sizeof(uint64_t)) return 0;
+                if (!mmap_.Open(fname)) return 0;
+                const char *dptr = mmap_.Data();
+                BinaryHeader h;
+                if (mmap_.Size() < sizeof(h)){
+                    mmap_.Close(); return 0;
+                }
+                memcpy(&h, dptr, sizeof(h));
+                if (h.magic != kBinaryMagic){
+                    mmap_.Close(); return 0;
+                }
+                utils::Assert(h.version == kBinaryVersion, "FMatrixS: unsupported binary format version");
+                utils::Assert(h.offset[4] <= mmap_.Size(), "FMatrixS: binary file is truncated");
+                rptr_ = reinterpret_cast<const size_t*>(dptr + h.offset[0]);
+                rdata_ = reinterpret_cast<const REntry*>(dptr + h.offset[1]);
+                num_row_ = static_cast<size_t>(h.num_row);
+                num_entry_ = static_cast<size_t>(h.num_entry);
+                utils::Assert(rptr_[num_row_] == num_entry_, "FMatrixS: binary file is corrupted");
+                if (h.num_col_ptr != 0){
+                    cptr_ = reinterpret_cast<const size_t*>(dptr + h.offset[2]);
+                    cdata_ = reinterpret_cast<const REntry*>(dptr + h.offset[3]);
+                    num_col_ptr_ = static_cast<size_t>(h.num_col_ptr);
+                    num_col_entry_ = num_entry_;
+                }
+                num_col_ = h.num_col != 0 ? static_cast<size_t>(h.num_col) : this->CalcNumCol();
+                return static_cast<size_t>(h.offset[4]);
+            }
+            /*! \return start of the mapped file, valid after LoadMMap succeeds */
+            inline const char *MappedData(void) const{
+                return mmap_.Data();
+            }
+            /*! \return size of the mapped file */
+            inline size_t MappedSize(void) const{
+                return mmap_.Size();
             }
             /*!
             * \brief load from text file
@@ -342,38 +784,379 @@ namespace xgboost{
                     }
                     this->AddRow(findex, fvalue);
                 }
-                // initialize column support as well
                 this->InitData();
             }
         private:
             /*!
-             * \brief save data to binary stream
-             * \param fo output stream
-             * \param ptr pointer data
-             * \param data data content
+             * \brief propose cut points of one column
+             * \param begin begin of the sorted column
+             * \param end end of the column
+             * \param max_bin maximum number of bins
+             * \param cut output cut points
              */
-            inline static void SaveBinary(utils::IStream &fo,
-                const std::vector<size_t> &ptr,
-                const std::vector<REntry> &data){
-                size_t nrow = ptr.size() - 1;
-                fo.Write(&nrow, sizeof(size_t));
-                fo.Write(&ptr[0], ptr.size() * sizeof(size_t));
-                if (data.size() != 0){
-                    fo.Write(&data[0], data.size() * sizeof(REntry));
+            inline static void ProposeBinCut(const REntry *begin, const REntry *end, int max_bin, std::vector<bst_float> &cut){
+                size_t ndistinct = 1;
+                for (const REntry *p = begin + 1; p < end; p++){
+                    if (p->fvalue != (p - 1)->fvalue) ndistinct++;
+                }
+                // number of entries each bin is expected to hold
+                const double step = ndistinct <= (size_t)max_bin ? 0.0 : static_cast<double>(end - begin) / max_bin;
+                for (const REntry *j = begin; j < end;){
+                    // skip to the end of current distinct value
+                    const REntry *k = j + 1;
+                    while (k < end && k->fvalue == j->fvalue) ++k;
+                    if (k == end){
+                        cut.push_back(j->fvalue + 1e-5f); break;
+                    }
+                    if ((int)cut.size() + 1 < max_bin && static_cast<size_t>(k - begin) >= step * (cut.size() + 1)){
+                        cut.push_back((j->fvalue + k->fvalue) * 0.5f);
+                    }
+                    j = k;
+                }
+            }
+            /*!
+             * \brief build the quantized index, cut points are chosen so that each bin holds
+             *        about the same number of entries, columns with no more than max_bin
+             *        distinct values get one bin per value
+             * \param max_bin maximum number of bins per column
+             */
+            inline void InitBinIndex(int max_bin) const{
+                utils::Assert(max_bin >= 2 && max_bin <= 256, "max_bin must be in [2,256]");
+                utils::Assert(this->HaveColAccess(), "BinIndex: need column access matrix");
+                const unsigned ncol = static_cast<unsigned>(this->NumCol());
+                std::vector< std::vector<bst_float> > cuts(ncol);
+                bin_.Clear();
+                bin_.min_val.resize(ncol, 0.0f);
+                for (unsigned b = 0; b < this->NumColBlock(); b++){
+                    this->FetchColBlock(b);
+                    const unsigned cbegin = static_cast<unsigned>(this->ColBlockBegin(b));
+                    const unsigned cend = static_cast<unsigned>(this->ColBlockBegin(b + 1));
+                    #pragma omp parallel for schedule(dynamic, 1)
+                    for (unsigned i = cbegin; i < cend; i++){
+                        if (this->GetColSize(i) == 0) continue;
+                        ProposeBinCut(cdata_ + (cptr_[i] - cbase_), cdata_ + (cptr_[i + 1] - cbase_), max_bin, cuts[i]);
+                        bin_.min_val[i] = cdata_[cptr_[i] - cbase_].fvalue;
+                    }
+                }
+                bin_.cut_ptr.resize(ncol + 1, 0);
+                for (unsigned i = 0; i < ncol; i++){
+                    bin_.cut_ptr[i + 1] = bin_.cut_ptr[i] + static_cast<bst_uint>(cuts[i].size());
+                    bin_.cut.insert(bin_.cut.end(), cuts[i].begin(), cuts[i].end());
+                }
+                bin_.row_bin.resize(num_entry_);
+                const unsigned nrow = static_cast<unsigned>(this->NumRow());
+                const size_t *row_ptr = rptr_;
+                const REntry *row_data = rdata_;
+                #pragma omp parallel for schedule(static)
+                for (unsigned i = 0; i < nrow; i++){
+                    for (size_t j = row_ptr[i]; j < row_ptr[i + 1]; j++){
+                        const bst_uint fid = row_data[j].findex;
+                        const bst_float *begin = &bin_.cut[0] + bin_.cut_ptr[fid];
+                        const bst_float *end = &bin_.cut[0] + bin_.cut_ptr[fid + 1];
+                        size_t k = std::upper_bound(begin, end, row_data[j].fvalue) - begin;
+                        // float rounding can push the maximum value onto the last cut
+                        if (k == static_cast<size_t>(end - begin)) k -= 1;
+                        bin_.row_bin[j] = static_cast<unsigned char>(k);
+                    }
+                }
+                bin_.max_bin = max_bin;
+            }
+            /*! \brief order columns by decreasing size, then by index */
+            inline static bool CmpColSize(const std::pair<size_t, bst_uint> &a, const std::pair<size_t, bst_uint> &b){
+                if (a.first != b.first) return a.first > b.first;
+                return a.second < b.second;
+            }
+            /*! \brief set or clear the bits of rows of column fid in a row bitmap */
+            inline void MarkColRows(bst_uint fid, std::vector<uint64_t> &mark, bool set) const{
+                for (const REntry *p = cdata_ + cptr_[fid]; p != cdata_ + cptr_[fid + 1]; p++){
+                    const uint64_t bit = static_cast<uint64_t>(1) << (p->findex & 63);
+                    if (set) mark[p->findex >> 6] |= bit;
+                    else mark[p->findex >> 6] &= ~bit;
+                }
+            }
+            /*!
+             * \brief build the bundle index, columns are visited from the longest, each joins the first of the
+             *        kBundleSearch most recent bundles that has no row in common with it, or starts a new bundle,
+             *        rows of these open bundles are kept in bitmaps
+             */
+            inline void InitBundleIndex(void) const{
+                utils::Assert(this->HaveColAccess(), "BundleIndex: need column access matrix");
+                utils::Assert(this->NumColBlock() == 1, "BundleIndex: need columns in memory");
+                const size_t ncol = this->NumCol(), nrow = this->NumRow();
+                std::vector< std::pair<size_t, bst_uint> > order;
+                for (size_t i = 0; i < ncol; i++){
+                    if (this->GetColSize(i) != 0) order.push_back(std::make_pair(this->GetColSize(i), static_cast<bst_uint>(i)));
+                }
+                std::sort(order.begin(), order.end(), CmpColSize);
+                std::vector< std::vector<bst_uint> > members;
+                std::vector<size_t> count;
+                // bitmap of bundle b is mark[b % kBundleSearch], reused once the bundle leaves the search window
+                std::vector< std::vector<uint64_t> > mark;
+                for (size_t j = 0; j < order.size(); j++){
+                    const size_t len = order[j].first;
+                    const bst_uint fid = order[j].second;
+                    const REntry *begin = cdata_ + cptr_[fid], *end = cdata_ + cptr_[fid + 1];
+                    size_t b = members.size();
+                    for (size_t k = members.size() - std::min(members.size(), static_cast<size_t>(kBundleSearch)); k < members.size(); k++){
+                        if (count[k] + len > nrow) continue;
+                        const std::vector<uint64_t> &m = mark[k % kBundleSearch];
+                        const REntry *p = begin;
+                        while (p != end && ((m[p->findex >> 6] >> (p->findex & 63)) & 1) == 0) p++;
+                        if (p == end){
+                            b = k; break;
+                        }
+                    }
+                    if (b == members.size()){
+                        if (mark.size() < kBundleSearch){
+                            mark.push_back(std::vector<uint64_t>((nrow + 63) / 64, 0));
+                        }else{
+                            const std::vector<bst_uint> &old = members[b - kBundleSearch];
+                            for (size_t k = 0; k < old.size(); k++){
+                                this->MarkColRows(old[k], mark[b % kBundleSearch], false);
+                            }
+                        }
+                        members.push_back(std::vector<bst_uint>());
+                        count.push_back(0);
+                    }
+                    this->MarkColRows(fid, mark[b % kBundleSearch], true);
+                    members[b].push_back(fid);
+                    count[b] += len;
+                }
+                std::vector< std::vector<uint64_t> >().swap(mark);
+
+                bundle_.Clear();
+                bundle_.fpos.resize(ncol, static_cast<bst_uint>(kNotBundled));
+                bundle_.bundle_ptr.push_back(0);
+                for (size_t b = 0; b < members.size(); b++){
+                    if (members[b].size() < 2) continue;
+                    std::sort(members[b].begin(), members[b].end());
+                    for (size_t k = 0; k < members[b].size(); k++){
+                        bundle_.fpos[members[b][k]] = static_cast<bst_uint>(bundle_.feat.size());
+                        bundle_.feat.push_back(members[b][k]);
+                    }
+                    bundle_.bundle_ptr.push_back(static_cast<bst_uint>(bundle_.feat.size()));
+                }
+                const unsigned nfeat = static_cast<unsigned>(bundle_.feat.size());
+                bundle_.col_ptr.resize(nfeat + 1);
+                bundle_.col_ptr[0] = 1;
+                for (unsigned k = 0; k < nfeat; k++){
+                    bundle_.col_ptr[k + 1] = bundle_.col_ptr[k] + this->GetColSize(bundle_.feat[k]);
+                }
+                bundle_.data.resize(bundle_.col_ptr[nfeat]);
+                bundle_.data[0] = REntry(0, 0.0f);
+                #pragma omp parallel for schedule(dynamic, 64)
+                for (unsigned k = 0; k < nfeat; k++){
+                    const bst_uint fid = bundle_.feat[k];
+                    std::copy(cdata_ + cptr_[fid], cdata_ + cptr_[fid + 1], &bundle_.data[0] + bundle_.col_ptr[k]);
+                }
+                bundle_.built = true;
+            }
+            /*! \brief map float to unsigned integer of the same order, -0 and 0 get the same key */
+            inline static unsigned SortKey(bst_float fvalue){
+                if (fvalue == 0.0f) fvalue = 0.0f;
+                unsigned u;
+                memcpy(&u, &fvalue, sizeof(u));
+                return (u & 0x80000000U) != 0 ? ~u : (u | 0x80000000U);
+            }
+            /*! \brief compare by value, then by row index */
+            inline static bool CmpValueRow(const REntry &a, const REntry &b){
+                if (a.fvalue < b.fvalue) return true;
+                if (b.fvalue < a.fvalue) return false;
+                return a.findex < b.findex;
+            }
+            /*!
+             * \brief sort entries of a column by value, entries of same value keep their order,
+             *        LSD radix sort on the order preserving key, short columns use std::sort
+             * \param begin begin of the column, entries are in row order
+             * \param end end of the column
+             * \param tmp temp space
+             */
+            inline static void SortColumn(REntry *begin, REntry *end, std::vector<REntry> &tmp){
+                const size_t n = end - begin;
+                if (n < 256){
+                    std::sort(begin, end, CmpValueRow); return;
+                }
+                // histogram of all four digits in one pass
+                size_t hist[4][256];
+                memset(hist, 0, sizeof(hist));
+                for (size_t j = 0; j < n; j++){
+                    const unsigned key = SortKey(begin[j].fvalue);
+                    hist[0][key & 255]++; hist[1][(key >> 8) & 255]++;
+                    hist[2][(key >> 16) & 255]++; hist[3][key >> 24]++;
+                }
+                if (tmp.size() < n) tmp.resize(n);
+                REntry *src = begin, *dst = &tmp[0];
+                for (int d = 0; d < 4; d++){
+                    const int shift = d * 8;
+                    // skip the digit when all keys share it
+                    if (hist[d][(SortKey(src[0].fvalue) >> shift) & 255] == n) continue;
+                    size_t pos[256], sum = 0;
+                    for (int k = 0; k < 256; k++){
+                        pos[k] = sum; sum += hist[d][k];
+                    }
+                    for (size_t j = 0; j < n; j++){
+                        dst[pos[(SortKey(src[j].fvalue) >> shift) & 255]++] = src[j];
+                    }
+                    std::swap(src, dst);
+                }
+                if (src != begin) std::copy(src, src + n, begin);
+            }
+            /*! \return maximum feature index plus one in the row view */
+            inline size_t CalcNumCol(void) const{
+                int nthread;
+                #pragma omp parallel
+                {
+                    nthread = omp_get_num_threads();
+                }
+                std::vector<bst_uint> tmax(nthread, 0);
+                #pragma omp parallel for schedule(static, 1)
+                for (int t = 0; t < nthread; t++){
+                    const size_t begin = num_entry_ / nthread * t;
+                    const size_t end = t + 1 == nthread ? num_entry_ : num_entry_ / nthread * (t + 1);
+                    bst_uint m = 0;
+                    for (size_t j = begin; j < end; j++){
+                        m = std::max(m, rdata_[j].findex + 1);
+                    }
+                    tmax[t] = m;
+                }
+                return *std::max_element(tmax.begin(), tmax.end());
+            }
+            /*! \brief point row view to the vectors */
+            inline void SyncRowView(void){
+                rptr_ = &row_ptr_[0];
+                rdata_ = row_data_.size() != 0 ? &row_data_[0] : NULL;
+                num_row_ = row_ptr_.size() - 1;
+                num_entry_ = row_data_.size();
+            }
+            /*!
+             * \brief count entries of each column, rows are split into one contiguous range per thread
+             * \param rbegin output, begin of the range of each thread
+             * \param tpos output, first position of each column written by each thread
+             * \param ptr output, column pointer
+             */
+            inline void CountCol(std::vector<size_t> &rbegin,
+                                 std::vector< std::vector<size_t> > &tpos,
+                                 std::vector<size_t> &ptr) const{
+                int nthread;
+                #pragma omp parallel
+                {
+                    nthread = omp_get_num_threads();
+                }
+                // each thread takes a contiguous range of rows holding about the same number of entries
+                rbegin.resize(nthread + 1, 0);
+                for (int t = 1; t < nthread; t++){
+                    rbegin[t] = std::lower_bound(rptr_, rptr_ + num_row_, num_entry_ / nthread * t) - rptr_;
+                }
+                rbegin[0] = 0;
+                rbegin[nthread] = num_row_;
+                const size_t ncol = num_col_;
+                tpos.resize(nthread);
+                #pragma omp parallel for schedule(static, 1)
+                for (int t = 0; t < nthread; t++){
+                    std::vector<size_t> &cnt = tpos[t];
+                    cnt.resize(ncol, 0);
+                    for (size_t j = rptr_[rbegin[t]]; j < rptr_[rbegin[t + 1]]; j++){
+                        cnt[rdata_[j].findex] += 1;
+                    }
+                }
+                // turn the counts into the write position of each thread, rows keep their order in each column
+                ptr.resize(ncol + 1);
+                ptr[0] = 0;
+                for (size_t i = 0; i < ncol; i++){
+                    size_t sum = ptr[i];
+                    for (int t = 0; t < nthread; t++){
+                        const size_t n = tpos[t][i];
+                        tpos[t][i] = sum; sum += n;
+                    }
+                    ptr[i + 1] = sum;
                 }
             }
             /*!
-             * \brief load data from binary stream
+             * \brief write entries of columns in [cbegin, cend) in column order, positions in tpos are advanced
+             * \param out output, position p of the column storage is out[p - base]
+             */
+            inline void ScatterCol(size_t cbegin, size_t cend,
+                                   const std::vector<size_t> &rbegin,
+                                   std::vector< std::vector<size_t> > &tpos,
+                                   REntry *out, size_t base) const{
+                const int nthread = static_cast<int>(tpos.size());
+                const bool all = cbegin == 0 && cend == num_col_;
+                #pragma omp parallel for schedule(static, 1)
+                for (int t = 0; t < nthread; t++){
+                    std::vector<size_t> &pos = tpos[t];
+                    for (size_t i = rbegin[t]; i < rbegin[t + 1]; i++){
+                        for (size_t j = rptr_[i]; j < rptr_[i + 1]; j++){
+                            const bst_uint fid = rdata_[j].findex;
+                            if (!all && (fid < cbegin || fid >= cend)) continue;
+                            out[pos[fid]++ - base] = REntry(static_cast<bst_uint>(i), rdata_[j].fvalue);
+                        }
+                    }
+                }
+            }
+            /*!
+             * \brief sort columns in [cbegin, cend), entries of same value stay in row order
+             * \param out column storage, position p is out[p - base]
+             */
+            inline void SortCol(size_t cbegin, size_t cend, REntry *out, size_t base) const{
+                #pragma omp parallel
+                {
+                    std::vector<REntry> tmp;
+                    #pragma omp for schedule(dynamic, 64)
+                    for (unsigned i = static_cast<unsigned>(cbegin); i < static_cast<unsigned>(cend); i++){
+                        SortColumn(out + (col_ptr_[i] - base), out + (col_ptr_[i + 1] - base), tmp);
+                    }
+                }
+            }
+            /*! \brief remove the page file of columns */
+            inline void ClearColPage(void) const{
+                if (page_ != NULL){
+                    delete page_; page_ = NULL;
+                }
+            }
+            /*! \brief point column view to the vectors */
+            inline void SyncColView(void) const{
+                cptr_ = col_ptr_.size() != 0 ? &col_ptr_[0] : NULL;
+                cdata_ = col_data_.size() != 0 ? &col_data_[0] : NULL;
+                num_col_ptr_ = col_ptr_.size();
+                num_col_entry_ = col_data_.size();
+                cbase_ = 0; col_block_ = 0;
+            }
+            /*!
+             * \brief load data in the legacy format, whose pointers are size_t
+             * \param fi input stream
+             * \param lower lower 32 bits of the number of rows, already consumed from the stream
+             */
+            inline void LoadLegacyBinary(utils::IStream &fi, unsigned lower){
+                utils::Assert(sizeof(size_t) == sizeof(uint64_t) || sizeof(size_t) == sizeof(unsigned), "Load FMatrixS");
+                LoadLegacyBinary(fi, lower, row_ptr_, row_data_);
+                this->SyncRowView();
+                int col_access;
+                fi.Read(&col_access, sizeof(int));
+                if (col_access != 0){
+                    unsigned nlower;
+                    utils::Assert(fi.Read(&nlower, sizeof(unsigned)) != 0, "Load FMatrixS");
+                    LoadLegacyBinary(fi, nlower, col_ptr_, col_data_);
+                    this->SyncColView();
+                }
+                num_col_ = this->CalcNumCol();
+            }
+            /*!
+             * \brief load one pointer and data pair in the legacy format
              * \param fi input stream
+             * \param lower lower 32 bits of the number of rows, already consumed from the stream
              * \param ptr pointer data
              * \param data data content
              */
-            inline static void LoadBinary(utils::IStream &fi,
+            inline static void LoadLegacyBinary(utils::IStream &fi, unsigned lower,
                 std::vector<size_t> &ptr,
                 std::vector<REntry> &data){
-                size_t nrow;
-                utils::Assert(fi.Read(&nrow, sizeof(size_t)) != 0, "Load FMatrixS");
-                ptr.resize(nrow + 1);
+                uint64_t nrow = lower;
+                if (sizeof(size_t) == sizeof(uint64_t)){
+                    unsigned upper;
+                    utils::Assert(fi.Read(&upper, sizeof(unsigned)) != 0, "Load FMatrixS");
+                    nrow |= static_cast<uint64_t>(upper) << 32;
+                }
+                ptr.resize(static_cast<size_t>(nrow) + 1);
                 utils::Assert(fi.Read(&ptr[0], ptr.size() * sizeof(size_t)) != 0, "Load FMatrixS");
 
                 data.resize(ptr.back());
@@ -381,15 +1164,87 @@ namespace xgboost{
                     utils::Assert(fi.Read(&data[0], data.size() * sizeof(REntry)) != 0, "Load FMatrixS");
                 }
             }
+            /*! \brief round position up to alignment of sections */
+            inline static uint64_t AlignPos(uint64_t pos){
+                return (pos + kBinaryAlign - 1) / kBinaryAlign * kBinaryAlign;
+            }
+            /*! \brief write zeros to move stream position from pos to end */
+            inline static void WritePad(utils::IStream &fo, uint64_t &pos, uint64_t end){
+                static const char zeros[kBinaryAlign] = {0};
+                utils::Assert(end >= pos && end - pos <= kBinaryAlign, "BUG: FMatrixS::WritePad");
+                if (end != pos) fo.Write(zeros, static_cast<size_t>(end - pos));
+                pos = end;
+            }
+            /*! \brief skip bytes to move stream position from pos to end */
+            inline static void SkipPad(utils::IStream &fi, uint64_t &pos, uint64_t end){
+                char buf[kBinaryAlign];
+                utils::Assert(end >= pos && end - pos <= kBinaryAlign, "FMatrixS: invalid binary format");
+                if (end != pos){
+                    utils::Assert(fi.Read(buf, static_cast<size_t>(end - pos)) != 0, "Load FMatrixS");
+                }
+                pos = end;
+            }
+            /*! \brief write pointers as uint64_t */
+            inline static void WritePtr(utils::IStream &fo, const size_t *ptr, size_t n){
+                if (sizeof(size_t) == sizeof(uint64_t)){
+                    fo.Write(ptr, n * sizeof(uint64_t));
+                }else{
+                    std::vector<uint64_t> buf(ptr, ptr + n);
+                    fo.Write(&buf[0], n * sizeof(uint64_t));
+                }
+            }
+            /*! \brief read pointers stored as uint64_t */
+            inline static void ReadPtr(utils::IStream &fi, std::vector<size_t> &ptr, uint64_t n){
+                ptr.resize(static_cast<size_t>(n));
+                if (sizeof(size_t) == sizeof(uint64_t)){
+                    utils::Assert(fi.Read(&ptr[0], ptr.size() * sizeof(uint64_t)) != 0, "Load FMatrixS");
+                }else{
+                    std::vector<uint64_t> buf(ptr.size());
+                    utils::Assert(fi.Read(&buf[0], buf.size() * sizeof(uint64_t)) != 0, "Load FMatrixS");
+                    for (size_t i = 0; i < buf.size(); ++i){
+                        ptr[i] = static_cast<size_t>(buf[i]);
+                    }
+                }
+            }
         public:
-            /*! \brief row pointer of CSR sparse storage */
+            /*!
+             * \brief row pointer of CSR sparse storage, unused when the matrix is memory mapped,
+             *        call InitData after changing the row storage directly
+             */
             std::vector<size_t>  row_ptr_;
             /*! \brief data in the row */
             std::vector<REntry>  row_data_;
-            /*! \brief column pointer of CSC format */
-            std::vector<size_t>  col_ptr_;
+            /*! \brief column pointer of CSC format, built on demand */
+            mutable std::vector<size_t>  col_ptr_;
             /*! \brief column datas */
-            std::vector<REntry>  col_data_;
+            mutable std::vector<REntry>  col_data_;
+        private:
+            /*! \brief view of row pointer, points to row_ptr_ or into the mapped file */
+            const size_t *rptr_;
+            /*! \brief view of row data */
+            const REntry *rdata_;
+            /*! \brief view of column pointer, NULL if there is no column access */
+            mutable const size_t *cptr_;
+            /*! \brief view of column data */
+            mutable const REntry *cdata_;
+            /*! \brief number of rows and entries in row view */
+            size_t num_row_, num_entry_;
+            /*! \brief size of column pointer and number of entries in column view */
+            mutable size_t num_col_ptr_, num_col_entry_;
+            /*! \brief number of columns */
+            size_t num_col_;
+            /*! \brief page file of columns, NULL if columns are in memory */
+            mutable utils::ColPageFile<REntry> *page_;
+            /*! \brief position of the first entry of the column view in the whole column storage */
+            mutable size_t cbase_;
+            /*! \brief block in the column view */
+            mutable unsigned col_block_;
+            /*! \brief mapped binary file */
+            utils::MMapFile mmap_;
+            /*! \brief quantized index, built lazily by GetBinIndex */
+            mutable BinIndex bin_;
+            /*! \brief bundles of exclusive columns, built lazily by GetBundleIndex */
+            mutable BundleIndex bundle_;
         };
     };
 };
@@ -6,6 +6,7 @@
 #include "xgboost_data.h"
 #include "../utils/xgboost_omp.h"
 #include "../utils/xgboost_config.h"
+#include "../utils/xgboost_random.h"
 /*!
  * \file xgboost_gbmbase.h
  * \brief a base model class,
@@ -75,6 +76,7 @@ namespace xgboost{
              */
             inline void LoadModel(utils::IStream &fi){
                 if (boosters.size() != 0) this->FreeSpace();
+                flat_.Clear();
                 utils::Assert(fi.Read(&mparam, sizeof(ModelParam)) != 0);
                 boosters.resize(mparam.num_boosters);
                 for (size_t i = 0; i < boosters.size(); i++){
@@ -170,21 +172,41 @@ namespace xgboost{
         public:
             /*!
              * \brief do gradient boost training for one step, using the information given
-             *        Note: content of grad and hess can change after DoBoost
-             * \param grad first order gradient of each instance
-             * \param hess second order gradient of each instance
+             *        Note: content of gpair can change after DoBoost
+             * \param gpair first and second order gradient of each instance
              * \param feats features of each instance
              * \param root_index pre-partitioned root index of each instance,
              *          root_index.size() can be 0 which indicates that no pre-partition involved
-             * \param bst_group which booster group it belongs to, by default, we only have 1 booster group, and leave this parameter as default
+             * \param bst_group which booster group it belongs to, by default, we only have 1 booster group, and leave this parameter as default,
+             *        -1 trains a multi-output tree for all groups, then gpair holds the gradients of all groups, group by group
+             * \param buffer_offset buffer index of the first instance of feats, -1 if feats is not buffered,
+             *        when given, the new tree adds the leaf each instance reached during training to the prediction buffer,
+             *        so the instances are not predicted again
              */
-            inline void DoBoost(std::vector<float> &grad,
-                                std::vector<float> &hess,
+            inline void DoBoost(booster::GPairView gpair,
                                 const booster::FMatrixS &feats,
                                 const std::vector<unsigned> &root_index,
-                                int bst_group = 0 ) {
-                booster::IBooster *bst = this->GetUpdateBooster( bst_group );
-                bst->DoBoost(grad, hess, feats, root_index);
+                                int bst_group = 0, int buffer_offset = -1 ) {
+                if (bst_group < 0){
+                    this->BoostGroups(gpair, feats, root_index, -1, 0, buffer_offset);
+                }else{
+                    this->BoostGroups(gpair, feats, root_index, bst_group, bst_group + 1, buffer_offset);
+                }
+            }
+            /*!
+             * \brief do gradient boost training for one step of all booster groups
+             * \param gpair first and second order gradient of each instance, the gradients of group g are in [ g * NumRow(), (g+1) * NumRow() )
+             * \param feats features of each instance
+             * \param root_index pre-partitioned root index of each instance, can be empty
+             * \param buffer_offset buffer index of the first instance of feats, -1 if feats is not buffered
+             */
+            inline void DoBoostGroups(booster::GPairView gpair,
+                                      const booster::FMatrixS &feats,
+                                      const std::vector<unsigned> &root_index,
+                                      int buffer_offset = -1){
+                const int ngroup = this->NumBoosterGroup();
+                utils::Assert(gpair.size() == feats.NumRow() * ngroup, "DoBoostGroups: gradient size must be NumRow() * NumBoosterGroup()");
+                this->BoostGroups(gpair, feats, root_index, 0, ngroup, buffer_offset);
             }
             /*!
              * \brief predict values for given sparse feature vector
@@ -211,6 +233,8 @@ namespace xgboost{
                 for (size_t i = itop; i < this->boosters.size(); ++i ){
                     if( booster_info[i] == bst_group ){
                         psum += this->boosters[i]->Predict(feats, row_index, root_index);
+                    }else if( booster_info[i] < 0 ){
+                        psum += static_cast<RegTreeTrainer<FMatrixS>*>(this->boosters[i])->PredictOutput(feats, row_index, root_index, bst_group);
                     }
                 }
                 // updated the buffered results
@@ -220,10 +244,45 @@ namespace xgboost{
                 }
                 return psum;
             }
+            /*!
+             * \brief predict all rows of a matrix without prediction buffer,
+             *        tree ensembles are scored by a flattened copy of the trees, which is rebuilt after the model changes
+             * \param feats feature matrix
+             * \param root_index root id of each row, can be empty
+             * \param bst_group booster group index, -1 to predict all groups
+             * \param preds output prediction of each row, prediction of group g is in [ g * NumRow(), (g+1) * NumRow() ) when all groups are predicted
+             */
+            inline void PredictBatch(const FMatrixS &feats, const std::vector<unsigned> &root_index,
+                                     int bst_group, float *preds){
+                if (mparam.booster_type == 0){
+                    if (flat_.NumTree() != boosters.size()){
+                        flat_.Clear();
+                        for (size_t i = 0; i < boosters.size(); ++i){
+                            flat_.AddTree(static_cast<RegTreeTrainer<FMatrixS>*>(boosters[i])->GetTree(), booster_info[i]);
+                        }
+                    }
+                    flat_.Predict(feats, root_index, bst_group, preds, this->NumBoosterGroup());
+                    return;
+                }
+                const unsigned ndata = static_cast<unsigned>(feats.NumRow());
+                const int gbegin = bst_group < 0 ? 0 : bst_group;
+                const int gend = bst_group < 0 ? this->NumBoosterGroup() : bst_group + 1;
+                for (int g = gbegin; g < gend; ++g){
+                    float *gpreds = preds + (size_t)(g - gbegin) * ndata;
+                    #pragma omp parallel for schedule( static )
+                    for (unsigned j = 0; j < ndata; ++j){
+                        gpreds[j] = this->Predict(feats, j, -1, root_index.size() == 0 ? 0 : root_index[j], g);
+                    }
+                }
+            }
             /*! \return number of boosters so far */
             inline int NumBoosters(void) const{
                 return mparam.num_boosters;
             }
+            /*! \return whether booster groups are trained together by multi-output trees */
+            inline bool MultiOutput(void) const{
+                return tparam.multi_output != 0 && this->NumBoosterGroup() > 1;
+            }
             /*! \return number of booster groups */
             inline int NumBoosterGroup(void) const{
                 if( mparam.num_booster_group == 0 ) return 1;
@@ -261,7 +320,8 @@ namespace xgboost{
                     booster_info[i - 1] = booster_info[i];
                 }
                 boosters.resize(mparam.num_boosters -= 1);
-                booster_info.resize(boosters.size());                
+                booster_info.resize(boosters.size());
+                flat_.Clear();                
                 // update pred counter
                 for( size_t i = 0; i < pred_counter.size(); ++ i ){
                     if( pred_counter[i] > (unsigned)bid ) pred_counter[i] -= 1;                    
@@ -287,6 +347,134 @@ namespace xgboost{
                     delete boosters[i];
                 }
                 boosters.clear(); booster_info.clear(); mparam.num_boosters = 0;
+                flat_.Clear();
+            }
+            /*! \brief add one booster of bst_group trained on gpair, see DoBoost */
+            inline void BoostOne(booster::GPairView gpair,
+                                 const booster::FMatrixS &feats,
+                                 const std::vector<unsigned> &root_index,
+                                 int bst_group, int buffer_offset){
+                utils::Assert(bst_group >= 0 || mparam.booster_type == 0, "multi-output booster must be tree booster");
+                booster::IBooster *bst = this->GetUpdateBooster( bst_group );
+                if (mparam.booster_type == 0){
+                    // tree makers reuse the buffers of the group across rounds, multi-output trees use the space of group 0
+                    const size_t sid = bst_group < 0 ? 0 : (size_t)bst_group;
+                    if (tree_space_.size() <= sid) tree_space_.resize(sid + 1);
+                    static_cast<RegTreeTrainer<FMatrixS>*>(bst)->SetWorkspace(&tree_space_[sid]);
+                    bst->DoBoost(gpair, feats, root_index);
+                    static_cast<RegTreeTrainer<FMatrixS>*>(bst)->SetWorkspace(NULL);
+                }else{
+                    bst->DoBoost(gpair, feats, root_index);
+                }
+                flat_.Clear();
+                if (buffer_offset >= 0 && mparam.booster_type == 0 && mparam.do_reboost == 0 && tparam.reupdate_booster == -1){
+                    this->AddTrainLeaf(static_cast<RegTreeTrainer<FMatrixS>*>(bst), boosters.size() - 1, buffer_offset, bst_group);
+                }
+            }
+            /*!
+             * \brief add num_parallel_tree boosters for each group in [gbegin, gend), the boosters are added group by group,
+             *        when group_parallel is set or there are parallel trees, the tree boosters are trained concurrently,
+             *        the threads are divided between boosters; when a call adds more than one booster, each booster draws random
+             *        numbers from its own generator seeded in booster order, also when the boosters are trained one by one,
+             *        so the model does not depend on the schedule
+             * \param gpair gradient of the groups, the gradients of group g are in [ (g-gbegin) * NumRow(), (g-gbegin+1) * NumRow() ),
+             *        for multi-output boosters the gradients of all groups
+             * \param feats features of each instance
+             * \param root_index pre-partitioned root index of each instance, can be empty
+             * \param gbegin first group, -1 with gend = 0 adds multi-output boosters
+             * \param gend end of groups
+             * \param buffer_offset buffer index of the first instance of feats, -1 if feats is not buffered
+             */
+            inline void BoostGroups(booster::GPairView gpair,
+                                    const booster::FMatrixS &feats,
+                                    const std::vector<unsigned> &root_index,
+                                    int gbegin, int gend, int buffer_offset){
+                // number of gradients each booster is trained on
+                const size_t ndata = gbegin < 0 ? gpair.size() : feats.NumRow();
+                const int npar = tparam.num_parallel_tree;
+                const int ntask = (gend - gbegin) * npar;
+                utils::Assert(npar >= 1, "num_parallel_tree must be positive");
+                utils::Assert(npar == 1 || mparam.booster_type == 0, "num_parallel_tree requires tree booster");
+                // the column copy is built on first use, build it before the boosters share the matrix
+                if (mparam.booster_type == 0) feats.HaveColAccess();
+                // seeds are drawn in booster order, so the model is the same whether the boosters are trained one by one or concurrently
+                std::vector<random::Random> rnd(ntask > 1 ? ntask : 0);
+                for (size_t t = 0; t < rnd.size(); ++t){
+                    rnd[t].Seed(random::NextUInt32());
+                }
+                // column pages fetched from disk are shared by all boosters, those are trained one by one
+                if ((tparam.group_parallel == 0 && npar == 1) || ntask == 1 || mparam.booster_type != 0 || mparam.do_reboost != 0 ||
+                    tparam.reupdate_booster != -1 || feats.NumColBlock() > 1){
+                    for (int t = 0; t < ntask; ++t){
+                        const int g = gbegin + t / npar;
+                        if (rnd.size() != 0) random::ThreadRandom() = &rnd[t];
+                        this->BoostOne(booster::GPairView(&gpair[(g - gbegin) * ndata], ndata), feats, root_index, g, buffer_offset);
+                        random::ThreadRandom() = NULL;
+                    }
+                    return;
+                }
+                // boosters are made in booster order
+                const size_t tbegin = boosters.size();
+                std::vector<RegTreeTrainer<FMatrixS>*> trees(ntask);
+                for (int t = 0; t < ntask; ++t){
+                    trees[t] = static_cast<RegTreeTrainer<FMatrixS>*>(this->GetUpdateBooster(gbegin + t / npar));
+                }
+                if (tree_space_.size() < (size_t)ntask) tree_space_.resize(ntask);
+                int nthread;
+                #pragma omp parallel
+                {
+                    nthread = omp_get_num_threads();
+                }
+                const int nconcur = std::min(ntask, nthread);
+                for (int t = 0; t < ntask; ++t){
+                    trees[t]->SetThreadShare(std::max(nthread / nconcur, 1));
+                    trees[t]->SetWorkspace(&tree_space_[t]);
+                }
+                // tree makers open parallel regions of their own inside the region over boosters
+                const int max_levels = omp_get_max_active_levels();
+                omp_set_max_active_levels(std::max(max_levels, 2));
+                #pragma omp parallel for schedule( dynamic, 1 ) num_threads( nconcur )
+                for (int t = 0; t < ntask; ++t){
+                    random::ThreadRandom() = &rnd[t];
+                    trees[t]->DoBoost(booster::GPairView(&gpair[(t / npar) * ndata], ndata), feats, root_index);
+                    random::ThreadRandom() = NULL;
+                }
+                omp_set_max_active_levels(max_levels);
+                flat_.Clear();
+                for (int t = 0; t < ntask; ++t){
+                    trees[t]->SetWorkspace(NULL);
+                    trees[t]->SetThreadShare(0);
+                    if (buffer_offset >= 0) this->AddTrainLeaf(trees[t], tbegin + t, buffer_offset, gbegin + t / npar);
+                }
+            }
+            /*!
+             * \brief add leaf values of the newly trained tree to the prediction buffer of the training instances
+             * \param bst the new tree
+             * \param tree_index position of the new tree in boosters
+             * \param buffer_offset buffer index of the first training instance
+             * \param bst_group booster group of the tree, -1 for multi-output tree
+             */
+            inline void AddTrainLeaf(RegTreeTrainer<FMatrixS> *bst, size_t tree_index, int buffer_offset, int bst_group){
+                bst->TakeTrainLeaf(tmp_leaf_);
+                if (tmp_leaf_.size() == 0) return;
+                const RegTree &tree = bst->GetTree();
+                const int gbegin = bst_group < 0 ? 0 : bst_group;
+                const int gend = bst_group < 0 ? this->NumBoosterGroup() : bst_group + 1;
+                for (int g = gbegin; g < gend; ++g){
+                    // buffers that include all trees of the group before the new one can take the new tree directly
+                    unsigned ready = 0;
+                    for (unsigned i = 0; i < tree_index; ++i){
+                        if (booster_info[i] == g || booster_info[i] < 0) ready = i + 1;
+                    }
+                    const unsigned ndata = static_cast<unsigned>(tmp_leaf_.size());
+                    #pragma omp parallel for schedule( static )
+                    for (unsigned j = 0; j < ndata; ++j){
+                        const int bid = mparam.BufferOffset(buffer_offset + j, g);
+                        if (tmp_leaf_[j] < 0 || pred_counter[bid] < ready) continue;
+                        pred_buffer[bid] += bst_group < 0 ? tree.leafvec(tmp_leaf_[j])[g] : tree[tmp_leaf_[j]].leaf_value();
+                        pred_counter[bid] = static_cast<unsigned>(tree_index + 1);
+                    }
+                }
             }
             /*! \brief configure a booster */
             inline void ConfigBooster(booster::IBooster *bst){
@@ -313,6 +501,12 @@ namespace xgboost{
                     boosters.push_back(booster::CreateBooster<FMatrixS>(mparam.booster_type));
                     booster_info.push_back(bst_group);
                     this->ConfigBooster(boosters.back());
+                    if (bst_group < 0){
+                        // multi-output tree stores one leaf value per booster group
+                        char val[32];
+                        sprintf(val, "%d", this->NumBoosterGroup());
+                        boosters.back()->SetParam("size_leaf_vector", val);
+                    }
                     boosters.back()->InitModel();
                 }
                 else{
@@ -392,10 +586,19 @@ namespace xgboost{
                  *  parameter this is part of trial interactive update mode
                  */
                 int reupdate_booster;
+                /*! \brief whether multiple booster groups are trained by one multi-output tree per round */
+                int multi_output;
+                /*! \brief whether the boosters of different groups in one round are trained concurrently */
+                int group_parallel;
+                /*! \brief number of trees added for each group in one round, trained concurrently from the same gradients */
+                int num_parallel_tree;
                 /*! \brief constructor */
                 TrainParam(void) {
                     nthread = 1;
                     reupdate_booster = -1;
+                    multi_output = 0;
+                    group_parallel = 0;
+                    num_parallel_tree = 1;
                 }
                 /*!
                  * \brief set parameters from outside
@@ -405,6 +608,9 @@ namespace xgboost{
                 inline void SetParam(const char *name, const char *val){
                     if (!strcmp("nthread", name))                 nthread = atoi(val);
                     if (!strcmp("interact:booster_index", name))  reupdate_booster = atoi(val);
+                    if (!strcmp("multi_output", name))            multi_output = atoi(val);
+                    if (!strcmp("group_parallel", name))          group_parallel = atoi(val);
+                    if (!strcmp("bst:num_parallel_tree", name))   num_parallel_tree = atoi(val);
                 }
             };
         protected:
@@ -423,6 +629,12 @@ namespace xgboost{
             std::vector<unsigned> pred_counter;
             /*! \brief configurations saved for each booster */
             utils::ConfigSaver cfg;
+            /*! \brief flattened copy of tree boosters used by PredictBatch */
+            FlatTreeEnsemble flat_;
+            /*! \brief leaf of each training instance in the newest tree */
+            std::vector<int> tmp_leaf_;
+            /*! \brief PerBoosterGroup, or per booster trained concurrently in one round: buffers of tree makers kept across boosting rounds */
+            std::vector<RegTreeTrainer<FMatrixS>::Workspace> tree_space_;
         };
     };
 };
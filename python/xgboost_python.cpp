@@ -7,7 +7,7 @@ namespace xgboost{
     namespace python{
         class DMatrix: public regrank::DMatrix{
         public:
-            // whether column is initialized
+            // whether rows are initialized, column access is built on demand
             bool init_col_;
         public:
             DMatrix(void){
@@ -17,7 +17,7 @@ namespace xgboost{
         public:            
             inline void Load(const char *fname, bool silent){
                 this->CacheLoad(fname, silent);
-                init_col_ = this->data.HaveColAccess();
+                init_col_ = true;
             }
             inline void Clear( void ){
                 this->data.Clear();
@@ -29,17 +29,13 @@ namespace xgboost{
                 return this->data.NumRow();
             }
             inline void AddRow( const XGEntry *data, size_t len ){
-                xgboost::booster::FMatrixS &mat = this->data;
-                mat.row_data_.resize( mat.row_ptr_.back() + len );
-                memcpy( &mat.row_data_[mat.row_ptr_.back()], data, sizeof(XGEntry)*len );
-                mat.row_ptr_.push_back( mat.row_ptr_.back() + len );
+                this->data.AddRow( data, len );
                 init_col_ = false;
             }
             inline const XGEntry* GetRow(unsigned ridx, size_t* len) const{
-                const xgboost::booster::FMatrixS &mat = this->data;
-
-                *len = mat.row_ptr_[ridx+1] - mat.row_ptr_[ridx];
-                return &mat.row_data_[ mat.row_ptr_[ridx] ];
+                xgboost::booster::FMatrixS::Line sp = this->data[ ridx ];
+                *len = sp.len;
+                return sp.data_;
             }
             inline void ParseCSR( const size_t *indptr,
                                   const unsigned *indices,
@@ -47,6 +43,7 @@ namespace xgboost{
                                   size_t nindptr,
                                   size_t nelem ){
                 xgboost::booster::FMatrixS &mat = this->data;
+                mat.Clear();
                 mat.row_ptr_.resize( nindptr );
                 memcpy( &mat.row_ptr_[0], indptr, sizeof(size_t)*nindptr );
                 mat.row_data_.resize( nelem );
@@ -139,23 +136,23 @@ namespace xgboost{
             }
             inline void BoostOneIter( const DMatrix &train, 
                                       float *grad, float *hess, size_t len, int bst_group ){
-                this->grad_.resize( len ); this->hess_.resize( len );
-                memcpy( &this->grad_[0], grad, sizeof(float)*len );
-                memcpy( &this->hess_[0], hess, sizeof(float)*len );
+                this->gpair_.resize( len );
+                for( size_t i = 0; i < len; ++ i ){
+                    this->gpair_[i] = booster::bst_gpair( grad[i], hess[i] );
+                }
                 
-                if( grad_.size() == train.Size() ){
+                if( gpair_.size() == train.Size() ){
                     if( bst_group < 0 ) bst_group = 0;
-                    base_gbm.DoBoost(grad_, hess_, train.data, train.info.root_index, bst_group);
+                    base_gbm.DoBoost(booster::GPairView(gpair_), train.data, train.info.root_index, bst_group);
                 }else{
                     utils::Assert( bst_group == -1, "must set bst_group to -1 to support all group boosting" );
                     int ngroup = base_gbm.NumBoosterGroup();
-                    utils::Assert( grad_.size() == train.Size() * (size_t)ngroup, "BUG: UpdateOneIter: mclass" );
-                    std::vector<float> tgrad( train.Size() ), thess( train.Size() );
-                    for( int g = 0; g < ngroup; ++ g ){
-                        memcpy( &tgrad[0], &grad_[g*tgrad.size()], sizeof(float)*tgrad.size() );
-                        memcpy( &thess[0], &hess_[g*tgrad.size()], sizeof(float)*tgrad.size() );
-                        base_gbm.DoBoost(tgrad, thess, train.data, train.info.root_index, g );
+                    utils::Assert( gpair_.size() == train.Size() * (size_t)ngroup, "BUG: UpdateOneIter: mclass" );
+                    if( base_gbm.MultiOutput() ){
+                        base_gbm.DoBoost(booster::GPairView(gpair_), train.data, train.info.root_index, -1 );
+                        return;
                     }
+                    base_gbm.DoBoostGroups(booster::GPairView(gpair_), train.data, train.info.root_index);
                 }                
             }
         };
@@ -172,18 +172,21 @@ namespace xgboost{
              */
             inline void UpdateOneIter(const DMatrix &train){
                 this->PredictRaw(preds_, train);
-                obj_->GetGradient(preds_, train.info, base_gbm.NumBoosters(), grad_, hess_);
-                if( grad_.size() == train.Size() ){
-                    base_gbm.DoBoost(grad_, hess_, train.data, train.info.root_index);
+                obj_->GetGradient(preds_, train.info, base_gbm.NumBoosters(), gpair_);
+                // cached training data takes the new trees into its prediction buffer without traversing them
+                const int buffer_offset = this->FindBufferOffset(train);
+                if( gpair_.size() == train.Size() ){
+                    base_gbm.DoBoost(booster::GPairView(gpair_), train.data, train.info.root_index, 0, buffer_offset);
                 }else{
                     int ngroup = base_gbm.NumBoosterGroup();
-                    utils::Assert( grad_.size() == train.Size() * (size_t)ngroup, "BUG: UpdateOneIter: mclass" );
-                    std::vector<float> tgrad( train.Size() ), thess( train.Size() );
-                    for( int g = 0; g < ngroup; ++ g ){
-                        memcpy( &tgrad[0], &grad_[g*tgrad.size()], sizeof(float)*tgrad.size() );
-                        memcpy( &thess[0], &hess_[g*tgrad.size()], sizeof(float)*tgrad.size() );
-                        base_gbm.DoBoost(tgrad, thess, train.data, train.info.root_index, g );
+                    utils::Assert( gpair_.size() == train.Size() * (size_t)ngroup, "BUG: UpdateOneIter: mclass" );
+                    if( base_gbm.MultiOutput() ){
+                        // one multi-output tree fits the gradients of all groups
+                        base_gbm.DoBoost(booster::GPairView(gpair_), train.data, train.info.root_index, -1, buffer_offset);
+                        return;
                     }
+                    // gradients of each group are stored contiguously, each group gets a view of its own range
+                    base_gbm.DoBoostGroups(booster::GPairView(gpair_), train.data, train.info.root_index, buffer_offset);
                 }
             }
             /*!
@@ -231,9 +234,9 @@ namespace xgboost{
                     base_gbm.DelteBooster(); return;
                 }
 
-                obj_->GetGradient(preds_, train.info, base_gbm.NumBoosters(), grad_, hess_);
+                obj_->GetGradient(preds_, train.info, base_gbm.NumBoosters(), gpair_);
                 std::vector<unsigned> root_index;
-                base_gbm.DoBoost(grad_, hess_, train.data, root_index);
+                base_gbm.DoBoost(booster::GPairView(gpair_), train.data, root_index);
 
                 for(size_t i = 0; i < cache_.size(); ++i){
                     this->InteractRePredict(*cache_[i].mat_);
@@ -268,6 +271,16 @@ namespace xgboost{
                 if( bst_group < 0 ){
                     int ngroup = base_gbm.NumBoosterGroup();
                     preds.resize( data.Size() * ngroup );
+                    if( buffer_offset < 0 && ngroup > 1 ){
+                        // all groups are predicted in one pass over the trees
+                        base_gbm.PredictBatch(data.data, data.info.root_index, -1, &preds[0]);
+                        const unsigned ndata = static_cast<unsigned>(preds.size());
+                        #pragma omp parallel for schedule( static )
+                        for (unsigned j = 0; j < ndata; ++j){
+                            preds[j] = mparam.base_score + preds[j];
+                        }
+                        return;
+                    }
                     for( int g = 0; g < ngroup; ++ g ){ 
                         this->PredictBuffer(&preds[ data.Size() * g ], data, buffer_offset, g );
                     }
@@ -285,11 +298,12 @@ namespace xgboost{
                         preds[j] = mparam.base_score + base_gbm.Predict(data.data, j, buffer_offset + j, data.info.GetRoot(j), bst_group );
 
                     }
-                }else
+                }else{
+                    base_gbm.PredictBatch(data.data, data.info.root_index, bst_group, preds);
                     #pragma omp parallel for schedule( static )
                     for (unsigned j = 0; j < ndata; ++j){
-                        preds[j] = mparam.base_score + base_gbm.Predict(data.data, j, -1, data.info.GetRoot(j), bst_group );
-                    }{
+                        preds[j] = mparam.base_score + preds[j];
+                    }
                 }
             }
         private:
@@ -367,7 +381,8 @@ namespace xgboost{
             std::string name_obj_;
             std::vector< std::pair<std::string, std::string> > cfg_;
         protected:
-            std::vector<float> grad_, hess_, preds_;
+            std::vector<booster::bst_gpair> gpair_;
+            std::vector<float> preds_;
         };
     }
 };
@@ -18,8 +18,16 @@
 #include <string>
 #include <cstring>
 #include "../booster/xgboost_data.h"
+#include "../utils/xgboost_omp.h"
 #include "../utils/xgboost_utils.h"
 #include "../utils/xgboost_stream.h"
+#include "../utils/xgboost_text_parser.h"
+
+#ifndef _MSC_VER
+extern "C"{
+#include <pthread.h>
+};
+#endif
 
 namespace xgboost{
     /*! \brief namespace to handle regression and rank */
@@ -52,6 +60,9 @@ namespace xgboost{
             booster::FMatrixS data;
             /*! \brief information fields */
             Info info;
+        public:
+            /*! \brief reader of a text file as a sequence of row batches, defined after DMatrix */
+            class TextStream;
         public:
             /*! \brief default constructor */
             DMatrix(void){}
@@ -60,37 +71,38 @@ namespace xgboost{
                 return data.NumRow();
             }           
             /*!
-             * \brief load from text file
+             * \brief load from text file, the file is read block by block,
+             *        each block is cut into chunks at whitespace and the chunks are parsed in parallel
              * \param fname name of text data
              * \param silent whether print information or not
              */
             inline void LoadText(const char* fname, bool silent = false){
                 data.Clear();
                 FILE* file = utils::FopenCheck(fname, "r");
-                float label; bool init = true;
-                char tmp[1024];
-                std::vector<booster::bst_uint> findex;
-                std::vector<booster::bst_float> fvalue;
+                int nthread;
+                #pragma omp parallel
+                {
+                    nthread = omp_get_num_threads();
+                }
+                utils::TextBlockReader reader(file);
+                std::vector<const char*> bounds;
+                std::vector<TextChunk> chunks;
+                const char *begin, *end;
                 
-                while (fscanf(file, "%s", tmp) == 1){
-                    unsigned index; float value;
-                    if (sscanf(tmp, "%u:%f", &index, &value) == 2){
-                        findex.push_back(index); fvalue.push_back(value);
+                while (reader.Next(&begin, &end)){
+                    utils::TextBlockReader::Split(begin, end, nthread * 4, bounds);
+                    const int nchunk = static_cast<int>(bounds.size()) - 1;
+                    chunks.resize(nchunk);
+                    #pragma omp parallel for schedule( dynamic, 1 )
+                    for (int i = 0; i < nchunk; ++i){
+                        ParseTextChunk(bounds[i], bounds[i + 1], chunks[i]);
                     }
-                    else{
-                        if (!init){
-                            info.labels.push_back(label);
-                            data.AddRow(findex, fvalue);
-                        }
-                        findex.clear(); fvalue.clear();
-                        utils::Assert(sscanf(tmp, "%f", &label) == 1, "invalid format");
-                        init = false;
+                    // merge the chunks into row storage in order
+                    for (int i = 0; i < nchunk; ++i){
+                        this->AddTextChunk(chunks[i]);
                     }
                 }
-            
-                info.labels.push_back(label);
-                data.AddRow(findex, fvalue);
-                // initialize column support as well
+                // column access is built when needed
                 data.InitData();
                 
                 if (!silent){
@@ -102,43 +114,31 @@ namespace xgboost{
                 this->TryLoadWeight(fname, silent);
             }
             /*!
-             * \brief load from binary file
+             * \brief load from binary file, buffers in the versioned format are memory mapped,
+             *        so the feature matrix is not copied and its pages are shared between processes
              * \param fname name of binary data
              * \param silent whether print information or not
              * \return whether loading is success
              */
             inline bool LoadBinary(const char* fname, bool silent = false){
-                FILE *fp = fopen64(fname, "rb");
-                if (fp == NULL) return false;
-                utils::FileStream fs(fp);
-                data.LoadBinary(fs);
-                info.labels.resize(data.NumRow());
-                utils::Assert(fs.Read(&info.labels[0], sizeof(float)* data.NumRow()) != 0, "DMatrix LoadBinary");
-                {// load in group ptr
-                    unsigned ngptr;
-                    if( fs.Read(&ngptr, sizeof(unsigned) ) != 0 ){
-                        info.group_ptr.resize( ngptr );
-                        if( ngptr != 0 ){
-                            utils::Assert( fs.Read(&info.group_ptr[0], sizeof(unsigned) * ngptr) != 0, "Load group file");
-                            utils::Assert( info.group_ptr.back() == data.NumRow(), "number of group must match number of record" );
-                        }
-                    }
+                const size_t offset = data.LoadMMap(fname);
+                if (offset != 0){
+                    // only the information fields after the matrix are copied
+                    utils::MemoryStream fs(data.MappedData() + offset, data.MappedSize() - offset);
+                    this->LoadInfo(fs);
+                }else{
+                    FILE *fp = fopen64(fname, "rb");
+                    if (fp == NULL) return false;
+                    utils::FileStream fs(fp);
+                    data.LoadBinary(fs);
+                    this->LoadInfo(fs);
+                    fs.Close();
                 }
-                {// load in weight
-                    unsigned nwt;
-                    if( fs.Read(&nwt, sizeof(unsigned) ) != 0 ){
-                        utils::Assert( nwt == 0 || nwt == data.NumRow(), "invalid weight" );
-                        info.weights.resize( nwt );
-                        if( nwt != 0 ){
-                            utils::Assert( fs.Read(&info.weights[0], sizeof(unsigned) * nwt) != 0, "Load weight file");
-                        }
-                    }
-                }
-                fs.Close();
                 
                 if (!silent){
-                    printf("%ux%u matrix with %lu entries is loaded from %s\n",
-                           (unsigned)data.NumRow(), (unsigned)data.NumCol(), (unsigned long)data.NumEntry(), fname);
+                    printf("%ux%u matrix with %lu entries is loaded from %s%s\n",
+                           (unsigned)data.NumRow(), (unsigned)data.NumCol(), (unsigned long)data.NumEntry(), fname,
+                           data.IsMapped() ? " (mmap)" : "");
                     if( info.group_ptr.size() != 0 ){
                         printf("data contains %u groups\n", (unsigned)info.group_ptr.size()-1 );
                     }
@@ -146,15 +146,15 @@ namespace xgboost{
                 return true;
             }
             /*!
-             * \brief save to binary file
+             * \brief save to binary file, the file is written to a temporary name and then renamed,
+             *        so processes that mapped the old file keep a valid view
              * \param fname name of binary data
              * \param silent whether print information or not
              */
             inline void SaveBinary(const char* fname, bool silent = false){
-                // initialize column support as well
-                data.InitData();
-                
-                utils::FileStream fs(utils::FopenCheck(fname, "wb"));
+                std::string tmpname = fname;
+                tmpname += ".tmp";
+                utils::FileStream fs(utils::FopenCheck(tmpname.c_str(), "wb"));
                 data.SaveBinary(fs);
                 utils::Assert( info.labels.size() == data.NumRow(), "label size is not consistent with feature matrix size" );
                 fs.Write(&info.labels[0], sizeof(float) * data.NumRow());
@@ -173,6 +173,10 @@ namespace xgboost{
                     }
                 }
                 fs.Close();
+#ifdef _MSC_VER
+                remove(fname);
+#endif
+                utils::Assert( rename(tmpname.c_str(), fname) == 0, "DMatrix: can not rename binary file" );
                 if (!silent){
                     printf("%ux%u matrix with %lu entries is saved to %s\n",
                        (unsigned)data.NumRow(), (unsigned)data.NumCol(), (unsigned long)data.NumEntry(), fname);
@@ -189,8 +193,11 @@ namespace xgboost{
              * \param fname name of binary data
              * \param silent whether print information or not
              * \param savebuffer whether do save binary buffer if it is text
+             * \param col_access whether the data is used for training, if true the column access is built
+             *        after loading text so that the buffer contains it, otherwise column access is
+             *        only built when needed and the buffer contains rows only
              */
-            inline void CacheLoad(const char *fname, bool silent = false, bool savebuffer = true){
+            inline void CacheLoad(const char *fname, bool silent = false, bool savebuffer = true, bool col_access = true){
                 int len = strlen(fname);
                 if (len > 8 && !strcmp(fname + len - 7, ".buffer")){
                     if( !this->LoadBinary(fname, silent) ){
@@ -203,10 +210,172 @@ namespace xgboost{
                 sprintf(bname, "%s.buffer", fname);
                 if (!this->LoadBinary(bname, silent)){
                     this->LoadText(fname, silent);
+                    if (col_access) data.InitColAccess();
                     if (savebuffer) this->SaveBinary(bname, silent);
                 }
             }
         private:
+            /*! \brief rows parsed from one chunk of text */
+            struct TextChunk{
+                /*! \brief label of each row */
+                std::vector<float> labels;
+                /*! \brief end of each row in entries, the first row starts at nlead */
+                std::vector<size_t> row_end;
+                /*! \brief entries of the rows */
+                std::vector<booster::FMatrixS::REntry> entries;
+                /*! \brief number of entries before the first label, they belong to the last row of previous chunk */
+                size_t nlead;
+            };
+            /*!
+             * \brief parse a chunk of text, a token is a feature if sscanf( "%u:%f" ) accepts it,
+             *        otherwise it is the label that starts a new row
+             * \param begin begin of the chunk
+             * \param end end of the chunk
+             * \param out output rows
+             */
+            inline static void ParseTextChunk(const char *begin, const char *end, TextChunk &out){
+                out.labels.clear(); out.row_end.clear(); out.entries.clear(); out.nlead = 0;
+                bool has_row = false;
+                std::string tok;
+                const char *p = begin;
+                while (true){
+                    while (p != end && utils::IsSpace(*p)) ++p;
+                    if (p == end) break;
+                    const char *colon = NULL, *q = p;
+                    for (; q != end && !utils::IsSpace(*q); ++q){
+                        if (*q == ':' && colon == NULL) colon = q;
+                    }
+                    unsigned index; float value;
+                    bool is_entry = false;
+                    if (colon != NULL){
+                        is_entry = utils::ParseUIntFast(p, colon, &index) && utils::ParseFloatFast(colon + 1, q, &value);
+                        if (!is_entry){
+                            tok.assign(p, q);
+                            is_entry = sscanf(tok.c_str(), "%u:%f", &index, &value) == 2;
+                        }
+                    }
+                    if (is_entry){
+                        // FMatrixS::AddRow drops feature index UINT_MAX, keep the same behavior
+                        if (index != UINT_MAX) out.entries.push_back(booster::FMatrixS::REntry(index, value));
+                    }else{
+                        float label;
+                        if (!utils::ParseFloatFast(p, q, &label)){
+                            tok.assign(p, q);
+                            utils::Assert(sscanf(tok.c_str(), "%f", &label) == 1, "invalid format");
+                        }
+                        if (has_row) out.row_end.push_back(out.entries.size());
+                        else out.nlead = out.entries.size();
+                        out.labels.push_back(label);
+                        has_row = true;
+                    }
+                    p = q;
+                }
+                if (has_row) out.row_end.push_back(out.entries.size());
+                else out.nlead = out.entries.size();
+            }
+            /*! \brief append rows of a chunk to the matrix */
+            inline void AddTextChunk(const TextChunk &chunk){
+                booster::FMatrixS &mat = this->data;
+                const booster::FMatrixS::REntry *e = chunk.entries.size() != 0 ? &chunk.entries[0] : NULL;
+                // features before the first label continue the last row, they are dropped if there is no row yet
+                if (chunk.nlead != 0 && mat.row_ptr_.size() > 1){
+                    mat.row_data_.insert(mat.row_data_.end(), e, e + chunk.nlead);
+                    mat.row_ptr_.back() = mat.row_data_.size();
+                }
+                const size_t base = mat.row_data_.size() - chunk.nlead;
+                mat.row_data_.insert(mat.row_data_.end(), e + chunk.nlead, e + chunk.entries.size());
+                for (size_t i = 0; i < chunk.row_end.size(); ++i){
+                    mat.row_ptr_.push_back(base + chunk.row_end[i]);
+                }
+                info.labels.insert(info.labels.end(), chunk.labels.begin(), chunk.labels.end());
+            }
+            /*!
+             * \brief parse whitespace separated numbers in parallel, reading stops after
+             *        the first token that is not a complete number, same as a loop of fscanf
+             * \param fi input file
+             * \param fmt sscanf format of one number followed by %n
+             * \param out output numbers are appended to it
+             */
+            template<typename T>
+            inline static void LoadNumbers(FILE *fi, const char *fmt, std::vector<T> &out){
+                int nthread;
+                #pragma omp parallel
+                {
+                    nthread = omp_get_num_threads();
+                }
+                utils::TextBlockReader reader(fi);
+                std::vector<const char*> bounds;
+                std::vector< std::vector<T> > cvalue;
+                std::vector<int> cstop;
+                const char *begin, *end;
+                while (reader.Next(&begin, &end)){
+                    utils::TextBlockReader::Split(begin, end, nthread * 4, bounds);
+                    const int nchunk = static_cast<int>(bounds.size()) - 1;
+                    cvalue.resize(nchunk); cstop.resize(nchunk);
+                    #pragma omp parallel for schedule( dynamic, 1 )
+                    for (int i = 0; i < nchunk; ++i){
+                        cstop[i] = ParseNumbers(bounds[i], bounds[i + 1], fmt, cvalue[i]) ? 0 : 1;
+                    }
+                    for (int i = 0; i < nchunk; ++i){
+                        out.insert(out.end(), cvalue[i].begin(), cvalue[i].end());
+                        if (cstop[i] != 0) return;
+                    }
+                }
+            }
+            /*!
+             * \brief parse numbers in a chunk
+             * \return false if a token that is not a complete number is met
+             */
+            template<typename T>
+            inline static bool ParseNumbers(const char *p, const char *end, const char *fmt, std::vector<T> &out){
+                out.clear();
+                std::string tok;
+                while (true){
+                    while (p != end && utils::IsSpace(*p)) ++p;
+                    if (p == end) return true;
+                    const char *q = p;
+                    while (q != end && !utils::IsSpace(*q)) ++q;
+                    T v;
+                    if (!utils::ParseNumberFast(p, q, &v)){
+                        tok.assign(p, q);
+                        int n = 0;
+                        if (sscanf(tok.c_str(), fmt, &v, &n) != 1) return false;
+                        if (n != static_cast<int>(tok.length())){
+                            out.push_back(v); return false;
+                        }
+                    }
+                    out.push_back(v);
+                    p = q;
+                }
+            }
+            /*!
+             * \brief load information fields stored after the feature matrix
+             * \param fs input stream
+             */
+            inline void LoadInfo(utils::IStream &fs){
+                info.labels.resize(data.NumRow());
+                utils::Assert(fs.Read(&info.labels[0], sizeof(float)* data.NumRow()) != 0, "DMatrix LoadBinary");
+                {// load in group ptr
+                    unsigned ngptr;
+                    if( fs.Read(&ngptr, sizeof(unsigned) ) != 0 ){
+                        info.group_ptr.resize( ngptr );
+                        if( ngptr != 0 ){
+                            utils::Assert( fs.Read(&info.group_ptr[0], sizeof(unsigned) * ngptr) != 0, "Load group file");
+                            utils::Assert( info.group_ptr.back() == data.NumRow(), "number of group must match number of record" );
+                        }
+                    }
+                }
+                {// load in weight
+                    unsigned nwt;
+                    if( fs.Read(&nwt, sizeof(unsigned) ) != 0 ){
+                        utils::Assert( nwt == 0 || nwt == data.NumRow(), "invalid weight" );
+                        info.weights.resize( nwt );
+                        if( nwt != 0 ){
+                            utils::Assert( fs.Read(&info.weights[0], sizeof(unsigned) * nwt) != 0, "Load weight file");
+                        }
+                    }
+                }
+            }
             inline bool TryLoadGroup(const char* fname, bool silent = false){
                 std::string name = fname;
                 if (name.length() > 8 && !strcmp(fname + name.length() - 7, ".buffer")){
@@ -216,10 +385,11 @@ namespace xgboost{
                 //if exists group data load it in
                 FILE *fi = fopen64(name.c_str(), "r");
                 if (fi == NULL) return false;                
+                std::vector<unsigned> nline;
+                LoadNumbers(fi, "%u%n", nline);
                 info.group_ptr.push_back(0);
-                unsigned nline;
-                while (fscanf(fi, "%u", &nline) == 1){
-                    info.group_ptr.push_back(info.group_ptr.back()+nline);
+                for (size_t i = 0; i < nline.size(); ++i){
+                    info.group_ptr.push_back(info.group_ptr.back()+nline[i]);
                 }
                 if(!silent){
                     printf("%lu groups are loaded from %s\n", info.group_ptr.size()-1, name.c_str());
@@ -237,10 +407,7 @@ namespace xgboost{
                 //if exists group data load it in
                 FILE *fi = fopen64(name.c_str(), "r");
                 if (fi == NULL) return false;                
-                float wt;
-                while (fscanf(fi, "%f", &wt) == 1){
-                    info.weights.push_back( wt );
-                }
+                LoadNumbers(fi, "%f%n", info.weights);
                 if(!silent){
                     printf("loading weight from %s\n", name.c_str());
                 }
@@ -249,6 +416,139 @@ namespace xgboost{
                 return true;
             }
         };
+
+        /*!
+         * \brief read a text file in the same format as DMatrix::LoadText as a sequence of batches,
+         *        each batch holds the complete rows of one block of text, so memory use is bounded
+         *        by the block size whatever the size of the file; the next batch is parsed by a
+         *        background thread while the current one is used.
+         *        Group and weight files are not read, batches only contain features and labels
+         */
+        class DMatrix::TextStream{
+        public:
+            /*!
+             * \brief constructor
+             * \param fname name of text data
+             * \param block_size size of text parsed into one batch
+             */
+            TextStream(const char *fname, size_t block_size)
+                : fp_(utils::FopenCheck(fname, "r")), reader_(fp_, block_size),
+                  current_(0), prefetch_(false), has_carry_(false), end_(false){
+                this->StartPrefetch();
+            }
+            /*! \brief destructor */
+            ~TextStream(void){
+                this->JoinPrefetch();
+                fclose(fp_);
+            }
+            /*!
+             * \brief get next batch, the batch stays valid until next call of Next
+             * \return the batch, NULL if the whole file has been read
+             */
+            inline const DMatrix *Next(void){
+                this->JoinPrefetch();
+                if (batch_[1 - current_].Size() == 0) return NULL;
+                current_ = 1 - current_;
+                this->StartPrefetch();
+                return &batch_[current_];
+            }
+        private:
+            // parse rows of next blocks into the batch not in use, until it holds at least one row
+            inline void ReadBatch(void){
+                DMatrix &batch = batch_[1 - current_];
+                booster::FMatrixS &mat = batch.data;
+                mat.Clear(); batch.info.labels.clear();
+                int nthread;
+                #pragma omp parallel
+                {
+                    nthread = omp_get_num_threads();
+                }
+                const char *begin, *end;
+                while (!end_ && batch.info.labels.size() == 0){
+                    // last row of previous block may continue in this block
+                    if (has_carry_){
+                        mat.row_data_.insert(mat.row_data_.end(), carry_.begin(), carry_.end());
+                        mat.row_ptr_.push_back(mat.row_data_.size());
+                        batch.info.labels.push_back(carry_label_);
+                        has_carry_ = false;
+                    }
+                    if (!reader_.Next(&begin, &end)){
+                        end_ = true; break;
+                    }
+                    utils::TextBlockReader::Split(begin, end, nthread * 4, bounds_);
+                    const int nchunk = static_cast<int>(bounds_.size()) - 1;
+                    chunks_.resize(nchunk);
+                    #pragma omp parallel for schedule( dynamic, 1 )
+                    for (int i = 0; i < nchunk; ++i){
+                        ParseTextChunk(bounds_[i], bounds_[i + 1], chunks_[i]);
+                    }
+                    for (int i = 0; i < nchunk; ++i){
+                        batch.AddTextChunk(chunks_[i]);
+                    }
+                    // hold back the last row, its features may continue in next block
+                    const size_t nrow = batch.info.labels.size();
+                    if (nrow != 0){
+                        carry_.assign(mat.row_data_.begin() + mat.row_ptr_[nrow - 1], mat.row_data_.end());
+                        carry_label_ = batch.info.labels.back();
+                        mat.row_data_.resize(mat.row_ptr_[nrow - 1]);
+                        mat.row_ptr_.pop_back();
+                        batch.info.labels.pop_back();
+                        has_carry_ = true;
+                    }
+                }
+                mat.InitData();
+            }
+            // start parsing next batch in background
+            inline void StartPrefetch(void){
+                prefetch_ = true;
+#ifndef _MSC_VER
+                if (pthread_create(&prefetch_thread_, NULL, PrefetchEntry, this) == 0) return;
+#endif
+                this->ReadBatch(); prefetch_ = false;
+            }
+            // wait for the running prefetch
+            inline void JoinPrefetch(void){
+                if (!prefetch_) return;
+#ifndef _MSC_VER
+                pthread_join(prefetch_thread_, NULL);
+#endif
+                prefetch_ = false;
+            }
+#ifndef _MSC_VER
+            inline static void *PrefetchEntry(void *arg){
+                static_cast<TextStream*>(arg)->ReadBatch();
+                return NULL;
+            }
+#endif
+        private:
+            // stream can not be shared between two owners
+            TextStream(const TextStream &);
+            TextStream &operator=(const TextStream &);
+        private:
+            /*! \brief input file */
+            FILE *fp_;
+            /*! \brief reader of text blocks */
+            utils::TextBlockReader reader_;
+            /*! \brief two batches, one in use and one being parsed */
+            DMatrix batch_[2];
+            /*! \brief batch returned by last Next */
+            int current_;
+            /*! \brief whether a prefetch is running */
+            bool prefetch_;
+            /*! \brief chunk bounds and parsed chunks of current block */
+            std::vector<const char*> bounds_;
+            std::vector<TextChunk> chunks_;
+            /*! \brief last row of previous block, whether it is kept */
+            bool has_carry_;
+            std::vector<booster::FMatrixS::REntry> carry_;
+            float carry_label_;
+            /*! \brief whether the whole file has been read */
+            bool end_;
+#ifndef _MSC_VER
+            /*! \brief prefetch thread */
+            pthread_t prefetch_thread_;
+#endif
+        };
     };
 };
 #endif
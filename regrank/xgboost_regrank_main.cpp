@@ -59,6 +59,11 @@ namespace xgboost{
             inline void SetParam(const char *name, const char *val){
                 if (!strcmp("silent", name))       silent = atoi(val);
                 if (!strcmp("use_buffer", name))   use_buffer = atoi(val);
+                if (!strcmp("col_page", name))     col_page = val;
+                if (!strcmp("col_page_block", name)) col_page_block = atoi(val);
+                if (!strcmp("col_page_cache", name)) col_page_cache = atoi(val);
+                if (!strcmp("pred_stream", name))  pred_stream = atoi(val);
+                if (!strcmp("pred_stream_block", name)) pred_stream_block = atoi(val);
                 if (!strcmp("seed", name))         random::Seed(atoi(val));
                 if (!strcmp("num_round", name))    num_round = atoi(val);
                 if (!strcmp("save_period", name))  save_period = atoi(val);
@@ -91,6 +96,11 @@ namespace xgboost{
                 // default parameters
                 silent = 0;
                 use_buffer = 1;
+                col_page = "NULL";
+                col_page_block = 64;
+                col_page_cache = 256;
+                pred_stream = 0;
+                pred_stream_block = 16;
                 num_round = 10;
                 save_period = 0;
                 eval_train = 0;
@@ -114,16 +124,27 @@ namespace xgboost{
             inline void InitData(void){
                 if (name_fmap != "NULL") fmap.LoadText(name_fmap.c_str());
                 if (task == "dump") return;
+                // streaming prediction reads the test data batch by batch in TaskPred
+                if (task == "pred" && pred_stream != 0) return;
                 if (task == "pred" || task == "dumppath"){
-                    data.CacheLoad(test_path.c_str(), silent != 0, use_buffer != 0);
+                    // prediction only reads rows, skip building column access
+                    data.CacheLoad(test_path.c_str(), silent != 0, use_buffer != 0, false);
                 }
                 else{
                     // training 
-                    data.CacheLoad(train_path.c_str(), silent != 0, use_buffer != 0);
+                    data.CacheLoad(train_path.c_str(), silent != 0, use_buffer != 0, col_page == "NULL");
+                    if (col_page != "NULL"){
+                        data.data.InitColPage(col_page.c_str(), static_cast<size_t>(col_page_block) << 20,
+                                              static_cast<size_t>(col_page_cache) << 20);
+                        if (!silent){
+                            printf("column access is stored in %u blocks in page file %s\n",
+                                   data.data.NumColBlock(), col_page.c_str());
+                        }
+                    }
                     utils::Assert(eval_data_names.size() == eval_data_paths.size());
                     for (size_t i = 0; i < eval_data_names.size(); ++i){
                         deval.push_back(new DMatrix());
-                        deval.back()->CacheLoad(eval_data_paths[i].c_str(), silent != 0, use_buffer != 0);
+                        deval.back()->CacheLoad(eval_data_paths[i].c_str(), silent != 0, use_buffer != 0, false);
                         devalall.push_back(deval.back());
                     }
                     std::vector<const DMatrix *> dcache(1, &data);
@@ -235,6 +256,9 @@ namespace xgboost{
                 this->SaveModel(fname);
             }
             inline void TaskPred(void){
+                if (pred_stream != 0){
+                    this->TaskPredStream(); return;
+                }
                 std::vector<float> preds;
                 if (!silent) printf("start prediction...\n");
                 learner.Predict(preds, data);
@@ -245,11 +269,40 @@ namespace xgboost{
                 }
                 fclose(fo);
             }
+            inline void TaskPredStream(void){
+                std::vector<float> preds;
+                if (!silent) printf("start streaming prediction from %s to %s...\n", test_path.c_str(), name_pred.c_str());
+                utils::Assert(pred_stream_block > 0, "pred_stream_block must be positive");
+                FILE *fo = utils::FopenCheck(name_pred.c_str(), "w");
+                DMatrix::TextStream stream(test_path.c_str(), static_cast<size_t>(pred_stream_block) << 20);
+                size_t nrow = 0;
+                // the next batch is parsed in background while current one is predicted and written
+                for (const DMatrix *batch = stream.Next(); batch != NULL; batch = stream.Next()){
+                    learner.Predict(preds, *batch);
+                    utils::Assert(preds.size() == batch->Size(), "streaming prediction needs one prediction per instance");
+                    for (size_t i = 0; i < preds.size(); i++){
+                        fprintf(fo, "%f\n", preds[i]);
+                    }
+                    nrow += batch->Size();
+                }
+                fclose(fo);
+                if (!silent) printf("%lu instances are predicted\n", (unsigned long)nrow);
+            }
         private:
             /* \brief whether silent */
             int silent;
             /* \brief whether use auto binary buffer */
             int use_buffer;
+            /* \brief page file to keep column access of training data out of memory, NULL to keep it in memory */
+            std::string col_page;
+            /* \brief size of each column block in the page file, in MB */
+            int col_page_block;
+            /* \brief memory used to cache column blocks, in MB */
+            int col_page_cache;
+            /* \brief whether predict test text data batch by batch, without loading the whole data or using buffer */
+            int pred_stream;
+            /* \brief size of text read into each prediction batch, in MB */
+            int pred_stream_block;
             /* \brief whether evaluate training statistics */            
             int eval_train;
             /* \brief number of boosting iterations */
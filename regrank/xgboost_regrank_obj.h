@@ -26,14 +26,13 @@ namespace xgboost{
              * \param preds prediction of current round             
              * \param info information about labels, weights, groups in rank
              * \param iter current iteration number 
-             * \param grad gradient over each preds
-             * \param hess second order gradient over each preds
+             * \param gpair first and second order gradient over each preds,
+             *        for multiple booster groups, gradients of group k are stored in [k*ndata, (k+1)*ndata)
              */
             virtual void GetGradient(const std::vector<float>& preds,  
                                      const DMatrix::Info &info,
                                      int iter,
-                                     std::vector<float> &grad, 
-                                     std::vector<float> &hess ) = 0;
+                                     std::vector<booster::bst_gpair> &gpair ) = 0;
             /*! \return the default evaluation metric for the problem */
             virtual const char* DefaultEvalMetric(void) = 0;
             /*! 
@@ -16,6 +16,7 @@ namespace xgboost{
         public:
             RegressionObj( int loss_type ){
                 loss.loss_type = loss_type;
+                scale_pos_weight = 1.0f;
             }
             virtual ~RegressionObj(){}
             virtual void SetParam(const char *name, const char *val){
@@ -25,10 +26,9 @@ namespace xgboost{
             virtual void GetGradient(const std::vector<float>& preds,  
                                      const DMatrix::Info &info,
                                      int iter,
-                                     std::vector<float> &grad, 
-                                     std::vector<float> &hess ) {
+                                     std::vector<booster::bst_gpair> &gpair ) {
                 utils::Assert( preds.size() == info.labels.size(), "label size predict size not match" );
-                grad.resize(preds.size()); hess.resize(preds.size());
+                gpair.resize(preds.size());
 
                 const unsigned ndata = static_cast<unsigned>(preds.size());
                 #pragma omp parallel for schedule( static )
@@ -36,8 +36,8 @@ namespace xgboost{
                     float p = loss.PredTransform(preds[j]);
                     float w = info.GetWeight(j);
                     if( info.labels[j] == 1.0f ) w *= scale_pos_weight;
-                    grad[j] = loss.FirstOrderGradient(p, info.labels[j]) * w;
-                    hess[j] = loss.SecondOrderGradient(p, info.labels[j]) * w;
+                    gpair[j] = booster::bst_gpair(loss.FirstOrderGradient(p, info.labels[j]) * w,
+                                                  loss.SecondOrderGradient(p, info.labels[j]) * w);
                 }
             }
             virtual const char* DefaultEvalMetric(void) {
@@ -70,10 +70,9 @@ namespace xgboost{
             virtual void GetGradient(const std::vector<float>& preds,  
                                      const DMatrix::Info &info,
                                      int iter,
-                                     std::vector<float> &grad, 
-                                     std::vector<float> &hess ) {
+                                     std::vector<booster::bst_gpair> &gpair ) {
                 utils::Assert( preds.size() == info.labels.size(), "label size predict size not match" );
-                grad.resize(preds.size()); hess.resize(preds.size());
+                gpair.resize(preds.size());
                 const std::vector<unsigned> &gptr = info.group_ptr;
                 utils::Assert( gptr.size() != 0 && gptr.back() == preds.size(), "rank loss must have group file" );
                 const unsigned ngroup = static_cast<unsigned>( gptr.size() - 1 );
@@ -87,15 +86,14 @@ namespace xgboost{
                         int nhit = 0;
                         for(unsigned j = gptr[k]; j < gptr[k+1]; ++j ){
                             rec.push_back( preds[j] );
-                            grad[j] = hess[j] = 0.0f;
+                            gpair[j] = booster::bst_gpair(0.0f, 0.0f);
                             nhit += info.labels[j];
                         }
                         Softmax( rec );
                         if( nhit == 1 ){
                             for(unsigned j = gptr[k]; j < gptr[k+1]; ++j ){
                                 float p = rec[ j - gptr[k] ];
-                                grad[j] = p - info.labels[j];
-                                hess[j] = 2.0f * p * ( 1.0f - p );
+                                gpair[j] = booster::bst_gpair(p - info.labels[j], 2.0f * p * ( 1.0f - p ));
                             }  
                         }else{
                             utils::Assert( nhit == 0, "softmax does not allow multiple labels" );
@@ -121,11 +119,10 @@ namespace xgboost{
             virtual void GetGradient(const std::vector<float>& preds,  
                                      const DMatrix::Info &info,
                                      int iter,
-                                     std::vector<float> &grad, 
-                                     std::vector<float> &hess ) {
+                                     std::vector<booster::bst_gpair> &gpair ) {
                 utils::Assert( nclass != 0, "must set num_class to use softmax" );
                 utils::Assert( preds.size() == (size_t)nclass * info.labels.size(), "SoftmaxMultiClassObj: label size and pred size does not match" );
-                grad.resize(preds.size()); hess.resize(preds.size());
+                gpair.resize(preds.size());
                 
                 const unsigned ndata = static_cast<unsigned>(info.labels.size());
                 #pragma omp parallel
@@ -144,12 +141,12 @@ namespace xgboost{
                         utils::Assert( label < nclass, "SoftmaxMultiClassObj: label exceed num_class" );
                         for( int k = 0; k < nclass; ++ k ){
                             float p = rec[ k ];
+                            const float h = 2.0f * p * ( 1.0f - p );
                             if( label == k ){
-                                grad[j+k*ndata] = p - 1.0f;
+                                gpair[j+k*ndata] = booster::bst_gpair(p - 1.0f, h);
                             }else{
-                                grad[j+k*ndata] = p;
+                                gpair[j+k*ndata] = booster::bst_gpair(p, h);
                             }
-                            hess[j+k*ndata] = 2.0f * p * ( 1.0f - p );
                         }  
                     }
                 }
@@ -200,10 +197,9 @@ namespace xgboost{
             virtual void GetGradient(const std::vector<float>& preds,  
                                      const DMatrix::Info &info,
                                      int iter,
-                                     std::vector<float> &grad, 
-                                     std::vector<float> &hess ) {
+                                     std::vector<booster::bst_gpair> &gpair ) {
                 utils::Assert( preds.size() == info.labels.size(), "label size predict size not match" );              
-                grad.resize(preds.size()); hess.resize(preds.size());
+                gpair.resize(preds.size());
                 const std::vector<unsigned> &gptr = info.group_ptr;
                 utils::Assert( gptr.size() != 0 && gptr.back() == preds.size(), "rank loss must have group file" );
                 const unsigned ngroup = static_cast<unsigned>( gptr.size() - 1 );
@@ -222,7 +218,7 @@ namespace xgboost{
                         lst.clear(); pairs.clear(); 
                         for(unsigned j = gptr[k]; j < gptr[k+1]; ++j ){
                             lst.push_back( ListEntry(preds[j], info.labels[j], j ) );
-                            grad[j] = hess[j] = 0.0f;
+                            gpair[j] = booster::bst_gpair(0.0f, 0.0f);
                         }                        
                         std::sort( lst.begin(), lst.end(), ListEntry::CmpPred );
                         rec.resize( lst.size() );
@@ -266,11 +262,11 @@ namespace xgboost{
                             float g = loss.FirstOrderGradient( p, 1.0f );
                             float h = loss.SecondOrderGradient( p, 1.0f );
                             // accumulate gradient and hessian in both pid, and nid, 
-                            grad[ pos.rindex ] += g * w; 
-                            grad[ neg.rindex ] -= g * w;
+                            gpair[ pos.rindex ].grad += g * w; 
+                            gpair[ neg.rindex ].grad -= g * w;
                             // take conservative update, scale hessian by 2
-                            hess[ pos.rindex ] += 2.0f * h * w; 
-                            hess[ neg.rindex ] += 2.0f * h * w;
+                            gpair[ pos.rindex ].hess += 2.0f * h * w; 
+                            gpair[ neg.rindex ].hess += 2.0f * h * w;
                         }                       
                     }
                 }
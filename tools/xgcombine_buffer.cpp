@@ -177,6 +177,8 @@ public:
             utils::Assert( info.group_ptr.back() == data.NumRow(), "group size must match num rows" );
         }
         this->data.InitData();
+        // the buffer is used for training, store column access in it
+        this->data.InitColAccess();
     }
 };
 
@@ -0,0 +1,239 @@
+#ifndef XGBOOST_COLPAGE_H
+#define XGBOOST_COLPAGE_H
+/*!
+ * \file xgboost_colpage.h
+ * \brief page file of column blocks, used to keep the sorted column copy of a feature matrix
+ *        out of memory, blocks are served through a cache of bounded size and the next block
+ *        is read by a background thread while the current one is used
+ * \author Tianqi Chen: tianqi.tchen@gmail.com
+ */
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "xgboost_utils.h"
+
+#ifndef _MSC_VER
+extern "C"{
+#include <pthread.h>
+#include <unistd.h>
+};
+#endif
+
+namespace xgboost{
+    namespace utils{
+        /*!
+         * \brief page file of column blocks, each block holds the entries of a range of columns,
+         *        the file is a scratch file that is removed when the page is closed
+         * \tparam Entry type of entry in column
+         */
+        template<typename Entry>
+        class ColPageFile{
+        public:
+            /*! \brief a block of columns in memory */
+            struct Block{
+                /*! \brief first column of the block */
+                size_t cbegin;
+                /*! \brief end of columns in the block */
+                size_t cend;
+                /*! \brief position of the first entry of the block in the whole column storage */
+                size_t ebegin;
+                /*! \brief entries of the columns */
+                std::vector<Entry> data;
+            };
+        public:
+            /*! \brief constructor */
+            ColPageFile(void) : fp_(NULL), nslot_(0), npin_(0), current_(0), prefetch_bid_(-1){}
+            /*! \brief destructor, removes the page file */
+            ~ColPageFile(void){
+                this->Close();
+            }
+            /*!
+             * \brief create the page file, blocks are added by AddBlock in column order
+             * \param fname name of the page file
+             */
+            inline void Create(const char *fname){
+                this->Close();
+                fname_ = fname;
+                fp_ = FopenCheck(fname, "w+b");
+                blocks_.clear();
+                foffset_.clear();
+                foffset_.push_back(0);
+            }
+            /*!
+             * \brief append a block to the page file
+             * \param cbegin first column of the block
+             * \param cend end of columns in the block
+             * \param ebegin position of the first entry in the whole column storage
+             * \param data entries of the block
+             * \param len number of entries
+             */
+            inline void AddBlock(size_t cbegin, size_t cend, size_t ebegin, const Entry *data, size_t len){
+                Block b;
+                b.cbegin = cbegin; b.cend = cend; b.ebegin = ebegin;
+                blocks_.push_back(b);
+                if (len != 0){
+                    Assert(fwrite(data, sizeof(Entry), len, fp_) == len, "ColPageFile: can not write page file");
+                }
+                foffset_.push_back(foffset_.back() + len);
+            }
+            /*!
+             * \brief finish writing, set up the cache
+             * \param cache_bytes memory budget of the cache, at least two blocks are kept
+             *        so the next block can be read while the current one is in use
+             */
+            inline void Finish(size_t cache_bytes){
+                fflush(fp_);
+                const unsigned nblock = this->NumBlock();
+                size_t max_len = 1;
+                for (unsigned i = 0; i < nblock; ++i){
+                    max_len = std::max(max_len, static_cast<size_t>(foffset_[i + 1] - foffset_[i]));
+                }
+                // blocks are scanned in order again and again, so the first blocks stay in the cache,
+                // the rest are streamed through two slots, one in use and one being prefetched
+                size_t nslot = std::max(static_cast<size_t>(2), cache_bytes / (max_len * sizeof(Entry)));
+                if (nslot >= nblock){
+                    npin_ = nblock; nslot_ = nblock;
+                }else{
+                    npin_ = static_cast<unsigned>(nslot) - 2; nslot_ = npin_ + 2;
+                }
+                slots_.clear();
+                slots_.resize(nslot_);
+                slot_bid_.clear();
+                slot_bid_.resize(nslot_, -1);
+                current_ = 0; prefetch_bid_ = -1;
+            }
+            /*! \brief stop prefetching and remove the page file */
+            inline void Close(void){
+                this->JoinPrefetch();
+                if (fp_ != NULL){
+                    fclose(fp_); fp_ = NULL;
+                    remove(fname_.c_str());
+                }
+                slots_.clear(); slot_bid_.clear(); blocks_.clear();
+            }
+            /*! \return number of blocks */
+            inline unsigned NumBlock(void) const{
+                return static_cast<unsigned>(blocks_.size());
+            }
+            /*! \return first column of block bid, available without reading the block */
+            inline size_t BlockBegin(unsigned bid) const{
+                return blocks_[bid].cbegin;
+            }
+            /*!
+             * \brief get a block, the block stays valid until next call of Fetch,
+             *        starts reading the block after it in background
+             * \param bid block id
+             * \return the block
+             */
+            inline const Block &Fetch(unsigned bid){
+                this->JoinPrefetch();
+                int s = this->FindSlot(bid);
+                if (slot_bid_[s] != static_cast<int>(bid)){
+                    this->ReadBlock(bid, s);
+                }
+                current_ = s;
+                const unsigned next = (bid + 1) % this->NumBlock();
+                const int ns = this->FindSlot(next);
+                if (next != bid && slot_bid_[ns] != static_cast<int>(next)){
+                    this->StartPrefetch(next, ns);
+                }
+                return slots_[s];
+            }
+        private:
+            // slot that block bid is read into, streamed blocks never take the slot in use
+            inline int FindSlot(unsigned bid) const{
+                if (bid < npin_) return static_cast<int>(bid);
+                const int a = static_cast<int>(npin_), b = a + 1;
+                if (slot_bid_[a] == static_cast<int>(bid)) return a;
+                if (slot_bid_[b] == static_cast<int>(bid)) return b;
+                return current_ == a ? b : a;
+            }
+            // read block bid into slot s
+            inline void ReadBlock(unsigned bid, int s){
+                Block &b = slots_[s];
+                const Block &src = blocks_[bid];
+                b.cbegin = src.cbegin; b.cend = src.cend; b.ebegin = src.ebegin;
+                const size_t len = static_cast<size_t>(foffset_[bid + 1] - foffset_[bid]);
+                b.data.resize(len);
+                if (len != 0){
+                    ReadAt(&b.data[0], len * sizeof(Entry), foffset_[bid] * sizeof(Entry));
+                }
+                slot_bid_[s] = static_cast<int>(bid);
+            }
+            // read from position of the page file, can be called from the prefetch thread
+            inline void ReadAt(void *ptr, size_t size, size_t offset){
+#ifndef _MSC_VER
+                char *p = static_cast<char*>(ptr);
+                while (size != 0){
+                    const ssize_t n = pread(fileno(fp_), p, size, static_cast<off_t>(offset));
+                    Assert(n > 0, "ColPageFile: can not read page file");
+                    p += n; offset += static_cast<size_t>(n); size -= static_cast<size_t>(n);
+                }
+#else
+                Assert(_fseeki64(fp_, offset, SEEK_SET) == 0, "ColPageFile: can not seek page file");
+                Assert(fread(ptr, 1, size, fp_) == size, "ColPageFile: can not read page file");
+#endif
+            }
+            // start reading block bid into slot s in background
+            inline void StartPrefetch(unsigned bid, int s){
+                prefetch_bid_ = static_cast<int>(bid);
+                prefetch_slot_ = s;
+                // mark the slot empty until the read finishes
+                slot_bid_[s] = -1;
+#ifndef _MSC_VER
+                if (pthread_create(&prefetch_thread_, NULL, PrefetchEntry, this) != 0){
+                    this->ReadBlock(bid, s); prefetch_bid_ = -1;
+                }
+#else
+                this->ReadBlock(bid, s); prefetch_bid_ = -1;
+#endif
+            }
+            // wait for the running prefetch
+            inline void JoinPrefetch(void){
+                if (prefetch_bid_ < 0) return;
+#ifndef _MSC_VER
+                pthread_join(prefetch_thread_, NULL);
+#endif
+                prefetch_bid_ = -1;
+            }
+#ifndef _MSC_VER
+            inline static void *PrefetchEntry(void *arg){
+                ColPageFile *self = static_cast<ColPageFile*>(arg);
+                self->ReadBlock(static_cast<unsigned>(self->prefetch_bid_), self->prefetch_slot_);
+                return NULL;
+            }
+#endif
+        private:
+            // page file can not be shared between two owners
+            ColPageFile(const ColPageFile &);
+            ColPageFile &operator=(const ColPageFile &);
+        private:
+            /*! \brief name of the page file */
+            std::string fname_;
+            /*! \brief page file */
+            FILE *fp_;
+            /*! \brief column range of each block, data is not used */
+            std::vector<Block> blocks_;
+            /*! \brief offset of each block in the page file, in number of entries */
+            std::vector<size_t> foffset_;
+            /*! \brief number of cache slots, and number of blocks that are kept once read */
+            unsigned nslot_, npin_;
+            /*! \brief cache slots */
+            std::vector<Block> slots_;
+            /*! \brief block held by each slot, -1 if empty */
+            std::vector<int> slot_bid_;
+            /*! \brief slot returned by last Fetch */
+            int current_;
+            /*! \brief block being prefetched, -1 if none */
+            int prefetch_bid_;
+            /*! \brief slot of the block being prefetched */
+            int prefetch_slot_;
+#ifndef _MSC_VER
+            /*! \brief prefetch thread */
+            pthread_t prefetch_thread_;
+#endif
+        };
+    };
+};
+#endif
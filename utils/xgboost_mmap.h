@@ -0,0 +1,90 @@
+#ifndef XGBOOST_MMAP_H
+#define XGBOOST_MMAP_H
+/*!
+ * \file xgboost_mmap.h
+ * \brief read only memory mapped file, pages are shared through the OS page cache
+ *        between processes that map the same file
+ * \author Tianqi Chen: tianqi.tchen@gmail.com
+ */
+#include <cstdio>
+#include "xgboost_utils.h"
+
+#ifndef _MSC_VER
+extern "C"{
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+};
+#endif
+
+namespace xgboost{
+    namespace utils{
+        /*! \brief read only memory mapped file */
+        class MMapFile{
+        public:
+            /*! \brief constructor */
+            MMapFile(void) : dptr_(NULL), size_(0){}
+            /*! \brief destructor, unmap the file */
+            ~MMapFile(void){
+                this->Close();
+            }
+            /*!
+             * \brief map a file into memory
+             * \param fname name of the file
+             * \return whether the mapping succeeds, always false on platforms without mmap
+             */
+            inline bool Open(const char *fname){
+                this->Close();
+#ifndef _MSC_VER
+                int fd = open(fname, O_RDONLY);
+                if (fd < 0) return false;
+                struct stat st;
+                if (fstat(fd, &st) != 0 || st.st_size == 0){
+                    close(fd); return false;
+                }
+                void *ptr = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+                // the mapping stays valid after the descriptor is closed
+                close(fd);
+                if (ptr == MAP_FAILED) return false;
+                dptr_ = static_cast<const char*>(ptr);
+                size_ = static_cast<size_t>(st.st_size);
+                return true;
+#else
+                return false;
+#endif
+            }
+            /*! \brief unmap the file */
+            inline void Close(void){
+#ifndef _MSC_VER
+                if (dptr_ != NULL){
+                    munmap(const_cast<char*>(dptr_), size_);
+                }
+#endif
+                dptr_ = NULL; size_ = 0;
+            }
+            /*! \return whether a file is mapped */
+            inline bool IsOpen(void) const{
+                return dptr_ != NULL;
+            }
+            /*! \return start of the mapped content */
+            inline const char *Data(void) const{
+                return dptr_;
+            }
+            /*! \return size of the mapped content in bytes */
+            inline size_t Size(void) const{
+                return size_;
+            }
+        private:
+            // mapping can not be shared between two owners
+            MMapFile(const MMapFile &);
+            MMapFile &operator=(const MMapFile &);
+        private:
+            /*! \brief start of the mapping */
+            const char *dptr_;
+            /*! \brief size of the mapping */
+            size_t size_;
+        };
+    };
+};
+#endif
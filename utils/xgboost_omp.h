@@ -11,8 +11,12 @@
 #include <omp.h>
 #else
 #warning "OpenMP is not available, compile to single thread code"
+#include <ctime>
 inline int omp_get_thread_num() { return 0; }
 inline int omp_get_num_threads() { return 1; }
 inline void omp_set_num_threads(int nthread) {}
+inline int omp_get_max_active_levels() { return 1; }
+inline void omp_set_max_active_levels(int levels) {}
+inline double omp_get_wtime() { return static_cast<double>(clock()) / CLOCKS_PER_SEC; }
 #endif
 #endif
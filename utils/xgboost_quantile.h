@@ -0,0 +1,262 @@
+#ifndef XGBOOST_QUANTILE_H
+#define XGBOOST_QUANTILE_H
+/*!
+ * \file xgboost_quantile.h
+ * \brief weighted quantile summary and sketch, the summary can be merged and pruned,
+ *        used to propose candidate split points from weighted data
+ * \author Tianqi Chen: tianqi.tchen@gmail.com
+ */
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "xgboost_utils.h"
+
+namespace xgboost{
+    namespace utils{
+        /*!
+         * \brief summary of weighted quantile, a list of entries sorted by value,
+         *        each entry gives the lower and upper bound of the rank of its value
+         * \tparam DType type of data value
+         * \tparam RType type of rank and weight
+         */
+        template<typename DType, typename RType>
+        struct WQSummary{
+            /*! \brief an entry in the summary */
+            struct Entry{
+                /*! \brief minimum rank */
+                RType rmin;
+                /*! \brief maximum rank */
+                RType rmax;
+                /*! \brief weight of the value itself */
+                RType wmin;
+                /*! \brief the value of data */
+                DType value;
+                /*! \brief constructor */
+                Entry(void){}
+                /*! \brief constructor */
+                Entry(RType rmin, RType rmax, RType wmin, DType value)
+                    : rmin(rmin), rmax(rmax), wmin(wmin), value(value){}
+                /*! \return rmin estimation of the value next to current one */
+                inline RType RMinNext(void) const{
+                    return rmin + wmin;
+                }
+                /*! \return rmax estimation of the value before current one */
+                inline RType RMaxPrev(void) const{
+                    return rmax - wmin;
+                }
+            };
+            /*! \brief entries of the summary */
+            std::vector<Entry> data;
+        public:
+            /*! \brief clear the summary */
+            inline void Clear(void){
+                data.clear();
+            }
+            /*! \return total weight of the summary */
+            inline RType MaxRank(void) const{
+                return data.size() == 0 ? RType(0) : data.back().rmax;
+            }
+            /*!
+             * \brief add a value from a sorted stream, the exact rank is kept
+             * \param value the value, must be no smaller than values pushed before
+             * \param weight weight of the value
+             */
+            inline void PushSorted(DType value, RType weight){
+                if (data.size() != 0 && data.back().value == value){
+                    data.back().rmax += weight;
+                    data.back().wmin += weight;
+                }
+                else{
+                    const RType r = this->MaxRank();
+                    data.push_back(Entry(r, r + weight, weight, value));
+                }
+            }
+            /*!
+             * \brief set the summary from a set of unsorted weighted values
+             * \param qdata pairs of value and weight, will be sorted by value
+             */
+            inline void SetFromPairs(std::vector< std::pair<DType, RType> > &qdata){
+                std::sort(qdata.begin(), qdata.end());
+                this->Clear();
+                for (size_t i = 0; i < qdata.size(); ++i){
+                    this->PushSorted(qdata[i].first, qdata[i].second);
+                }
+            }
+            /*!
+             * \brief set current summary to be pruned version of src,
+             *        keeps the first and last entry and at most maxsize entries in all
+             * \param src source summary
+             * \param maxsize maximum number of entries to keep, must be at least 2
+             */
+            inline void SetPrune(const WQSummary &src, size_t maxsize){
+                utils::Assert(maxsize >= 2, "WQSummary: prune size must be at least 2");
+                if (src.data.size() <= maxsize){
+                    this->data = src.data; return;
+                }
+                const size_t ssize = src.data.size();
+                const RType begin = src.data[0].rmax;
+                const RType range = src.data[ssize - 1].rmin - src.data[0].rmax;
+                const size_t n = maxsize - 1;
+                data.clear();
+                data.push_back(src.data[0]);
+                size_t i = 1, lastidx = 0;
+                for (size_t k = 1; k < n; ++k){
+                    // target rank of k-th entry, doubled to avoid division
+                    const RType dx2 = 2 * ((k * range) / n + begin);
+                    // find first i such that dx2 < rmax[i+1] + rmin[i+1]
+                    while (i < ssize - 1 && dx2 >= src.data[i + 1].rmax + src.data[i + 1].rmin) ++i;
+                    if (i == ssize - 1) break;
+                    if (dx2 < src.data[i].RMinNext() + src.data[i + 1].RMaxPrev()){
+                        if (i != lastidx){
+                            data.push_back(src.data[i]); lastidx = i;
+                        }
+                    }
+                    else{
+                        if (i + 1 != lastidx){
+                            data.push_back(src.data[i + 1]); lastidx = i + 1;
+                        }
+                    }
+                }
+                if (lastidx != ssize - 1){
+                    data.push_back(src.data[ssize - 1]);
+                }
+            }
+            /*!
+             * \brief set current summary to be the merge of two summaries
+             * \param sa first input summary
+             * \param sb second input summary
+             */
+            inline void SetCombine(const WQSummary &sa, const WQSummary &sb){
+                if (sa.data.size() == 0){
+                    this->data = sb.data; return;
+                }
+                if (sb.data.size() == 0){
+                    this->data = sa.data; return;
+                }
+                data.clear();
+                const Entry *a = &sa.data[0], *a_end = a + sa.data.size();
+                const Entry *b = &sb.data[0], *b_end = b + sb.data.size();
+                // extended rmin value of previous entry
+                RType aprev_rmin = 0, bprev_rmin = 0;
+                while (a != a_end && b != b_end){
+                    if (a->value == b->value){
+                        data.push_back(Entry(a->rmin + b->rmin, a->rmax + b->rmax,
+                                             a->wmin + b->wmin, a->value));
+                        aprev_rmin = a->RMinNext();
+                        bprev_rmin = b->RMinNext();
+                        ++a; ++b;
+                    }
+                    else if (a->value < b->value){
+                        data.push_back(Entry(a->rmin + bprev_rmin, a->rmax + b->RMaxPrev(),
+                                             a->wmin, a->value));
+                        aprev_rmin = a->RMinNext();
+                        ++a;
+                    }
+                    else{
+                        data.push_back(Entry(b->rmin + aprev_rmin, b->rmax + a->RMaxPrev(),
+                                             b->wmin, b->value));
+                        bprev_rmin = b->RMinNext();
+                        ++b;
+                    }
+                }
+                if (a != a_end){
+                    const RType brmax = (b_end - 1)->rmax;
+                    for (; a != a_end; ++a){
+                        data.push_back(Entry(a->rmin + bprev_rmin, a->rmax + brmax, a->wmin, a->value));
+                    }
+                }
+                if (b != b_end){
+                    const RType armax = (a_end - 1)->rmax;
+                    for (; b != b_end; ++b){
+                        data.push_back(Entry(b->rmin + aprev_rmin, b->rmax + armax, b->wmin, b->value));
+                    }
+                }
+            }
+        };
+    };
+
+    namespace utils{
+        /*!
+         * \brief streaming weighted quantile sketch, values can be pushed in any order,
+         *        keeps a hierarchy of pruned summaries so memory stays bounded,
+         *        sketches built on different parts of the data can be merged through their summaries
+         * \tparam DType type of data value
+         * \tparam RType type of rank and weight
+         */
+        template<typename DType, typename RType>
+        class WQuantileSketch{
+        public:
+            /*! \brief type of summary */
+            typedef WQSummary<DType, RType> Summary;
+            /*!
+             * \brief initialize the sketch
+             * \param maxn maximum number of values expected to be pushed
+             * \param eps accuracy of the sketch, rank error is bounded by eps times total weight
+             */
+            inline void Init(size_t maxn, double eps){
+                nlevel = 1;
+                while (true){
+                    limit_size = static_cast<size_t>(ceil(nlevel / eps)) + 1;
+                    if ((static_cast<size_t>(1) << nlevel) * limit_size >= maxn) break;
+                    ++nlevel;
+                }
+                inqueue.clear();
+                inqueue.reserve(limit_size * 2);
+                level.clear();
+            }
+            /*!
+             * \brief add a value to the sketch
+             * \param value the value
+             * \param weight weight of the value
+             */
+            inline void Push(DType value, RType weight = 1){
+                if (inqueue.size() == limit_size * 2){
+                    this->Flush();
+                }
+                inqueue.push_back(std::make_pair(value, weight));
+            }
+            /*!
+             * \brief get the summary of all values pushed so far
+             * \param out the output summary, has at most limit_size entries
+             */
+            inline void GetSummary(Summary &out){
+                this->Flush();
+                out.Clear();
+                for (size_t l = 0; l < level.size(); ++l){
+                    if (level[l].data.size() == 0) continue;
+                    temp.SetCombine(out, level[l]);
+                    out.SetPrune(temp, limit_size);
+                }
+            }
+        private:
+            // move values in the queue into the summary hierarchy
+            inline void Flush(void){
+                if (inqueue.size() == 0) return;
+                temp.SetFromPairs(inqueue);
+                inqueue.clear();
+                carry.SetPrune(temp, limit_size);
+                for (size_t l = 0; ; ++l){
+                    if (level.size() <= l) level.resize(l + 1);
+                    if (level[l].data.size() == 0){
+                        level[l].data.swap(carry.data); break;
+                    }
+                    temp.SetCombine(level[l], carry);
+                    carry.SetPrune(temp, limit_size);
+                    level[l].Clear();
+                }
+            }
+        private:
+            /*! \brief number of levels expected */
+            size_t nlevel;
+            /*! \brief maximum size of each summary */
+            size_t limit_size;
+            /*! \brief values that are not yet in the summary */
+            std::vector< std::pair<DType, RType> > inqueue;
+            /*! \brief summary of each level */
+            std::vector<Summary> level;
+            /*! \brief temp space */
+            Summary temp, carry;
+        };
+    };
+};
+#endif
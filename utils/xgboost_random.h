@@ -22,6 +22,36 @@ typedef unsigned int  uint32_t;
 /*! namespace of PRNG */
 namespace xgboost{
     namespace random{
+        /*! \brief random number generator with independent random number seed*/
+        struct Random{
+            /*! \brief set random number seed */
+            inline void Seed( unsigned sd ){
+                this->rseed = sd;
+            }
+            /*! \brief return a real number uniform in [0,1) */
+            inline double RandDouble( void ){               
+                return static_cast<double>( rand_r( &rseed ) ) / (static_cast<double>( RAND_MAX )+1.0);
+            }
+            // random number seed
+            unsigned rseed;
+        };
+    };
+
+    namespace random{
+        /*!
+         * \brief generator used by the calling thread in place of the global PRNG, NULL to use the global PRNG,
+         *        code running concurrently in several threads sets it to get a reproducible sequence in each thread
+         */
+        inline Random *&ThreadRandom(void){
+            static Random *rnd = NULL;
+            #pragma omp threadprivate(rnd)
+            return rnd;
+        }
+        /*! \brief return a random integer in [0,RAND_MAX] from the PRNG of the calling thread */
+        inline int Rand(void){
+            Random *rnd = ThreadRandom();
+            return rnd == NULL ? rand() : rand_r(&rnd->rseed);
+        }
         /*! \brief seed the PRNG */
         inline void Seed(uint32_t seed){
             srand(seed);
@@ -29,18 +59,18 @@ namespace xgboost{
 
         /*! \brief return a real number uniform in [0,1) */
         inline double NextDouble(){
-            return static_cast<double>(rand()) / (static_cast<double>(RAND_MAX)+1.0);
+            return static_cast<double>(Rand()) / (static_cast<double>(RAND_MAX)+1.0);
         }
         /*! \brief return a real numer uniform in (0,1) */
         inline double NextDouble2(){
-            return (static_cast<double>(rand()) + 1.0) / (static_cast<double>(RAND_MAX)+2.0);
+            return (static_cast<double>(Rand()) + 1.0) / (static_cast<double>(RAND_MAX)+2.0);
         }
     };
 
     namespace random{
         /*! \brief return a random number */
         inline uint32_t NextUInt32(void){
-            return (uint32_t)rand();
+            return (uint32_t)Rand();
         }
         /*! \brief return a random number in n */
         inline uint32_t NextUInt32(uint32_t n){
@@ -127,22 +157,6 @@ namespace xgboost{
             Shuffle(&data[0], data.size());
         }
     };
-    
-    namespace random{
-        /*! \brief random number generator with independent random number seed*/
-        struct Random{
-            /*! \brief set random number seed */
-            inline void Seed( unsigned sd ){
-                this->rseed = sd;
-            }
-            /*! \brief return a real number uniform in [0,1) */
-            inline double RandDouble( void ){               
-                return static_cast<double>( rand_r( &rseed ) ) / (static_cast<double>( RAND_MAX )+1.0);
-            }
-            // random number seed
-            unsigned rseed;
-        };
-    };
 };
 
 #endif
@@ -2,6 +2,8 @@
 #define XGBOOST_STREAM_H
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 /*!
  * \file xgboost_stream.h
  * \brief general stream interface for serialization
@@ -49,6 +51,28 @@ namespace xgboost{
                 fclose(fp);
             }
         };
+
+        /*! \brief read only stream over a memory region */
+        class MemoryStream : public IStream{
+        private:
+            const char *dptr;
+            size_t size, pos;
+        public:
+            MemoryStream(const char *dptr, size_t size){
+                this->dptr = dptr; this->size = size; this->pos = 0;
+            }
+            virtual size_t Read(void *ptr, size_t size){
+                // same convention as FileStream, returns 1 when the whole block is read
+                if (size > this->size - pos) return 0;
+                memcpy(ptr, dptr + pos, size);
+                pos += size;
+                return 1;
+            }
+            virtual void Write(const void *ptr, size_t size){
+                fprintf(stderr, "Error:MemoryStream is read only\n");
+                exit(-1);
+            }
+        };
     };
 };
 #endif
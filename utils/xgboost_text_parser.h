@@ -0,0 +1,206 @@
+#ifndef XGBOOST_TEXT_PARSER_H
+#define XGBOOST_TEXT_PARSER_H
+/*!
+ * \file xgboost_text_parser.h
+ * \brief helpers to parse whitespace separated text in parallel:
+ *        a reader that returns blocks of a file cut at whitespace, and number parsers
+ *        whose fast path gives exactly the same result as sscanf, they return false
+ *        when the token needs to be handled by sscanf
+ * \author Tianqi Chen: tianqi.tchen@gmail.com
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "xgboost_utils.h"
+
+#ifdef _MSC_VER
+typedef unsigned __int64 uint64_t;
+#else
+#include <inttypes.h>
+#endif
+
+namespace xgboost{
+    namespace utils{
+        /*! \return whether c is a separator, same set as isspace in C locale */
+        inline bool IsSpace(char c){
+            return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+        }
+        /*! \return whether c is a decimal digit */
+        inline bool IsDigit(char c){
+            return c >= '0' && c <= '9';
+        }
+        /*!
+         * \brief parse unsigned integer made of at most 9 digits, the whole range must be consumed
+         * \param p begin of the token
+         * \param end end of the token
+         * \param out output value
+         * \return whether the fast path applies
+         */
+        inline bool ParseUIntFast(const char *p, const char *end, unsigned *out){
+            if (p == end || end - p > 9) return false;
+            unsigned v = 0;
+            for (; p != end; ++p){
+                if (!IsDigit(*p)) return false;
+                v = v * 10 + static_cast<unsigned>(*p - '0');
+            }
+            *out = v;
+            return true;
+        }
+        /*!
+         * \brief parse decimal float such as -1.25e-3, the whole range must be consumed,
+         *        the result is the correctly rounded float, same as strtof,
+         *        inputs whose rounding can not be decided cheaply are left to the caller
+         * \param p begin of the token
+         * \param end end of the token
+         * \param out output value
+         * \return whether the fast path applies
+         */
+        inline bool ParseFloatFast(const char *p, const char *end, float *out){
+            static const double kPow10[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+            };
+            bool neg = false;
+            if (p != end && (*p == '-' || *p == '+')){
+                neg = *p == '-'; ++p;
+            }
+            // mantissa in decimal, and the power of ten applied to it
+            uint64_t m = 0;
+            int ndigit = 0, exp10 = 0;
+            bool any = false;
+            for (; p != end && IsDigit(*p); ++p){
+                any = true;
+                if (m == 0 && *p == '0') continue;
+                if (++ndigit > 15) return false;
+                m = m * 10 + static_cast<unsigned>(*p - '0');
+            }
+            if (p != end && *p == '.'){
+                for (++p; p != end && IsDigit(*p); ++p){
+                    any = true;
+                    if (m == 0 && *p == '0'){
+                        --exp10; continue;
+                    }
+                    if (++ndigit > 15) return false;
+                    m = m * 10 + static_cast<unsigned>(*p - '0');
+                    --exp10;
+                }
+            }
+            if (!any) return false;
+            if (p != end && (*p == 'e' || *p == 'E')){
+                ++p;
+                bool eneg = false;
+                if (p != end && (*p == '-' || *p == '+')){
+                    eneg = *p == '-'; ++p;
+                }
+                if (p == end) return false;
+                int e = 0;
+                for (; p != end && IsDigit(*p); ++p){
+                    if (e > 1000) return false;
+                    e = e * 10 + (*p - '0');
+                }
+                exp10 += eneg ? -e : e;
+            }
+            if (p != end) return false;
+            if (m == 0){
+                *out = neg ? -0.0f : 0.0f; return true;
+            }
+            // m and the power of ten are exact in double, so q is correctly rounded
+            if (exp10 < -22 || exp10 > 22) return false;
+            const double q = exp10 < 0 ? static_cast<double>(m) / kPow10[-exp10] : static_cast<double>(m) * kPow10[exp10];
+            // rounding q to float gives a different result from rounding the exact value
+            // only when q lands on the midpoint between two floats, leave that case to strtof
+            uint64_t bits;
+            memcpy(&bits, &q, sizeof(bits));
+            if ((bits & 0x1FFFFFFFULL) == 0x10000000ULL) return false;
+            const float f = static_cast<float>(q);
+            *out = neg ? -f : f;
+            return true;
+        }
+        /*! \brief fast path of unsigned integer, used by generic code */
+        inline bool ParseNumberFast(const char *p, const char *end, unsigned *out){
+            return ParseUIntFast(p, end, out);
+        }
+        /*! \brief fast path of float, used by generic code */
+        inline bool ParseNumberFast(const char *p, const char *end, float *out){
+            return ParseFloatFast(p, end, out);
+        }
+    };
+
+    namespace utils{
+        /*!
+         * \brief read a file block by block, each block ends at a whitespace,
+         *        so that no token is split between two blocks
+         */
+        class TextBlockReader{
+        public:
+            /*!
+             * \brief constructor
+             * \param fp file to read from, the file is not closed by the reader
+             * \param block_size size of each read
+             */
+            TextBlockReader(FILE *fp, size_t block_size = 16 << 20)
+                : fp_(fp), block_size_(block_size), keep_begin_(0), keep_end_(0), eof_(false){}
+            /*!
+             * \brief get next block
+             * \param begin begin of the block
+             * \param end end of the block
+             * \return false if the whole file has been read
+             */
+            inline bool Next(const char **begin, const char **end){
+                // move the unfinished token of last block to the front
+                size_t nkeep = keep_end_ - keep_begin_;
+                if (nkeep != 0) memmove(&buf_[0], &buf_[0] + keep_begin_, nkeep);
+                keep_begin_ = keep_end_ = 0;
+                if (eof_ && nkeep == 0) return false;
+                if (buf_.size() < block_size_) buf_.resize(block_size_);
+                while (true){
+                    if (!eof_){
+                        if (nkeep == buf_.size()) buf_.resize(buf_.size() * 2);
+                        const size_t nread = fread(&buf_[0] + nkeep, 1, buf_.size() - nkeep, fp_);
+                        if (nread != buf_.size() - nkeep) eof_ = true;
+                        nkeep += nread;
+                    }
+                    if (eof_){
+                        *begin = &buf_[0]; *end = &buf_[0] + nkeep;
+                        return nkeep != 0;
+                    }
+                    // cut after the last whitespace, the rest is kept for next block
+                    size_t cut = nkeep;
+                    while (cut != 0 && !IsSpace(buf_[cut - 1])) --cut;
+                    if (cut != 0){
+                        keep_begin_ = cut; keep_end_ = nkeep;
+                        *begin = &buf_[0]; *end = &buf_[0] + cut;
+                        return true;
+                    }
+                    // a single token fills the buffer, read more
+                }
+            }
+            /*!
+             * \brief split a block into chunks at whitespace
+             * \param begin begin of the block
+             * \param end end of the block
+             * \param nchunk number of chunks wanted
+             * \param bounds output, chunk i is [bounds[i], bounds[i+1])
+             */
+            inline static void Split(const char *begin, const char *end, size_t nchunk, std::vector<const char*> &bounds){
+                bounds.clear();
+                bounds.push_back(begin);
+                const size_t step = static_cast<size_t>(end - begin) / nchunk + 1;
+                for (size_t i = 1; i < nchunk; ++i){
+                    const char *p = bounds.back() + step;
+                    if (p >= end) break;
+                    while (p != end && !IsSpace(*p)) ++p;
+                    bounds.push_back(p);
+                }
+                bounds.push_back(end);
+            }
+        private:
+            FILE *fp_;
+            size_t block_size_;
+            std::vector<char> buf_;
+            size_t keep_begin_, keep_end_;
+            bool eof_;
+        };
+    };
+};
+#endif
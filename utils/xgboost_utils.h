@@ -54,6 +54,13 @@ namespace xgboost{
             fprintf(stderr, "warning:%s\n", msg);
         }
 
+        /*! \brief hint the processor to bring the cache line holding addr closer, used ahead of random reads */
+        inline void Prefetch(const void *addr){
+#if defined(__GNUC__)
+            __builtin_prefetch(addr, 0, 3);
+#endif
+        }
+
         /*! \brief replace fopen, report error when the file open fails */
         inline FILE *FopenCheck(const char *fname, const char *flag){
             FILE *fp = fopen64(fname, flag);